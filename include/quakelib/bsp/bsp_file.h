@@ -1,9 +1,12 @@
 #pragma once
 
 #include "vect.h"
+#include <cstddef>
 #include <iostream>
+#include <iterator>
 #include <map>
 #include <memory>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -24,10 +27,23 @@ namespace quakelib::bsp {
 
   const uint32_t MAGIC_V29 = 29;
   const uint32_t MAGIC_V30 = 30;
+  // extended limit formats, 32-bit indices
+  const uint32_t MAGIC_BSP2 = 'B' | 'S' << 8 | 'P' << 16 | '2' << 24;
+  const uint32_t MAGIC_2PSB = '2' | 'P' << 8 | 'S' << 16 | 'B' << 24;
 
   const int NUM_HEADER_LUMPS = 15;
+
+  // leaf and clipnode contents
+  const int CONTENTS_EMPTY = -1;
+  const int CONTENTS_SOLID = -2;
+  const int CONTENTS_WATER = -3;
+  const int CONTENTS_SLIME = -4;
+  const int CONTENTS_LAVA = -5;
+  const int CONTENTS_SKY = -6;
   const int MAX_TEXNAME = 16;
   const int MAX_MIPLEVEL = 4;
+  const int MAX_LIGHTMAPS = 4;     // style layers per face
+  const int MAX_LIGHTSTYLES = 256; // style 255 marks an unused layer
 
   enum ELumpType {
     LUMP_ENTITIES = 0,
@@ -53,7 +69,7 @@ namespace quakelib::bsp {
   };
 
   struct header_t {
-    uint32_t version;              // version of the BSP format (29 or 30)
+    uint32_t version;              // version of the BSP format (29, 30, MAGIC_BSP2 or MAGIC_2PSB)
     lump_t lump[NUM_HEADER_LUMPS]; // directory of the lumps
   };
 
@@ -65,21 +81,25 @@ namespace quakelib::bsp {
     int32_t type;   // Type of plane, depending on normal vector.
   };
 
+  // The edge, face, node, clipnode and leaf structs below use the 32-bit BSP2 layout,
+  // so BSP2 lumps are used in place. Version 29 and 30 (the *29_t structs) and 2PSB
+  // lumps stay in their on-disk layout and are widened per element, see LumpView.
+
   struct fEdge_t {
-    uint16_t vertex0; // index of the start vertex
+    uint32_t vertex0; // index of the start vertex
                       //  must be in [0,numvertices[
-    uint16_t vertex1; // index of the end vertex
+    uint32_t vertex1; // index of the end vertex
                       //  must be in [0,numvertices[
   };
 
   struct fFace_t {
-    uint16_t plane_id;      // The plane in which the face lies
+    int32_t plane_id;       // The plane in which the face lies
                             //           must be in [0,numplanes[
-    uint16_t side;          // 0 if in front of the plane, 1 if behind the plane
+    int32_t side;           // 0 if in front of the plane, 1 if behind the plane
     uint32_t ledge_id;      // first edge in the List of edges
                             //           must be in [0,numledges[
-    uint16_t ledge_num;     // number of edges in the List of edges
-    uint16_t texinfo_id;    // index of the Texture info the face is part of
+    int32_t ledge_num;      // number of edges in the List of edges
+    int32_t texinfo_id;     // index of the Texture info the face is part of
                             //           must be in [0,numtexinfos[
     unsigned char light[4]; // two additional light models
     int32_t lightmap;       // Pointer inside the general light map, or -1
@@ -123,42 +143,246 @@ namespace quakelib::bsp {
   };
 
   struct fNode_t {
-    int plane_id;      // The plane that splits the node
+    int32_t plane_id;  // The plane that splits the node
                        //           must be in [0,numplanes[
-    int16_t front;     // If bit15==0, index of Front child node
-                       // If bit15==1, ~front = index of child leaf
-    int16_t back;      // If bit15==0, id of Back child node
-                       // If bit15==1, ~back =  id of child leaf
-    bbox3s_t box;      // Bounding box of node and all childs
-    uint16_t face_id;  // Index of first Polygons in the node
-    uint16_t face_num; // Number of faces in the node
+    int32_t front;     // If positive, index of Front child node
+                       // If negative, ~front = index of child leaf
+    int32_t back;      // If positive, id of Back child node
+                       // If negative, ~back =  id of child leaf
+    bbox3f_t box;      // Bounding box of node and all childs
+    uint32_t face_id;  // Index of first Polygons in the node
+    uint32_t face_num; // Number of faces in the node
+  };
+
+  struct fClipNode_t {
+    int32_t plane_id; // The plane that splits the node
+    int32_t front;    // If positive, id of Front child node
+                      // If negative, contents of the front side (CONTENTS_*)
+    int32_t back;     // If positive, id of Back child node
+                      // If negative, contents of the back side (CONTENTS_*)
   };
 
   struct fLeaf_t {
     int32_t type;           // Special type of leaf
     int32_t vislist;        // Beginning of visibility lists
                             //     must be -1 or in [0,numvislist[
-    bbox3s_t bound;         // Bounding box of the leaf
-    uint16_t lface_id;      // First item of the list of faces
+    bbox3f_t bound;         // Bounding box of the leaf
+    uint32_t lface_id;      // First item of the list of faces
                             //     must be in [0,numlfaces[
-    uint16_t lface_num;     // Number of faces in the leaf
+    uint32_t lface_num;     // Number of faces in the leaf
     unsigned char sndwater; // level of the four ambient sounds:
     unsigned char sndsky;   //   0    is no sound
     unsigned char sndslime; //   0xFF is maximum volume
     unsigned char sndlava;  //
   };
 
+  struct fEdge29_t {
+    uint16_t vertex0;
+    uint16_t vertex1;
+  };
+
+  struct fFace29_t {
+    uint16_t plane_id;
+    uint16_t side;
+    uint32_t ledge_id;
+    uint16_t ledge_num;
+    uint16_t texinfo_id;
+    unsigned char light[4];
+    int32_t lightmap;
+  };
+
+  struct fNode29_t {
+    int32_t plane_id;
+    uint16_t front; // below numnodes a node, otherwise 0xffff - leaf
+    uint16_t back;
+    bbox3s_t box;
+    uint16_t face_id;
+    uint16_t face_num;
+  };
+
+  struct fClipNode29_t {
+    int32_t plane_id;
+    uint16_t front; // below numclipnodes a node, otherwise contents + 0x10000
+    uint16_t back;
+  };
+
+  struct fLeaf29_t {
+    int32_t type;
+    int32_t vislist;
+    bbox3s_t bound;
+    uint16_t lface_id;
+    uint16_t lface_num;
+    unsigned char ambient[4];
+  };
+
+  // 2PSB has 32-bit indices like BSP2, but keeps the short bounds of version 29
+  struct fNode2PSB_t {
+    int32_t plane_id;
+    int32_t front;
+    int32_t back;
+    bbox3s_t box;
+    uint32_t face_id;
+    uint32_t face_num;
+  };
+
+  struct fLeaf2PSB_t {
+    int32_t type;
+    int32_t vislist;
+    bbox3s_t bound;
+    uint32_t lface_id;
+    uint32_t lface_num;
+    unsigned char ambient[4];
+  };
+
+  /**
+   * @brief Read-only bytes of a whole BSP file.
+   *
+   * The file is either read into one owned allocation or memory-mapped
+   * (copy-on-write, where the platform supports it). Lump views in
+   * bspFileContent point into this buffer, so it has to outlive them.
+   */
+  class BspFileBuffer {
+  public:
+    BspFileBuffer() = default;
+    ~BspFileBuffer();
+    BspFileBuffer(const BspFileBuffer &) = delete;
+    BspFileBuffer &operator=(const BspFileBuffer &) = delete;
+
+    /**
+     * @brief Opens a file, replacing any previous content.
+     * @param filename Path to the file.
+     * @param memoryMap Map the file instead of reading it, falls back to reading if mapping fails.
+     * @return False if the file could not be opened or read.
+     */
+    bool Open(const char *filename, bool memoryMap);
+
+    /**
+     * @brief Releases the owned memory or the mapping.
+     */
+    void Close();
+
+    const unsigned char *Data() const { return m_data; }
+
+    size_t Size() const { return m_size; }
+
+    bool IsMapped() const { return m_mapped; }
+
+  private:
+    vector<unsigned char> m_owned;
+    const unsigned char *m_data = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false;
+  };
+
+  /**
+   * @brief Read-only array view of one indexed lump.
+   *
+   * A lump stored in the BSP2 layout of T is read in place. A lump in one of the
+   * smaller version 29/30 or 2PSB layouts is not copied: each element is widened
+   * to T when it is accessed, so elements are returned by value. The iterators
+   * return widened values as well, like operator[].
+   */
+  template <typename T> class LumpView {
+  public:
+    class const_iterator {
+    public:
+      using iterator_concept = std::random_access_iterator_tag;
+      using iterator_category = std::input_iterator_tag; // elements are returned by value
+      using value_type = T;
+      using difference_type = std::ptrdiff_t;
+      using reference = T;
+
+      const_iterator() = default;
+      const_iterator(const LumpView *view, difference_type index) : m_view(view), m_index(index) {}
+
+      T operator*() const { return (*m_view)[m_index]; }
+      T operator[](difference_type n) const { return (*m_view)[m_index + n]; }
+
+      const_iterator &operator++() { return ++m_index, *this; }
+      const_iterator operator++(int) { return {m_view, m_index++}; }
+      const_iterator &operator--() { return --m_index, *this; }
+      const_iterator operator--(int) { return {m_view, m_index--}; }
+      const_iterator &operator+=(difference_type n) { return m_index += n, *this; }
+      const_iterator &operator-=(difference_type n) { return m_index -= n, *this; }
+
+      friend const_iterator operator+(const_iterator it, difference_type n) { return it += n; }
+      friend const_iterator operator+(difference_type n, const_iterator it) { return it += n; }
+      friend const_iterator operator-(const_iterator it, difference_type n) { return it -= n; }
+      friend difference_type operator-(const const_iterator &a, const const_iterator &b) {
+        return a.m_index - b.m_index;
+      }
+      friend bool operator==(const const_iterator &a, const const_iterator &b) {
+        return a.m_index == b.m_index;
+      }
+      friend auto operator<=>(const const_iterator &a, const const_iterator &b) {
+        return a.m_index <=> b.m_index;
+      }
+
+    private:
+      const LumpView *m_view = nullptr;
+      difference_type m_index = 0;
+    };
+    using iterator = const_iterator;
+    using value_type = T;
+    using size_type = size_t;
+
+    /// Widens the on-disk element at data, count is the number of elements in the lump.
+    using Widen = T (*)(const unsigned char *data, size_t count);
+
+    LumpView() = default;
+
+    LumpView(std::span<const T> items)
+        : m_data(reinterpret_cast<const unsigned char *>(items.data())), m_size(items.size()) {}
+
+    LumpView(const vector<T> &items) : LumpView(std::span<const T>(items)) {}
+
+    LumpView(const unsigned char *data, size_t size, size_t stride, Widen widen)
+        : m_data(data), m_size(size), m_stride(stride), m_widen(widen) {}
+
+    T operator[](size_t i) const {
+      if (m_widen)
+        return m_widen(m_data + i * m_stride, m_size);
+      return reinterpret_cast<const T *>(m_data)[i];
+    }
+
+    size_t size() const { return m_size; }
+
+    bool empty() const { return m_size == 0; }
+
+    const_iterator begin() const { return {this, 0}; }
+
+    const_iterator end() const { return {this, static_cast<std::ptrdiff_t>(m_size)}; }
+
+  private:
+    const unsigned char *m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_stride = sizeof(T);
+    Widen m_widen = nullptr;
+  };
+
+  /**
+   * @brief Lumps of a loaded BSP file.
+   *
+   * Every lump is a view into the BspFileBuffer of the owning QBsp. Lumps that
+   * are not suitably aligned for their element type are copied once into
+   * storage owned by the QBsp.
+   */
   struct bspFileContent {
     header_t header;
-    vector<fPlane_t> planes;
-    vector<fLeaf_t> leafs;
-    vector<fNode_t> nodes;
-    vector<vec3f_t> vertices;
-    vector<fFace_t> faces;
-    vector<fEdge_t> edges;
-    vector<fSurfaceInfo_t> surfaces;
-    vector<fModel_t> models;
+    std::span<const fPlane_t> planes;
+    LumpView<fLeaf_t> leafs;
+    LumpView<fNode_t> nodes;
+    LumpView<fClipNode_t> clipNodes;
+    std::span<const vec3f_t> vertices;
+    LumpView<fFace_t> faces;
+    LumpView<fEdge_t> edges;
+    std::span<const fSurfaceInfo_t> surfaces;
+    std::span<const fModel_t> models;
     vector<miptex_t> miptextures;
-    vector<int32_t> surfEdges;
+    std::span<const int32_t> surfEdges;
+    std::span<const unsigned char> lighting;
+    std::span<const unsigned char> visibility;
+    LumpView<uint32_t> markSurfaces;
+    std::span<const char> entities;
   };
 } // namespace quakelib::bsp
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "bsp_file.h"
+#include "flat_plane.h"
+
+namespace quakelib::bsp {
+  /**
+   * @brief Result of BspTree::TraceRay.
+   */
+  struct BspRayHit {
+    float fraction; ///< Position of the hit along start to end, 0 to 1
+    vec3f_t point;  ///< Hit position
+    vec3f_t normal; ///< Normal of the hit face
+    int face;       ///< Index into bspFileContent::faces
+  };
+
+  /**
+   * @brief Flattened render node tree of the world model.
+   *
+   * Nodes are copied once into a compact array with their splitting plane
+   * inlined and the 16-bit child references decoded, so queries never touch
+   * the plane lump. Axial planes (fPlane_t::type 0 to 2) take a single
+   * component instead of a dot product. All queries are allocation-free.
+   *
+   * Planes are converted when the file is loaded with
+   * QBspConfig::convertCoordToOGL, queries use the coordinate system of the
+   * loaded geometry.
+   */
+  class BspTree {
+  public:
+    BspTree() = default;
+
+    /**
+     * @brief Builds the flat tree from the node and plane lumps.
+     * @param ctx Lumps of the file, must outlive this object.
+     * @param oglCoords Convert planes to OpenGL coordinates.
+     */
+    BspTree(const bspFileContent &ctx, bool oglCoords);
+
+    /**
+     * @brief Finds the world leaf containing a point.
+     * @return Leaf index, 0 is the shared solid leaf outside the level.
+     */
+    int PointInLeaf(const vec3f_t &point) const;
+
+    /**
+     * @brief Contents (CONTENTS_*) of the world leaf containing a point.
+     */
+    int PointContents(const vec3f_t &point) const;
+
+    /**
+     * @brief Finds the first world face hit by a segment.
+     *
+     * Only faces turned towards the segment start are hit, like a visible
+     * surface pick.
+     *
+     * @return True on a hit, hit is left untouched otherwise.
+     */
+    bool TraceRay(const vec3f_t &start, const vec3f_t &end, BspRayHit &hit) const;
+
+    /**
+     * @brief Collects the world leaves overlapping an axis aligned box.
+     * @param leaves Receives up to maxLeaves leaf indices.
+     * @return Number of overlapping leaves, may exceed maxLeaves.
+     */
+    int BoxLeaves(const vec3f_t &mins, const vec3f_t &maxs, int *leaves, int maxLeaves) const;
+
+    bool Empty() const { return m_nodes.empty(); }
+
+  private:
+    struct Node : detail::FlatPlane {
+      int children[2]; // node index, or -(leaf + 1)
+      int firstFace;
+      int numFaces;
+    };
+
+    bool traceNode(int node, const vec3f_t &p1, const vec3f_t &p2, float f1, float f2, const vec3f_t &start,
+                   const vec3f_t &end, BspRayHit &hit) const;
+    bool faceContains(const Node &node, int face, const vec3f_t &p) const;
+    vec3f_t vertex(int surfEdge) const;
+    void boxLeaves(int node, const vec3f_t &mins, const vec3f_t &maxs, int *leaves, int maxLeaves,
+                   int &count) const;
+
+    const bspFileContent *m_ctx = nullptr;
+    bool m_oglCoords = false;
+    int m_root = -1;
+    vector<Node> m_nodes;
+  };
+} // namespace quakelib::bsp
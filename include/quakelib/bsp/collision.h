@@ -0,0 +1,107 @@
+#pragma once
+
+#include "bsp_file.h"
+#include "flat_plane.h"
+#include <array>
+#include <span>
+
+namespace quakelib::bsp {
+  /**
+   * @brief Result of a hull trace, modelled after Quake's trace_t.
+   */
+  struct BspTrace {
+    float fraction = 1.0f;         ///< Completed part of start to end, 1 if nothing was hit
+    vec3f_t endPos;                ///< Position the trace stopped at
+    vec3f_t planeNormal;           ///< Normal of the impact plane, facing the start point
+    float planeDist = 0.0f;        ///< Distance of the impact plane
+    int contents = CONTENTS_EMPTY; ///< CONTENTS_SOLID or CONTENTS_SKY on impact
+    bool startSolid = false;       ///< The start point is inside solid
+    bool allSolid = false;         ///< The whole trace is inside solid
+    bool inWater = false;          ///< Passed through water, slime or lava
+  };
+
+  /**
+   * @brief Segment for BspCollision::TraceBatch.
+   */
+  struct BspRay {
+    vec3f_t start;
+    vec3f_t end;
+  };
+
+  /**
+   * @brief Swept box traces against the clipping hulls of a BSP.
+   *
+   * Hull 0 is a point sized trace through the render nodes, hulls 1 and 2
+   * are the expanded clipnode hulls the compiler builds for the standard
+   * monster sizes: (-16 -16 -24, 16 16 32) and (-32 -32 -24, 32 32 64) in
+   * Quake. A box trace is a point trace of the box origin through the hull
+   * matching its size. Hull 3 is only present in some formats.
+   *
+   * Solid and sky stop a trace, water, slime and lava do not. Planes are
+   * converted once when the file is loaded with QBspConfig::convertCoordToOGL.
+   */
+  class BspCollision {
+  public:
+    static constexpr int MAX_HULLS = 4;
+
+    BspCollision() = default;
+
+    /**
+     * @brief Builds the flat hulls from the node, clipnode and plane lumps.
+     * @param ctx Lumps of the file, must outlive this object.
+     * @param oglCoords Convert planes to OpenGL coordinates.
+     */
+    BspCollision(const bspFileContent &ctx, bool oglCoords);
+
+    /**
+     * @brief Traces a segment through a hull of a model.
+     *
+     * Positions are relative to the model, subtract the entity origin for
+     * moving brush models.
+     *
+     * @param hullIndex 0 to MAX_HULLS - 1.
+     * @param model Index into bspFileContent::models, 0 is the world.
+     */
+    BspTrace Trace(const vec3f_t &start, const vec3f_t &end, int hullIndex, int model = 0) const;
+
+    /**
+     * @brief Traces many segments against the same hull, spread over all cores.
+     * @param out Receives one result per ray, must be at least as large as rays.
+     */
+    void TraceBatch(std::span<const BspRay> rays, std::span<BspTrace> out, int hullIndex,
+                    int model = 0) const;
+
+    /**
+     * @brief Contents (CONTENTS_*) of a hull at a point.
+     */
+    int PointContents(const vec3f_t &point, int hullIndex, int model = 0) const;
+
+    /**
+     * @brief Tests if a segment is unobstructed in hull 0 of the world.
+     */
+    bool LineOfSight(const vec3f_t &start, const vec3f_t &end) const {
+      return Trace(start, end, 0).fraction == 1.0f;
+    }
+
+    int NumModels() const { return (int)m_roots.size(); }
+
+  private:
+    struct Node : detail::FlatPlane {
+      int children[2]; // node index, or contents if negative
+    };
+
+    struct Hull {
+      const vector<Node> *nodes;
+      int root;
+    };
+
+    bool hull(int hullIndex, int model, Hull &out) const;
+    int contents(const Hull &hull, int node, const vec3f_t &p) const;
+    bool recursiveCheck(const Hull &hull, int node, float p1f, float p2f, const vec3f_t &p1,
+                        const vec3f_t &p2, BspTrace &trace) const;
+
+    vector<Node> m_renderNodes; // hull 0, leaves resolved to their contents
+    vector<Node> m_clipNodes;   // hulls 1 to 3
+    vector<std::array<int, MAX_HULLS>> m_roots;
+  };
+} // namespace quakelib::bsp
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "bsp_file.h"
+#include "primitives.h"
+
+namespace quakelib::bsp {
+  class QBsp;
+  class BspVisibility;
+
+  /**
+   * @brief Convex culling volume, up to six planes.
+   *
+   * A point p is inside when planes[i].x * p.x + planes[i].y * p.y +
+   * planes[i].z * p.z + planes[i].w >= 0 for every plane.
+   */
+  struct BspFrustum {
+    vec4f_t planes[6];
+    int count = 0;
+
+    /**
+     * @brief Extracts the six clip planes of a view-projection matrix.
+     * @param m Column-major matrix with OpenGL clip space (-w to w on every axis).
+     */
+    static BspFrustum FromMatrix(const float *m);
+
+    /**
+     * @brief Tests if an axis aligned box is at least partially inside.
+     */
+    bool IntersectsBox(const vec3f_t &mins, const vec3f_t &maxs) const;
+  };
+
+  /**
+   * @brief Contiguous run of one texture in BspDrawListBuilder::Indices().
+   */
+  struct BspDrawRange {
+    int texture;         ///< Index into bspFileContent::miptextures
+    uint32_t firstIndex; ///< First index of the run
+    uint32_t indexCount; ///< Number of indices in the run
+  };
+
+  /**
+   * @brief Result of BspDrawListBuilder::Build.
+   */
+  struct BspDrawList {
+    vector<int> surfaces;        ///< Visible world faces, grouped by texture
+    vector<BspDrawRange> ranges; ///< Draw calls, sorted by texture
+  };
+
+  /**
+   * @brief Builds per-frame draw lists of the world model.
+   *
+   * The world faces are packed once into a static vertex and index buffer,
+   * sorted by texture, so every frame only produces index ranges into it.
+   * Culling walks the node tree with the node bounds and stops at subtrees
+   * outside the frustum; planes a node is fully inside of are not tested
+   * again below it. With a PVS leaf, nodes without a visible leaf below them
+   * are skipped without a bounds test, the marking is redone only when the
+   * leaf changes. Per-frame cost follows the visible part of the level.
+   *
+   * Builds share state and are not thread-safe.
+   */
+  class BspDrawListBuilder {
+  public:
+    /**
+     * @brief Packs the world geometry of a loaded file.
+     * @param bsp Loaded file, must outlive this object. Builds its geometry if loaded lazily.
+     */
+    explicit BspDrawListBuilder(const QBsp &bsp);
+
+    /**
+     * @brief Collects the world faces inside a frustum.
+     * @param pvsLeaf Only consider leaves visible from this leaf (see BspVisibility), -1 disables the filter.
+     * @return Draw list, valid until the next Build.
+     */
+    const BspDrawList &Build(const BspFrustum &frustum, int pvsLeaf = -1);
+
+    /**
+     * @brief Static vertex buffer, same coordinate system as the loaded geometry.
+     *
+     * Lightmap coordinates refer to the whole atlas with its pages stacked, see Lightmap::Pages().
+     */
+    const vector<Vertex> &Vertices() const { return m_vertices; }
+
+    /**
+     * @brief Static index buffer, the faces of one texture are contiguous.
+     */
+    const vector<uint32_t> &Indices() const { return m_indices; }
+
+  private:
+    struct Bounds {
+      vec3f_t mins;
+      vec3f_t maxs;
+    };
+
+    struct Node {
+      Bounds bounds;
+      int children[2]; // node index, or -(leaf + 1)
+      int parent;
+      uint32_t visFrame;
+    };
+
+    struct Leaf {
+      Bounds bounds;
+      int firstMark;
+      int numMarks;
+      int parent;
+      uint32_t visFrame;
+    };
+
+    struct Face {
+      Bounds bounds;
+      uint32_t firstIndex;
+      uint32_t indexCount; // 0 for faces outside the world model
+      int texture;
+      uint32_t frame;
+    };
+
+    void markLeaves(int pvsLeaf);
+    void walk(int node, int clipMask);
+    void addLeaf(int leaf, int clipMask);
+    static int clipBox(const BspFrustum &frustum, const Bounds &bounds, int &clipMask);
+
+    const bspFileContent *m_ctx = nullptr;
+    const BspVisibility *m_vis = nullptr;
+    int m_root = -1;
+    vector<Vertex> m_vertices;
+    vector<uint32_t> m_indices;
+    vector<Node> m_nodes;
+    vector<Leaf> m_leaves;
+    vector<Face> m_faces;
+
+    // per-build state
+    const BspFrustum *m_frustum = nullptr;
+    bool m_usePvs = false;
+    int m_pvsLeaf = -1;
+    uint32_t m_visFrame = 0;
+    uint32_t m_frame = 0;
+    BspDrawList m_list;
+  };
+} // namespace quakelib::bsp
@@ -2,6 +2,7 @@
 
 #include "bsp_file.h"
 #include "primitives.h"
+#include <functional>
 #include <quakelib/entities.h>
 
 namespace quakelib::bsp {
@@ -9,17 +10,28 @@ namespace quakelib::bsp {
   public:
     SolidEntity(const bspFileContent &ctx, ParsedEntity *pe);
     const std::vector<SurfacePtr> &Faces();
+
+    // Contiguous vertices, indices and surfaces of all faces, nullptr for entities without a model
+    const SurfaceStore *Surfaces();
     bool IsWorldSpawn();
+    int ModelID() const { return m_modelId; }
 
   protected:
     void convertToOpenGLCoords();
 
   private:
+    int allocateFaces();
+    void buildFace(int face);
     void buildBSPTree(const fNode_t &);
     void getSurfaceIDsFromLeaf(int leafID);
     int getVertIndexFromEdge(int surfEdge);
-    std::vector<SurfacePtr> m_faces;
+    std::vector<SurfacePtr> m_faces; // views into m_store
+    SurfaceStorePtr m_store;
     int m_modelId = 0;
+    int m_firstFace = 0;
+    const bspFileContent *m_ctx = nullptr;
+    bool m_facesBuilt = false;
+    std::function<void()> m_requestGeometry; // set by a lazily loading QBsp, builds all models on demand
 
     friend class QBsp;
   };
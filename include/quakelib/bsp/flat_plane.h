@@ -0,0 +1,50 @@
+#pragma once
+
+#include "bsp_file.h"
+
+namespace quakelib::bsp::detail {
+  /**
+   * @brief Converts a point or direction from Quake to OpenGL coordinates.
+   *
+   * y up, z towards the viewer: (x, y, z) becomes (x, z, -y).
+   */
+  inline vec3f_t ToOGLCoords(const vec3f_t &v) { return {v.x, v.z, -v.y}; }
+
+  /**
+   * @brief Splitting plane of a flattened BspTree or BspCollision node.
+   *
+   * Implementation detail shared by both node arrays, so planes are read and
+   * converted to OpenGL coordinates in one place.
+   */
+  struct FlatPlane {
+    float normal[3];
+    float dist;
+    int type; // 0 to 2 for axial planes, uses normal otherwise
+
+    /// Copies a plane from the plane lump, the axial type follows the axis swap.
+    void SetPlane(const fPlane_t &plane, bool oglCoords) {
+      vec3f_t n = oglCoords ? ToOGLCoords(plane.normal) : plane.normal;
+      normal[0] = n.x;
+      normal[1] = n.y;
+      normal[2] = n.z;
+      dist = plane.dist;
+      type = plane.type;
+      if (oglCoords && (type == 1 || type == 2))
+        type = 3 - type;
+    }
+
+    /// Signed distance of p, a single multiply for axial planes.
+    float Distance(const vec3f_t &p) const {
+      switch (type) {
+      case 0:
+        return p.x * normal[0] - dist;
+      case 1:
+        return p.y * normal[1] - dist;
+      case 2:
+        return p.z * normal[2] - dist;
+      default:
+        return p.x * normal[0] + p.y * normal[1] + p.z * normal[2] - dist;
+      }
+    }
+  };
+} // namespace quakelib::bsp::detail
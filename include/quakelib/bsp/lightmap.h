@@ -1,12 +1,10 @@
 #pragma once
 
 #include "entity_solid.h"
+#include <span>
+#include <string_view>
 
 namespace quakelib::bsp {
-  const int LM_BLOCK_WIDTH = 256;
-  const int LM_BLOCK_HEIGHT = 256;
-  const int MAX_SANITY_LIGHTMAPS = (1u << 20);
-
   struct Color {
     union {
       struct {
@@ -21,41 +19,94 @@ namespace quakelib::bsp {
     };
   };
 
-  struct LightmapChart {
-    bool reverse;
-    int x;
+  // Bottom-left skyline allocator for one lightmap page
+  struct LightmapSkyline {
+    struct Segment {
+      int x, y, width;
+    };
+
+    LightmapSkyline(int width, int height);
+
+    // Returns false if the rectangle does not fit
+    bool Insert(int w, int h, int &outx, int &outy);
+
     int width;
     int height;
-    int *allocated;
+    int usedWidth = 0;
+    int usedHeight = 0;
+    vector<Segment> segments;
+  };
+
+  // Area of the stacked atlas image rewritten by Lightmap::UpdateStyles
+  struct LightmapRect {
+    int x, y, width, height;
   };
 
   class Lightmap {
   public:
-    Lightmap(uint8_t *data, size_t sz);
+    // pageSize 0 packs a single atlas sized to fit, otherwise pages of at most pageSize x pageSize.
+    // data holds sz RGB samples, or sz grey samples for a luminance atlas, and must outlive the Lightmap.
+    Lightmap(const uint8_t *data, size_t sz, int pageSize = 0, bool luminance = false);
     void PackLitSurfaces(std::vector<SolidEntityPtr> ent);
 
+    // Pages are stacked vertically in the atlas, Height() is Pages() * PageHeight().
+    // Surface::lm_tex_num holds the page of a surface, its lm_uv are relative to that page.
     const int Width() const;
     const int Height() const;
+    int Pages() const { return m_pages; }
+    int PageHeight() const { return m_pageHeight; }
+
+    // 4 for an RGBA atlas, 1 for a luminance (R8) atlas
+    int Channels() const { return m_luminance ? 1 : 4; }
+
+    // The atlas texels, Width() * Height() * Channels() bytes, without a copy
+    std::span<const uint8_t> Data() const;
+
+    // The atlas texels of an RGBA atlas, empty for a luminance atlas
     const vector<Color> &RGBA() const;
 
+    // Style intensities are in 1/256 steps, 256 keeps the baked samples. Every style starts at 256.
+    int StyleValue(int style) const;
+
+    // Sets the intensity of styles 0..values.size()-1 and recomposites only the surfaces using a
+    // style that changed. Returns the rewritten areas, valid until the next call.
+    const vector<LightmapRect> &UpdateStyles(std::span<const int> values);
+
+    // Value of a Quake style pattern such as "mmnmmommommnonmmonqnmmo" at time seconds, 10 steps per
+    // second. 'a' is dark, 'm' is 264 and 'z' is 550, an empty pattern is 256.
+    static int EvaluateStyle(std::string_view pattern, float time);
+
   private:
-    void initChart(LightmapChart *chart, int width, int height);
-    bool addChart(LightmapChart *chart, int w, int h, short *outx, short *outy);
-    int allocateBlock(int w, int h, short *x, short *y);
-    void fillSurfaceLightmap(SurfacePtr surf);
+    struct Rect {
+      SurfacePtr surf; // null for the reserved texels
+      int w, h;
+      int x = 0, y = 0, page = 0;
+    };
+
+    bool packPages(vector<Rect> &rects, int width, int height, vector<LightmapSkyline> &pages) const;
+    void fillSurfaceLightmap(size_t index);
 
-    LightmapChart m_chart;
-    std::vector<vec2i_t> m_offsets;
     std::vector<SurfacePtr> m_litSurfs;
+    vector<uint8_t> m_styleCount;        // sample layers present per surface in m_litSurfs
+    vector<vector<int>> m_styleSurfaces; // surfaces using each style
+    int m_styleValues[MAX_LIGHTSTYLES];
+    vector<uint32_t> m_accum;
+    vector<uint8_t> m_composite;
+    vector<uint32_t> m_stamp;
+    uint32_t m_frame = 0;
+    vector<LightmapRect> m_dirty;
 
-    uint8_t *m_rawData;
+    const uint8_t *m_rawData;
     vector<Color> m_lightmapData;
+    vector<uint8_t> m_luminanceData;
+    bool m_luminance = false;
     size_t m_size = 0;
-    int m_count = 0;
+    int m_pageSize = 0;
     int m_sampleCount = 0;
-    int m_lastAllocated = 0;
 
     int m_width = 0;
     int m_height = 0;
+    int m_pages = 0;
+    int m_pageHeight = 0;
   };
-} // namespace quakelib::bsp
\ No newline at end of file
+} // namespace quakelib::bsp
@@ -1,6 +1,7 @@
 #pragma once
 #include "bsp_file.h"
 #include <memory>
+#include <span>
 
 namespace quakelib::bsp {
   struct Vertex {
@@ -10,17 +11,22 @@ namespace quakelib::bsp {
     vec2f_t lm_uv;
   };
 
+  // View of one face inside the SurfaceStore of its model
   class Surface {
   public:
-    void Build(const bspFileContent &ctx, const fFace_t *fsurface);
+    // Fills verts and indices, which must hold ledge_num and (ledge_num - 2) * 3 elements
+    void Build(const bspFileContent &ctx, const fFace_t &fsurface, std::span<Vertex> verts,
+               std::span<uint32_t> indices);
     int id;
     int lightmapID;
     const fSurfaceInfo_t *info;
-    const fFace_t *fsurface;
+    fFace_t fsurface; // Widened copy of the face lump entry
     const miptex_t *textureReference;
-    vector<Vertex> verts;
-    vector<uint32_t> indices;
-    uint8_t *lm_samples;
+    std::span<Vertex> verts;     // Slice of SurfaceStore::vertices
+    std::span<uint32_t> indices; // Slice of SurfaceStore::indices, relative to the first vertex of the face
+    uint32_t firstVertex;        // Offset of verts in SurfaceStore::vertices
+    uint32_t firstIndex;         // Offset of indices in SurfaceStore::indices
+    const uint8_t *lm_samples;
     int lm_tex_num;
     int extents[2];
     int texturemins[2];
@@ -32,4 +38,14 @@ namespace quakelib::bsp {
   };
 
   typedef std::shared_ptr<Surface> SurfacePtr;
+
+  // Contiguous geometry of all faces of one model, built with one allocation per array.
+  // The SurfacePtrs handed out by the entity share ownership of the whole store.
+  struct SurfaceStore {
+    vector<Vertex> vertices;
+    vector<uint32_t> indices;
+    vector<Surface> surfaces;
+  };
+
+  typedef std::shared_ptr<SurfaceStore> SurfaceStorePtr;
 } // namespace quakelib::bsp
\ No newline at end of file
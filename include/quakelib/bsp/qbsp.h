@@ -1,15 +1,18 @@
 #pragma once
 
 #include "bsp_file.h"
+#include "collision.h"
 #include "entity_solid.h"
 #include "lightmap.h"
 #include "primitives.h"
+#include "visibility.h"
 #include <quakelib/config.h>
 #include <quakelib/entities.h>
 
 #include <fstream>
 #include <functional>
 #include <map>
+#include <memory>
 
 namespace quakelib::bsp {
   using EntityPtr = std::shared_ptr<quakelib::Entity>;
@@ -17,6 +20,8 @@ namespace quakelib::bsp {
   enum EQBspStatus {
     QBSP_OK = 0,
     QBSP_ERR_WRONG_VERSION = -1001,
+    QBSP_ERR_OPEN_FAILED = -1002,
+    QBSP_ERR_CORRUPT_LUMP = -1003,
   };
 
   struct bspTexure {
@@ -32,8 +37,8 @@ namespace quakelib::bsp {
     uint32_t id;
     uint32_t width;
     uint32_t height;
-    bool hasData;
-    unsigned char *data;
+    bool hasData = false;
+    const unsigned char *data = nullptr; ///< Points into the read-only file buffer, valid as long as the QBsp
   };
 
   /**
@@ -59,6 +64,65 @@ namespace quakelib::bsp {
      * (names and dimensions) to reduce memory usage.
      */
     bool loadTextureData = true;
+
+    /**
+     * @brief Memory-map the BSP file instead of reading it.
+     *
+     * Lumps are views into the file either way. Mapping skips the upfront
+     * read, pages are only touched when a lump is accessed. Falls back to
+     * reading where mapping is not available.
+     */
+    bool memoryMap = false;
+
+    /**
+     * @brief Defer texture and geometry processing until first use.
+     *
+     * LoadFile only validates the lumps and parses the entities. Texture
+     * headers are read on the first Textures() or Content() call. Surfaces of
+     * all models and the lightmap atlas are built together on the first
+     * Faces() or LightMap() call, since the atlas packs every model's faces.
+     * The node tree, PVS and hull queries are built on the first Tree(),
+     * Vis() or Collision() call. The file buffer stays open for the
+     * lifetime of the QBsp. Lazy accessors are not thread-safe.
+     */
+    bool lazyLoad = false;
+
+    /**
+     * @brief Build surfaces and read texture headers on all cores.
+     *
+     * Faces of all models are built in parallel chunks into their
+     * preallocated model arrays, and texture headers are read in parallel
+     * straight from the file buffer. The result is identical to a serial
+     * load.
+     */
+    bool parallelLoad = false;
+
+    /**
+     * @brief Faces or textures a parallelLoad worker takes at a time.
+     *
+     * 0 keeps the defaults of 256 faces and 16 textures. Files with fewer
+     * items than one chunk are loaded on the calling thread only.
+     */
+    size_t parallelChunkSize = 0;
+
+    /**
+     * @brief Maximum lightmap page size in texels, 0 for a single atlas.
+     *
+     * With 0 all faces are packed into one atlas sized to fit them. Otherwise
+     * faces are spread over as many pages of at most this size as needed,
+     * see Lightmap::Pages(). A face larger than the limit widens the pages.
+     */
+    int lightmapPageSize = 0;
+
+    /**
+     * @brief Keep the lightmap atlas single channel when there is no .lit file.
+     *
+     * The grey samples of the lighting lump are packed into an R8 atlas
+     * instead of being expanded to RGB and stored as RGBA, a quarter of the
+     * memory. Lightmap::Data() returns the texels, Lightmap::RGBA() stays
+     * empty. Colored .lit lighting always produces an RGBA atlas.
+     */
+    bool luminanceLightmap = false;
   };
 
   /**
@@ -94,14 +158,26 @@ namespace quakelib::bsp {
 
     /**
      * @brief Destructor.
+     *
+     * Lazy geometry requests of entities that outlive the QBsp are
+     * disconnected. Their faces still point into the file buffer and the
+     * parsed lumps, don't use them after the QBsp is destroyed.
      */
-    ~QBsp() = default;
+    ~QBsp();
+
+    // entities, the node tree and the lightmap point into the QBsp
+    QBsp(const QBsp &) = delete;
+    QBsp &operator=(const QBsp &) = delete;
+    QBsp(QBsp &&) = delete;
+    QBsp &operator=(QBsp &&) = delete;
 
     /**
      * @brief Load a BSP file from disk.
      *
      * Loads all lumps from the BSP file including geometry, textures,
      * entities, and lighting data according to the configuration.
+     * The file is kept in a single buffer, lumps and texture pixels are
+     * views into it rather than copies.
      *
      * @param filename Path to the .bsp file.
      * @return QBSP_OK on success, or an error code (e.g., QBSP_ERR_WRONG_VERSION).
@@ -110,10 +186,15 @@ namespace quakelib::bsp {
 
     /**
      * @brief Get the BSP file format version.
-     * @return Version number (typically 29 or 30 for Quake).
+     * @return Version number, 29 or 30, or MAGIC_BSP2 / MAGIC_2PSB for the extended limit formats.
      */
     uint32_t Version() const;
 
+    /**
+     * @brief Get the configuration the file was loaded with.
+     */
+    const QBspConfig &Config() const { return m_config; }
+
     /**
      * @brief Get the worldspawn entity.
      *
@@ -191,14 +272,56 @@ namespace quakelib::bsp {
      */
     const Lightmap *LightMap() const;
 
+    /**
+     * @brief Get the lightmap data for animating light styles.
+     *
+     * @see Lightmap::UpdateStyles
+     * @return Pointer to lightmap object, or nullptr if no lightmap data.
+     */
+    Lightmap *LightMap();
+
+    /**
+     * @brief Get the PVS queries for this file.
+     *
+     * Positions are expected in the same coordinate system as the loaded
+     * geometry, see QBspConfig::convertCoordToOGL.
+     *
+     * @return Visibility queries, valid as long as the QBsp.
+     */
+    const BspVisibility &Vis() const;
+
+    /**
+     * @brief Get the flattened node tree of the world model.
+     *
+     * Uses the same coordinate system as the loaded geometry.
+     *
+     * @return Point, ray and box queries, valid as long as the QBsp.
+     */
+    const BspTree &Tree() const;
+
+    /**
+     * @brief Get the hull traces for the world and the brush models.
+     *
+     * Uses the same coordinate system as the loaded geometry.
+     *
+     * @return Trace queries, valid as long as the QBsp.
+     */
+    const BspCollision &Collision() const;
+
   private:
     void parseEntities(const char *entsrc);
-    int loadTextureInfo();
+    int loadTextureInfo() const;
     void prepareLevel();
-    void prepareLightMaps();
-    void loadTexelBuff(unsigned char **buffOut, uint32_t offset, uint32_t len);
+    void prepareLightMaps() const;
+    void ensureTextures() const;
+    void ensureGeometry() const;
+    bool loadIndexedLumps();
+    template <typename T> bool viewLump(int lumpType, std::span<const T> &out);
+    template <typename T> bool viewLump(int lumpType, LumpView<T> &out);
+    template <typename D, auto widen, typename T> bool widenLump(int lumpType, LumpView<T> &out);
 
-    std::ifstream m_istream;
+    BspFileBuffer m_file;
+    vector<vector<unsigned char>> m_ownedLumps; // realigned lumps
     QBspConfig m_config;
     string m_mapPath = "";
 
@@ -206,10 +329,20 @@ namespace quakelib::bsp {
     std::map<string, vector<EntityPtr>> m_entities;
     vector<SolidEntityPtr> m_solidEntities;
 
-    vector<bspTexure> m_textures;
     SolidEntityPtr m_worldSpawn;
 
-    bspFileContent m_content;
-    Lightmap *m_lm;
+    // filled on first access when lazyLoad is set
+    mutable BspTree m_tree;
+    mutable BspVisibility m_vis;
+    mutable BspCollision m_collision;
+    mutable bool m_treeBuilt = false;
+    mutable bool m_visBuilt = false;
+    mutable bool m_collisionBuilt = false;
+    mutable vector<bspTexure> m_textures;
+    mutable bspFileContent m_content;
+    mutable vector<uint8_t> m_lmSamples; // RGB samples the lightmap reads, must outlive m_lm
+    mutable std::unique_ptr<Lightmap> m_lm;
+    mutable bool m_texturesLoaded = false;
+    mutable bool m_geometryLoaded = false;
   };
 } // namespace quakelib::bsp
\ No newline at end of file
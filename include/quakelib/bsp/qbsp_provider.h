@@ -52,12 +52,21 @@ namespace quakelib {
     std::vector<PointEntityPtr> GetPointEntities() const override;
     std::vector<PointEntityPtr> GetPointEntities(const std::string &className) const override;
     std::vector<std::string> GetTextureNames() const override;
+
+    /**
+     * @brief Builds the render meshes of an entity, one per texture.
+     *
+     * Meshes are cached per entity until the next Load or SetFaceType call,
+     * so the mesh and meshlet exports of the wrapper share one build.
+     */
     std::vector<RenderMesh> GetEntityMeshes(const SolidEntityPtr &entity) override;
     std::optional<TextureData> GetTextureData(const std::string &name) const override;
     std::optional<TextureData> GetLightmapData() const override;
+    std::optional<TextureView> GetLightmapView() const override;
 
   private:
     std::unique_ptr<quakelib::bsp::QBsp> m_bsp;
     std::map<std::string, SurfaceType> m_faceTypes;
+    std::map<const bsp::SolidEntity *, std::vector<RenderMesh>> m_meshCache;
   };
 } // namespace quakelib
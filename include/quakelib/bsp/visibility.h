@@ -0,0 +1,90 @@
+#pragma once
+
+#include "bsp_file.h"
+#include "bsp_tree.h"
+#include <deque>
+
+namespace quakelib::bsp {
+  /**
+   * @brief Potentially visible set queries on a loaded BSP.
+   *
+   * Decompresses the run-length encoded PVS of a leaf the first time it is
+   * queried and caches the row together with its visible leaves and
+   * surfaces, so repeated queries from the same leaf are lookups. Leaves
+   * without visibility data see every leaf, like in the Quake engine.
+   *
+   * At most MAX_CACHED_LEAVES leaves are cached, the one decompressed first is
+   * dropped when another leaf is queried. The vectors returned by the queries
+   * stay valid, but a dropped leaf's vectors are emptied, so use them before
+   * querying that many other leaves.
+   *
+   * The cache is filled from const queries and is not thread-safe.
+   */
+  class BspVisibility {
+  public:
+    BspVisibility() = default;
+
+    /**
+     * @brief Binds the visibility data of a loaded file.
+     * @param ctx Lumps of the file, must outlive this object.
+     * @param tree Node tree used to locate points, must outlive this object.
+     */
+    BspVisibility(const bspFileContent &ctx, const BspTree &tree);
+
+    /**
+     * @brief Finds the world leaf containing a point, see BspTree::PointInLeaf.
+     */
+    int PointInLeaf(const vec3f_t &point) const { return m_tree ? m_tree->PointInLeaf(point) : 0; }
+
+    /**
+     * @brief Decompressed PVS row of a leaf.
+     * @return One bit per visible leaf, bit (n - 1) stands for leaf n.
+     */
+    const vector<uint8_t> &LeafPVS(int leaf) const;
+
+    /**
+     * @brief Tests if a leaf is potentially visible from another.
+     */
+    bool LeafSees(int fromLeaf, int toLeaf) const;
+
+    /**
+     * @brief Leaves potentially visible from a leaf, in ascending order.
+     */
+    const vector<int> &VisibleLeaves(int leaf) const;
+
+    /**
+     * @brief World faces potentially visible from a leaf, ascending indices into bspFileContent::faces.
+     */
+    const vector<int> &VisibleSurfaces(int leaf) const;
+
+    const vector<int> &VisibleLeaves(const vec3f_t &point) const { return VisibleLeaves(PointInLeaf(point)); }
+
+    const vector<int> &VisibleSurfaces(const vec3f_t &point) const {
+      return VisibleSurfaces(PointInLeaf(point));
+    }
+
+    /**
+     * @brief Number of leaves covered by the PVS, leaf 0 excluded.
+     */
+    int NumVisLeaves() const { return m_numLeaves; }
+
+    static constexpr size_t MAX_CACHED_LEAVES = 256;
+
+  private:
+    struct LeafCache {
+      bool ready = false;
+      vector<uint8_t> pvs;
+      vector<int> leaves;
+      vector<int> surfaces;
+    };
+
+    const LeafCache &cached(int leaf) const;
+    void decompress(int leaf, vector<uint8_t> &out) const;
+
+    const bspFileContent *m_ctx = nullptr;
+    const BspTree *m_tree = nullptr;
+    int m_numLeaves = 0;
+    mutable vector<LeafCache> m_cache;
+    mutable std::deque<int> m_cacheOrder; // ready leaves, oldest first
+  };
+} // namespace quakelib::bsp
@@ -16,5 +16,35 @@ namespace quakelib {
      * @note This affects vertices, normals, and entity positions.
      */
     bool convertCoordToOGL = false;
+
+    /**
+     * @brief Merge adjacent coplanar faces before triangulation.
+     *
+     * Providers combine neighbouring faces of the same plane and texture
+     * projection into larger convex polygons when building render meshes,
+     * which cuts triangle and vertex counts. BSP faces with their own
+     * lightmap area are only merged when their lightmap coordinates line up.
+     *
+     * @see MergeCoplanarPolygons
+     */
+    bool mergeCoplanarFaces = false;
+
+    /**
+     * @brief Reorder provider meshes for the post-transform vertex cache.
+     *
+     * Triangles are reordered for cache reuse and vertices renumbered in
+     * the order they are first used. RenderMesh::stats reports the average
+     * cache miss ratio before and after.
+     *
+     * @see OptimizeMesh
+     */
+    bool optimizeVertexCache = false;
+
+    /**
+     * @brief Also reorder triangle clusters to reduce overdraw.
+     *
+     * Only used together with optimizeVertexCache.
+     */
+    bool optimizeOverdraw = false;
   };
 } // namespace quakelib
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <quakelib/map_provider.h>
+#include <quakelib/vertex.h>
+#include <vector>
+
+namespace quakelib {
+  /**
+   * @brief Convex polygon taking part in coplanar face merging.
+   */
+  struct MergePolygon {
+    std::vector<Vertex> vertices; ///< Boundary in winding order, the same orientation for all faces.
+    int group = 0;                ///< Only polygons of the same group are merged, e.g. the texture.
+  };
+
+  /**
+   * @brief Merge adjacent coplanar polygons into larger convex ones.
+   *
+   * Two polygons of the same group are merged when they lie on the same
+   * plane, share an edge, interpolate the same normal, texture and lightmap
+   * coordinates, and the result is convex. Vertices left in the middle of a
+   * straight edge are dropped unless another polygon uses their position,
+   * so no T-junctions are introduced. Polygons of every group count as users,
+   * so pass all faces of an entity in one call with the texture as group
+   * rather than merging each texture on its own.
+   *
+   * @param polygons Polygons to merge in place, absorbed polygons are removed.
+   * @return Number of merges performed.
+   */
+  int MergeCoplanarPolygons(std::vector<MergePolygon> &polygons);
+
+  /**
+   * @brief Append polygons to a mesh as triangle fans.
+   *
+   * Vertices with identical attributes are shared.
+   *
+   * @param mesh Mesh to append to.
+   * @param polygons Convex polygons to triangulate.
+   */
+  void AppendPolygons(RenderMesh &mesh, const std::vector<MergePolygon> &polygons);
+} // namespace quakelib
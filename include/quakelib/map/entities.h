@@ -11,6 +11,17 @@
 #include <quakelib/entities.h>
 
 namespace quakelib::map {
+  // result of the outside fill pass, see QMapConfig::outsideFill
+  struct OutsideFillResult {
+    bool ran = false;             // the pass ran, it needs worldspawn and at least one point entity
+    bool leaked = false;          // a point entity is reachable from outside the map, nothing was removed
+    std::string leakEntity;       // classname of the entity that leaked
+    Vec3 leakOrigin{0, 0, 0};     // and its origin
+    std::vector<Vec3> leakPath;   // voxel centres from the entity to the outside, like a pointfile
+    size_t removedFaces = 0;      // faces that only border the outside
+    float voxelSize = 0;          // voxel size used, grown for very large maps
+  };
+
   class SolidMapEntity : public SolidEntity {
   public:
     const std::vector<Brush> &GetOriginalBrushes() { return m_brushes; }
@@ -35,6 +46,12 @@ namespace quakelib::map {
     // stats getter
     long long StatsClippedFaces() const { return m_stats_clippedFaces; }
 
+    // identical earlier entity whose geometry this one shares, see QMapConfig::instanceBrushEntities
+    const std::shared_ptr<SolidMapEntity> &Prototype() const { return m_prototype; }
+
+    // translation from the prototype to this entity
+    const Vec3 &InstanceOffset() const { return m_instanceOffset; }
+
   private:
     void generateMesh(const std::map<int, MapSurface::eFaceType> &faceTypes,
                       const std::map<int, textureBounds> &texBounds);
@@ -43,6 +60,8 @@ namespace quakelib::map {
     void fixTJunctions();
     void removeCollinearVertices();
     void triangulateFaces();
+    OutsideFillResult outsideFill(const std::vector<std::shared_ptr<PointEntity>> &pointEntities,
+                                  const std::vector<std::string> &textureNames, float voxelSize);
 
     std::vector<Brush> m_brushes;
     std::vector<Brush> m_clippedBrushes;
@@ -50,6 +69,8 @@ namespace quakelib::map {
     std::vector<int> m_textureIDs;
     long long m_stats_clippedFaces{};
     bool m_wasClipped = false;
+    std::shared_ptr<SolidMapEntity> m_prototype;
+    Vec3 m_instanceOffset{0, 0, 0};
 
     Vec3 m_center{0};
     Vec3 m_min{0};
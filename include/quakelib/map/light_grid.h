@@ -0,0 +1,57 @@
+#pragma once
+
+#include <quakelib/map/types.h>
+#include <vector>
+
+namespace quakelib::map {
+
+  // Irradiance from the six axis directions, order +X, -X, +Y, -Y, +Z, -Z
+  struct AmbientCube {
+    Vec3 faces[6];
+
+    // Irradiance for a unit normal, the faces are blended by the squared normal components
+    Vec3 Evaluate(const Vec3 &normal) const;
+  };
+
+  // Regular grid of ambient cubes covering the level, baked by LightmapGenerator::BakeLightGrid.
+  // Dynamic objects look up their lighting with one trilinear fetch instead of evaluating lights.
+  class LightGrid {
+  public:
+    LightGrid() = default;
+    LightGrid(const Vec3 &origin, float cellSize, int sizeX, int sizeY, int sizeZ);
+
+    const Vec3 &Origin() const { return m_origin; }
+
+    float CellSize() const { return m_cellSize; }
+
+    int Size(int axis) const { return m_size[axis]; }
+
+    bool Empty() const { return m_cells.empty(); }
+
+    // World position of a grid point
+    Vec3 CellPosition(int x, int y, int z) const;
+
+    AmbientCube &Cell(int x, int y, int z) { return m_cells[cellIndex(x, y, z)]; }
+
+    const AmbientCube &Cell(int x, int y, int z) const { return m_cells[cellIndex(x, y, z)]; }
+
+    // All cells, x varies fastest, then y, then z
+    const std::vector<AmbientCube> &Cells() const { return m_cells; }
+
+    // Trilinear blend of the eight surrounding grid points, positions outside are clamped to the grid
+    AmbientCube Sample(const Vec3 &pos) const;
+
+    Vec3 Evaluate(const Vec3 &pos, const Vec3 &normal) const { return Sample(pos).Evaluate(normal); }
+
+  private:
+    size_t cellIndex(int x, int y, int z) const {
+      return (static_cast<size_t>(z) * m_size[1] + y) * m_size[0] + x;
+    }
+
+    Vec3 m_origin{0, 0, 0};
+    float m_cellSize = 0;
+    int m_size[3] = {0, 0, 0};
+    std::vector<AmbientCube> m_cells;
+  };
+
+} // namespace quakelib::map
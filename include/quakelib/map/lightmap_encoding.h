@@ -0,0 +1,25 @@
+#pragma once
+
+#include <quakelib/map/types.h>
+
+namespace quakelib::map {
+
+  // 8-bit per channel encodings for HDR lightmaps, same memory as a plain RGBA8 atlas
+  enum class LightmapEncoding {
+    RGBA8,  // Clamped to [0, 1], alpha is always 255
+    RGBM,   // rgb * a * range, a shared multiplier keeps overbright light up to range
+    LOGLUV, // Chromaticity in rg, 16-bit log luminance split over ba
+  };
+
+  // Default RGBM range, light above this value saturates
+  constexpr float LIGHTMAP_RGBM_RANGE = 6.0f;
+
+  void EncodeRGBM(const Vec3 &color, float range, unsigned char *out);
+  Vec3 DecodeRGBM(const unsigned char *in, float range);
+
+  // LogLuv as used in shaders: luminance covers 2^-63.5 .. 2^64.5, decode with
+  // Le = b * 255 + a * 255 / 256; Y = exp2((Le - 127) / 2)
+  void EncodeLogLuv(const Vec3 &color, unsigned char *out);
+  Vec3 DecodeLogLuv(const unsigned char *in);
+
+} // namespace quakelib::map
@@ -1,28 +1,56 @@
 #pragma once
 
+#include <functional>
 #include <quakelib/map/entities.h>
+#include <quakelib/map/light_grid.h>
+#include <quakelib/map/lightmap_encoding.h>
+#include <quakelib/map/lightmap_tracer.h>
 #include <vector>
 
 namespace quakelib::map {
 
   struct LightmapEntry {
-    int x, y; // Position in atlas
-    int w, h; // Size in atlas
+    int x, y;         // Position in atlas
+    int w, h;         // Size in atlas
+    Vec2 minUV;       // Lightmap space origin of the face
+    Vec3 min, max;    // World-space bounds of the face's luxel centers
+    size_t luxelBase; // First luxel of this entry in the luxel buffer, w * h luxels row by row
     FacePtr face;
   };
 
+  // Flat per-luxel surface data, built once after packing and shared by every lighting pass.
+  struct LuxelBuffer {
+    std::vector<Vec3> position;  // World position, pushed off the surface along the normal
+    std::vector<Vec3> normal;    // Plane normal of the owning face
+    std::vector<int> atlasIndex; // Pixel index into the atlas, -1 if clipped by the atlas border
+
+    size_t Size() const { return position.size(); }
+  };
+
   class LightmapGenerator {
   public:
     LightmapGenerator(int width = 512, int height = 512, float luxelSize = 16.0f);
 
     // Packs all faces from the provided entities into the atlas
-    // Returns false if the atlas is too small
+    // Returns false if the atlas is too small, leaving nothing packed and the lighting cleared
+    // Instanced entities (QMapConfig::instanceBrushEntities) get no atlas space of their own, they
+    // block light for occlusion, bounces and the light grid but show the prototype's lightmap,
+    // which is baked at the prototype's position. Disable instancing for final bakes.
     bool Pack(const std::vector<SolidEntityPtr> &entities);
 
     // Get the generated atlas data (RGBA or single channel)
     // Currently returns a simple debug pattern/white texture
     const std::vector<unsigned char> &GetAtlasData() const;
 
+    // Unclamped linear light per atlas pixel, three floats (RGB) per pixel.
+    // Built from the float luxel buffers, so overbright light and small bounce contributions survive.
+    // Pixels outside every face hold the ambient color, all zero before CalculateLighting.
+    std::vector<float> GetHDRAtlasData() const;
+
+    // HDR atlas packed into RGBA8, same size and layout as GetAtlasData
+    std::vector<unsigned char> GetEncodedAtlasData(LightmapEncoding encoding,
+                                                   float rgbmRange = LIGHTMAP_RGBM_RANGE) const;
+
     int GetWidth() const { return m_width; }
 
     int GetHeight() const { return m_height; }
@@ -36,14 +64,98 @@ namespace quakelib::map {
     void CalculateLighting(const std::vector<Light> &lights,
                            Vec3 ambientColor = {30.0f / 255.0f, 30.0f / 255.0f, 30.0f / 255.0f});
 
+    // Incremental relighting for interactive light edits.
+    // Only entries whose bounds touch the old or the new light sphere are re-evaluated,
+    // everything else keeps its baked value. Falls back to a full CalculateLighting
+    // if no lighting has been baked yet. Each call returns the number of relit entries.
+    // Bounce light from CalculateBounces is dropped on every entry, run it again after the edits.
+    int UpdateLight(size_t index, const Light &light);
+    int AddLight(const Light &light);
+    int RemoveLight(size_t index);
+
+    const std::vector<Light> &Lights() const { return m_lights; }
+
+    struct BounceSettings {
+      int bounces = 2;           // Number of indirect bounces to compute
+      int samples = 64;          // Hemisphere rays gathered per patch
+      int patchSize = 4;         // Patch edge length in luxels, luxels interpolate between patch centers
+      float reflectivity = 0.5f; // Fraction of incoming light re-emitted by every surface
+      float maxDistance = 8192.0f;
+    };
+
+    // Called after every finished bounce, the atlas already contains the refined result.
+    // Return false to stop refining.
+    using BounceProgressCb = std::function<bool(int bounce, int bounces)>;
+
+    // Progressive indirect lighting on top of CalculateLighting.
+    // The direct-only atlas stays usable while bounces are refined, each pass gathers the
+    // previous pass' light per patch against the shared LightmapTracer.
+    // The result is only valid for the current lights, UpdateLight, AddLight and RemoveLight discard it.
+    // Returns the number of completed bounces.
+    int CalculateBounces(const BounceSettings &settings, const BounceProgressCb &progress = nullptr);
+
+    struct OcclusionSettings {
+      int samples = 32;          // Hemisphere rays per luxel, low for previews, high for final bakes
+      float maxDistance = 64.0f; // Geometry further away than this does not occlude
+      float strength = 1.0f;     // 0 disables, 1 darkens fully occluded luxels to black
+      bool applyToAtlas = true;  // Multiply the atlas by the result, otherwise only fill Occlusion()
+    };
+
+    // Baked ambient occlusion from cosine-weighted hemisphere rays per luxel.
+    // Rays are traced in packets of LightmapTracer::PACKET_SIZE. The result is kept per luxel
+    // and survives relighting until the next Pack.
+    void CalculateOcclusion(const OcclusionSettings &settings);
+
+    // Per-luxel occlusion factor, 1 is fully open
+    const std::vector<float> &Occlusion() const { return m_occlusion; }
+
+    struct LightGridSettings {
+      float cellSize = 64.0f;      // Grid spacing in world units
+      int samples = 32;            // Sphere rays per grid point picking up baked surface light, 0 disables
+      float reflectivity = 0.5f;   // Same meaning as in BounceSettings
+      float maxDistance = 8192.0f; // Range of the surface light rays
+      bool shadows = true;         // Trace a shadow ray to every light in range
+    };
+
+    // Bakes an ambient cube grid over the bounds of the packed faces for lighting dynamic objects.
+    // Uses the current light list and ambient, plus the baked direct and bounce light of the surfaces.
+    LightGrid BakeLightGrid(const LightGridSettings &settings);
+
+    const std::vector<LightmapEntry> &Entries() const { return m_entries; }
+
+    const LuxelBuffer &Luxels() const { return m_luxels; }
+
   private:
     void GenerateAtlasImage();
+    void reset();
+    void buildLuxels();
+    void lightEntry(const LightmapEntry &entry);
+    void encodeLuxel(size_t luxel);
+    Vec3 luxelLight(size_t luxel) const;
+    bool traceLuxel(const LightmapTracer &bvh, const Vec3 &origin, const Vec3 &dir, float maxDist,
+                    size_t &luxel) const;
+    int relightSpheres(const Light &a, const Light &b);
+    const LightmapTracer &tracer();
 
     int m_width;
     int m_height;
     float m_luxelSize;
     std::vector<unsigned char> m_data;
     std::vector<LightmapEntry> m_entries;
+    LuxelBuffer m_luxels;
+    std::vector<Vec3> m_direct;   // Direct light per luxel, without ambient
+    std::vector<Vec3> m_indirect; // Accumulated bounce light per luxel
+    std::vector<float> m_occlusion;
+    bool m_applyOcclusion = false;
+    std::vector<SolidEntityPtr> m_instances; // Instances of packed entities, traced but not packed
+    LightmapTracer m_tracer;
+    std::vector<size_t> m_traceEntry; // Entry of every traced face
+    std::vector<Vec3> m_traceOffset;  // Instance offset of every traced face
+    bool m_tracerBuilt = false;
+    std::vector<Light> m_lights;
+    Vec3 m_ambient{30.0f / 255.0f, 30.0f / 255.0f, 30.0f / 255.0f};
+    bool m_lit = false;
+    bool m_bounced = false; // m_indirect holds bounce light from CalculateBounces
   };
 
 } // namespace quakelib::map
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <quakelib/map/face.h>
+#include <vector>
+
+namespace quakelib::map {
+
+  // Bounding volume hierarchy over the triangles of a set of faces.
+  // Shared by all lightmap passes that need visibility (bounces, occlusion).
+  class LightmapTracer {
+  public:
+    struct Hit {
+      float t;  // Distance along the ray
+      int face; // Index of the hit face in the list passed to Build
+    };
+
+    // Builds the hierarchy, triangles keep the index of the face they came from.
+    // offsets is empty or holds one translation per face, for faces shared by instanced entities.
+    void Build(const std::vector<FacePtr> &faces, const std::vector<Vec3> &offsets = {});
+
+    bool Empty() const { return m_nodes.empty(); }
+
+    // Closest hit along a normalized direction within maxDist
+    bool Intersect(const Vec3 &origin, const Vec3 &dir, float maxDist, Hit &hit) const;
+
+    // Any hit along a normalized direction within maxDist
+    bool Occluded(const Vec3 &origin, const Vec3 &dir, float maxDist) const;
+
+    static constexpr int PACKET_SIZE = 8;
+
+    // Rays in structure-of-arrays layout, traced together through one walk of the hierarchy
+    struct RayPacket {
+      float ox[PACKET_SIZE]{}, oy[PACKET_SIZE]{}, oz[PACKET_SIZE]{};
+      float dx[PACKET_SIZE]{}, dy[PACKET_SIZE]{}, dz[PACKET_SIZE]{};
+      int count = 0;
+
+      void Add(const Vec3 &origin, const Vec3 &dir) {
+        ox[count] = origin[0], oy[count] = origin[1], oz[count] = origin[2];
+        dx[count] = dir[0], dy[count] = dir[1], dz[count] = dir[2];
+        count++;
+      }
+    };
+
+    // Any hit test for every ray of the packet, returns the number of occluded rays
+    int OccludedPacket(const RayPacket &packet, float maxDist, bool (&occluded)[PACKET_SIZE]) const;
+
+  private:
+    struct Node {
+      Vec3 min, max;
+      int first; // First triangle for leaves, left child for inner nodes (right is first + 1)
+      int count; // Triangle count, 0 for inner nodes
+    };
+
+    struct Triangle {
+      Vec3 v0, e1, e2;
+      int face;
+    };
+
+    void buildNode(int nodeIndex, const std::vector<Vec3> &centroids, std::vector<int> &order, int first,
+                   int count);
+    template <bool anyHit> bool traverse(const Vec3 &origin, const Vec3 &dir, float maxDist, Hit &hit) const;
+
+    std::vector<Node> m_nodes;
+    std::vector<Triangle> m_triangles;
+  };
+
+} // namespace quakelib::map
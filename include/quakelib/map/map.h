@@ -12,6 +12,7 @@
 #include "map_file.h"
 #include "types.h"
 #include <quakelib/config.h>
+#include <quakelib/mesh_chunk.h>
 
 namespace quakelib::map {
   /**
@@ -32,6 +33,51 @@ namespace quakelib::map {
      * where brushes intersect.
      */
     bool csg = true;
+
+    /**
+     * @brief Spatial partitioning used by QMapProvider::GetEntityChunks.
+     */
+    ChunkMode chunkMode = ChunkMode::NONE;
+
+    /**
+     * @brief Cell edge length in world units for ChunkMode::GRID.
+     */
+    float chunkCellSize = 1024.0f;
+
+    /**
+     * @brief Maximum triangles per chunk for ChunkMode::KDTREE.
+     */
+    uint32_t chunkTriangleBudget = 4096;
+
+    /**
+     * @brief Build identical brush entities only once.
+     *
+     * Brush entities whose planes and texturing match after removing their
+     * translation, e.g. copies of the same door or prefab, are linked to the
+     * first one as instances instead of being built and clipped again.
+     * Instances keep their own bounds, their geometry is the prototype's
+     * moved by SolidMapEntity::InstanceOffset.
+     */
+    bool instanceBrushEntities = false;
+
+    /**
+     * @brief Remove worldspawn faces that can only be seen from outside the map.
+     *
+     * After CSG the solid worldspawn brushes are voxelized and the empty
+     * space is flood filled from the point entities. Faces without any
+     * reachable voxel in front of them, like the back sides of the walls
+     * enclosing the level, are dropped. When a point entity can be reached
+     * from outside the map leaks and nothing is removed, QMap::OutsideFill
+     * reports the leak.
+     */
+    bool outsideFill = false;
+
+    /**
+     * @brief Voxel edge length of the outside fill, doubled until the grid fits in 16M voxels.
+     *
+     * Gaps narrower than a voxel seal, walls thinner than a voxel still do.
+     */
+    float outsideFillVoxelSize = 8.0f;
   };
 
   /**
@@ -119,6 +165,11 @@ namespace quakelib::map {
      */
     void SetConfig(const QMapConfig &cfg) { m_config = cfg; }
 
+    /**
+     * @brief Gets the configuration used for geometry processing.
+     */
+    const QMapConfig &Config() const { return m_config; }
+
     /**
      * @brief Generates renderable geometry from brush definitions.
      *
@@ -136,6 +187,12 @@ namespace quakelib::map {
      */
     void GenerateGeometry();
 
+    /**
+     * @brief Gets the result of the outside fill pass of the last GenerateGeometry call.
+     * @see QMapConfig::outsideFill
+     */
+    const OutsideFillResult &OutsideFill() const { return m_outsideFill; }
+
     /**
      * @brief Collects polygons for a specific entity.
      * @param entityID The ID of the entity to process.
@@ -218,10 +275,12 @@ namespace quakelib::map {
 
   private:
     bool getPolygonsByTextureID(int entityID, int texID, std::vector<FacePtr> &list);
+    std::vector<int64_t> instanceKey(const SolidMapEntity &entity, Vec3 &origin) const;
 
     std::map<int, MapSurface::eFaceType> m_textureIDTypes;
     std::map<int, textureBounds> m_textureIDBounds;
     std::shared_ptr<QMapFile> m_map_file;
     QMapConfig m_config;
+    OutsideFillResult m_outsideFill;
   };
 } // namespace quakelib::map
@@ -4,6 +4,16 @@
 
 namespace quakelib {
 
+  /**
+   * @brief Solid entity drawn with the meshes of an earlier entity.
+   * @see quakelib::map::QMapConfig::instanceBrushEntities
+   */
+  struct EntityInstance {
+    uint32_t entity;    ///< Index of the instance in GetSolidEntities().
+    uint32_t prototype; ///< Index of the entity whose meshes are shared.
+    Vec3 offset;        ///< Translation from the prototype to the instance.
+  };
+
   /**
    * @brief Map provider implementation for MAP source files.
    *
@@ -52,8 +62,37 @@ namespace quakelib {
     std::vector<PointEntityPtr> GetPointEntities(const std::string &className) const override;
     std::vector<std::string> GetTextureNames() const override;
 
+    /**
+     * @brief Build the render meshes of an entity.
+     *
+     * Meshes are cached per entity until the geometry is regenerated, so
+     * repeated calls return the same vertices. Instances have no meshes of
+     * their own and return an empty list, draw the prototype's meshes with
+     * the offsets from GetEntityInstances instead.
+     *
+     * @param entity Entity to build.
+     * @return One mesh per texture.
+     */
     std::vector<RenderMesh> GetEntityMeshes(const SolidEntityPtr &entity) override;
 
+    /**
+     * @brief List the instanced entities with their prototype and offset.
+     * @return Instances in entity order, empty unless QMapConfig::instanceBrushEntities is set.
+     */
+    std::vector<EntityInstance> GetEntityInstances() const;
+
+    /**
+     * @brief Build the meshes of an entity partitioned into spatial chunks.
+     *
+     * Meant for worldspawn, whose per-texture meshes span the whole level.
+     * The partitioning follows QMapConfig::chunkMode, each chunk has its own
+     * bounds and per-texture meshes so it can be frustum culled on its own.
+     *
+     * @param entity Entity to build.
+     * @return Chunks with their meshes, a single chunk for ChunkMode::NONE.
+     */
+    std::vector<MeshChunk> GetEntityChunks(const SolidEntityPtr &entity);
+
     std::vector<std::string> GetRequiredWads() const override;
     void SetTextureBoundsProvider(std::function<std::pair<int, int>(const std::string &)> provider) override;
 
@@ -62,5 +101,6 @@ namespace quakelib {
     void generateLightmapUVs(std::vector<RenderMesh> &meshes);
 
     quakelib::map::QMap m_map;
+    std::map<const map::SolidMapEntity *, std::vector<RenderMesh>> m_meshCache;
   };
 } // namespace quakelib
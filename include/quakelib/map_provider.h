@@ -5,6 +5,7 @@
 #include <functional>
 #include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -13,7 +14,23 @@ namespace quakelib {
   struct TextureData {
     int width;
     int height;
-    std::vector<unsigned char> data; // RGBA
+    std::vector<unsigned char> data; // RGBA, or one byte per texel when channels is 1
+    int channels = 4;
+  };
+
+  // Texels owned by the provider, valid until the provider is destroyed or reloaded
+  struct TextureView {
+    int width;
+    int height;
+    int channels; // 4 for RGBA, 1 for R8
+    std::span<const unsigned char> data;
+  };
+
+  // Average cache miss ratio, vertex shader invocations per triangle with a 16 entry FIFO cache.
+  // 3 is the worst case, a large regular grid approaches 0.5.
+  struct MeshOptimizeStats {
+    float acmrBefore{0}; // index order the mesh was built with
+    float acmrAfter{0};  // after the vertex cache optimization, 0 when it did not run
   };
 
   struct RenderMesh {
@@ -23,6 +40,7 @@ namespace quakelib {
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
     SurfaceType type{SurfaceType::SOLID};
+    MeshOptimizeStats stats; // filled when Config::optimizeVertexCache is set
   };
 
   class IMapProvider {
@@ -50,6 +68,9 @@ namespace quakelib {
     virtual std::optional<TextureData> GetTextureData(const std::string &name) const { return std::nullopt; }
 
     virtual std::optional<TextureData> GetLightmapData() const { return std::nullopt; }
+
+    // Same as GetLightmapData without copying the texels
+    virtual std::optional<TextureView> GetLightmapView() const { return std::nullopt; }
   };
 
   using IMapProviderPtr = std::shared_ptr<IMapProvider>;
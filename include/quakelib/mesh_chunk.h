@@ -0,0 +1,49 @@
+#pragma once
+
+#include <quakelib/map_provider.h>
+#include <quakelib/qmath.h>
+#include <vector>
+
+namespace quakelib {
+  /**
+   * @brief How render meshes are partitioned into spatial chunks.
+   */
+  enum class ChunkMode {
+    NONE,   ///< One chunk holding every mesh.
+    GRID,   ///< Uniform grid of cubic cells.
+    KDTREE, ///< Median splits along the longest axis until a triangle budget is met.
+  };
+
+  /**
+   * @brief Spatial cell of an entity with its own bounds and per-texture meshes.
+   */
+  struct MeshChunk {
+    Vec3 mins = {0, 0, 0}; ///< Bounds of the triangles in the chunk.
+    Vec3 maxs = {0, 0, 0};
+    std::vector<RenderMesh> meshes; ///< One mesh per texture, in the order of the input meshes.
+  };
+
+  /**
+   * @brief Partition meshes into the cells of a uniform grid.
+   *
+   * Each triangle goes to the cell containing its centroid, so triangles
+   * are never split and the chunk bounds may reach into neighbouring cells.
+   *
+   * @param meshes Per-texture meshes of an entity.
+   * @param cellSize Edge length of a cell in world units, 0 puts everything into one chunk.
+   * @return Non-empty chunks ordered by cell.
+   */
+  std::vector<MeshChunk> ChunkMeshesGrid(const std::vector<RenderMesh> &meshes, float cellSize);
+
+  /**
+   * @brief Partition meshes with a k-d split by triangle count.
+   *
+   * Triangles are split at the median centroid along the longest axis until
+   * every chunk holds at most triangleBudget triangles.
+   *
+   * @param meshes Per-texture meshes of an entity.
+   * @param triangleBudget Maximum triangles per chunk.
+   * @return Chunks in tree order.
+   */
+  std::vector<MeshChunk> ChunkMeshesKdTree(const std::vector<RenderMesh> &meshes, size_t triangleBudget);
+} // namespace quakelib
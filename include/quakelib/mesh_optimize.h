@@ -0,0 +1,49 @@
+#pragma once
+
+#include <quakelib/map_provider.h>
+#include <vector>
+
+namespace quakelib {
+  /**
+   * @brief Simulate a FIFO vertex cache over a triangle list.
+   * @param indices Triangle list.
+   * @param vertexCount Number of vertices referenced by the indices.
+   * @param cacheSize Number of cache entries.
+   * @return Cache misses per triangle.
+   */
+  float ComputeACMR(const std::vector<uint32_t> &indices, size_t vertexCount, int cacheSize = 16);
+
+  /**
+   * @brief Reorder triangles for post-transform vertex cache reuse.
+   *
+   * Uses Forsyth's linear-speed greedy algorithm, the triangles themselves
+   * and their winding are unchanged.
+   */
+  void OptimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount);
+
+  /**
+   * @brief Reorder clusters of triangles to reduce overdraw.
+   *
+   * The cache optimized order is split into clusters wherever the cache
+   * starts over, clusters facing away from the mesh centre are drawn first
+   * since they are the most likely occluders. The new order is only kept
+   * while its ACMR stays within threshold times the input ACMR.
+   */
+  void OptimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices,
+                        float threshold = 1.05f);
+
+  /**
+   * @brief Renumber vertices in the order they are first referenced.
+   *
+   * Unreferenced vertices are dropped.
+   */
+  void OptimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
+
+  /**
+   * @brief Run the cache, optional overdraw and fetch passes over a mesh.
+   * @param mesh Mesh to optimize in place.
+   * @param overdraw Also reorder triangle clusters for overdraw.
+   * @return ACMR before and after.
+   */
+  MeshOptimizeStats OptimizeMesh(RenderMesh &mesh, bool overdraw = false);
+} // namespace quakelib
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <quakelib/map_provider.h>
+#include <quakelib/qmath.h>
+#include <vector>
+
+namespace quakelib {
+  constexpr size_t MESHLET_MAX_VERTICES = 64;
+  constexpr size_t MESHLET_MAX_TRIANGLES = 124;
+
+  /**
+   * @brief Small cluster of a mesh that can be culled on its own.
+   */
+  struct Meshlet {
+    uint32_t vertexOffset = 0;   ///< First entry in MeshletData::vertices.
+    uint32_t vertexCount = 0;    ///< Number of vertices, at most MESHLET_MAX_VERTICES.
+    uint32_t triangleOffset = 0; ///< First triangle in MeshletData::triangles, in triangles.
+    uint32_t triangleCount = 0;  ///< Number of triangles, at most MESHLET_MAX_TRIANGLES.
+
+    Vec3 center = {0, 0, 0}; ///< Bounding sphere.
+    float radius = 0;
+
+    Vec3 coneApex = {0, 0, 0}; ///< Normal cone, see IsMeshletBackfacing.
+    Vec3 coneAxis = {0, 0, 0};
+    float coneCutoff = 1; ///< 1 when the normals are too spread out to cull.
+  };
+
+  /**
+   * @brief Meshlets of one RenderMesh.
+   */
+  struct MeshletData {
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> vertices; ///< Indices into RenderMesh::vertices.
+    std::vector<uint8_t> triangles; ///< Three indices per triangle, local to the meshlet's vertices.
+  };
+
+  /**
+   * @brief Split a mesh into meshlets.
+   *
+   * Triangles are grown into a meshlet from their neighbours first so the
+   * clusters stay compact, running OptimizeMesh beforehand also improves
+   * the result.
+   *
+   * @param mesh Mesh to split.
+   * @param maxVertices Vertex limit per meshlet, at most 256.
+   * @param maxTriangles Triangle limit per meshlet.
+   * @return Meshlets with their bounds.
+   */
+  MeshletData BuildMeshlets(const RenderMesh &mesh, size_t maxVertices = MESHLET_MAX_VERTICES,
+                            size_t maxTriangles = MESHLET_MAX_TRIANGLES);
+
+  /**
+   * @brief Test whether every triangle of a meshlet faces away from the camera.
+   * @param meshlet Meshlet to test.
+   * @param cameraPos Camera position in the space of the mesh.
+   * @return true if the meshlet can be skipped.
+   */
+  bool IsMeshletBackfacing(const Meshlet &meshlet, const Vec3 &cameraPos);
+} // namespace quakelib
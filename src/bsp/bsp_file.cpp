@@ -0,0 +1,70 @@
+#include <fstream>
+#include <quakelib/bsp/bsp_file.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define QLIB_HAS_MMAP 1
+#endif
+
+namespace quakelib::bsp {
+  BspFileBuffer::~BspFileBuffer() { Close(); }
+
+  bool BspFileBuffer::Open(const char *filename, bool memoryMap) {
+    Close();
+
+#ifdef QLIB_HAS_MMAP
+    if (memoryMap) {
+      int fd = open(filename, O_RDONLY);
+      if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+          void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (mem != MAP_FAILED) {
+            m_data = static_cast<const unsigned char *>(mem);
+            m_size = st.st_size;
+            m_mapped = true;
+          }
+        }
+        // the mapping stays valid after the descriptor is closed
+        close(fd);
+        if (m_mapped)
+          return true;
+      }
+    }
+#endif
+
+    std::ifstream istream(filename, std::ios::binary | std::ios::ate);
+    if (!istream.is_open())
+      return false;
+
+    auto size = istream.tellg();
+    if (size <= 0)
+      return false;
+
+    m_owned.resize(size);
+    istream.seekg(0, istream.beg);
+    if (!istream.read(reinterpret_cast<char *>(m_owned.data()), size)) {
+      m_owned.clear();
+      return false;
+    }
+
+    m_data = m_owned.data();
+    m_size = m_owned.size();
+    return true;
+  }
+
+  void BspFileBuffer::Close() {
+#ifdef QLIB_HAS_MMAP
+    if (m_mapped)
+      munmap(const_cast<unsigned char *>(m_data), m_size);
+#endif
+    m_owned.clear();
+    m_owned.shrink_to_fit();
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+  }
+} // namespace quakelib::bsp
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cmath>
+#include <quakelib/bsp/bsp_tree.h>
+
+namespace quakelib::bsp {
+  static constexpr float ON_EPSILON = 0.01f;
+
+  BspTree::BspTree(const bspFileContent &ctx, bool oglCoords) : m_ctx(&ctx), m_oglCoords(oglCoords) {
+    if (ctx.models.empty() || ctx.nodes.empty())
+      return;
+
+    m_root = ctx.models[0].node_id0;
+    if (m_root >= (int)ctx.nodes.size())
+      m_root = -1;
+    m_nodes.resize(ctx.nodes.size());
+    for (size_t i = 0; i < ctx.nodes.size(); i++) {
+      const fNode_t &src = ctx.nodes[i];
+      Node &node = m_nodes[i];
+      node.SetPlane(ctx.planes[src.plane_id], oglCoords);
+
+      // negative children are ~leaf, broken references fall into the solid leaf so queries
+      // never need a range check
+      int children[2] = {src.front, src.back};
+      for (int c = 0; c < 2; c++) {
+        bool valid = children[c] >= 0 ? children[c] < (int)ctx.nodes.size()
+                                      : -(children[c] + 1) < (int)ctx.leafs.size();
+        node.children[c] = valid ? children[c] : -1;
+      }
+      node.firstFace = src.face_id;
+      node.numFaces = src.face_num;
+    }
+  }
+
+  int BspTree::PointInLeaf(const vec3f_t &point) const {
+    int node = m_root;
+    if (node < 0)
+      return 0;
+
+    while (node >= 0) {
+      const Node &n = m_nodes[node];
+      node = n.children[n.Distance(point) > 0 ? 0 : 1];
+    }
+    return -(node + 1);
+  }
+
+  int BspTree::PointContents(const vec3f_t &point) const {
+    int leaf = PointInLeaf(point);
+    if (leaf < 0 || leaf >= (int)m_ctx->leafs.size())
+      return CONTENTS_SOLID;
+    return m_ctx->leafs[leaf].type;
+  }
+
+  vec3f_t BspTree::vertex(int surfEdge) const {
+    int e = m_ctx->surfEdges[surfEdge];
+    const vec3f_t &v =
+        e >= 0 ? m_ctx->vertices[m_ctx->edges[e].vertex0] : m_ctx->vertices[m_ctx->edges[-e].vertex1];
+    return m_oglCoords ? detail::ToOGLCoords(v) : v;
+  }
+
+  bool BspTree::faceContains(const Node &node, int face, const vec3f_t &p) const {
+    const fFace_t &f = m_ctx->faces[face];
+    if (f.ledge_num < 3)
+      return false;
+
+    // p lies on the face plane, it is inside when it is on the same side of every edge
+    int sign = 0;
+    vec3f_t a = vertex(f.ledge_id + f.ledge_num - 1);
+    for (int i = 0; i < f.ledge_num; i++) {
+      vec3f_t b = vertex(f.ledge_id + i);
+      vec3f_t edge = {b.x - a.x, b.y - a.y, b.z - a.z};
+      vec3f_t rel = {p.x - a.x, p.y - a.y, p.z - a.z};
+      vec3f_t c = {edge.y * rel.z - edge.z * rel.y, edge.z * rel.x - edge.x * rel.z,
+                   edge.x * rel.y - edge.y * rel.x};
+      float s = c.x * node.normal[0] + c.y * node.normal[1] + c.z * node.normal[2];
+
+      if (s > ON_EPSILON || s < -ON_EPSILON) {
+        int side = s > 0 ? 1 : -1;
+        if (sign != 0 && side != sign)
+          return false;
+        sign = side;
+      }
+      a = b;
+    }
+    return true;
+  }
+
+  bool BspTree::traceNode(int node, const vec3f_t &p1, const vec3f_t &p2, float f1, float f2,
+                          const vec3f_t &start, const vec3f_t &end, BspRayHit &hit) const {
+    if (node < 0)
+      return false;
+
+    const Node &n = m_nodes[node];
+    float d1 = n.Distance(p1);
+    float d2 = n.Distance(p2);
+
+    if (d1 >= 0 && d2 >= 0)
+      return traceNode(n.children[0], p1, p2, f1, f2, start, end, hit);
+    if (d1 < 0 && d2 < 0)
+      return traceNode(n.children[1], p1, p2, f1, f2, start, end, hit);
+
+    // the segment crosses the plane, visit the near side, the faces on the plane, then the far side
+    int side = d1 < 0;
+    float frac = d1 / (d1 - d2);
+    vec3f_t mid = {p1.x + (p2.x - p1.x) * frac, p1.y + (p2.y - p1.y) * frac, p1.z + (p2.z - p1.z) * frac};
+    float fmid = f1 + (f2 - f1) * frac;
+
+    if (traceNode(n.children[side], p1, mid, f1, fmid, start, end, hit))
+      return true;
+
+    for (int face = n.firstFace; face < n.firstFace + n.numFaces; face++) {
+      // a face on side 0 faces along the plane normal and is seen from the front
+      if (m_ctx->faces[face].side != side || !faceContains(n, face, mid))
+        continue;
+
+      float sign = side ? -1.0f : 1.0f;
+      hit.fraction = fmid;
+      hit.point = mid;
+      hit.normal = {n.normal[0] * sign, n.normal[1] * sign, n.normal[2] * sign};
+      hit.face = face;
+      return true;
+    }
+
+    return traceNode(n.children[!side], mid, p2, fmid, f2, start, end, hit);
+  }
+
+  bool BspTree::TraceRay(const vec3f_t &start, const vec3f_t &end, BspRayHit &hit) const {
+    if (m_root < 0)
+      return false;
+    return traceNode(m_root, start, end, 0.0f, 1.0f, start, end, hit);
+  }
+
+  void BspTree::boxLeaves(int node, const vec3f_t &mins, const vec3f_t &maxs, int *leaves, int maxLeaves,
+                          int &count) const {
+    while (node >= 0) {
+      const Node &n = m_nodes[node];
+
+      float dmin, dmax;
+      if (n.type < 3) {
+        float lo = n.type == 0 ? mins.x : n.type == 1 ? mins.y : mins.z;
+        float hi = n.type == 0 ? maxs.x : n.type == 1 ? maxs.y : maxs.z;
+        float a = lo * n.normal[n.type] - n.dist;
+        float b = hi * n.normal[n.type] - n.dist;
+        dmin = std::min(a, b);
+        dmax = std::max(a, b);
+      } else {
+        // nearest and farthest box corners along the normal
+        vec3f_t mid = {(mins.x + maxs.x) * 0.5f, (mins.y + maxs.y) * 0.5f, (mins.z + maxs.z) * 0.5f};
+        float center = n.Distance(mid);
+        float radius = std::fabs(n.normal[0]) * (maxs.x - mins.x) * 0.5f +
+                       std::fabs(n.normal[1]) * (maxs.y - mins.y) * 0.5f +
+                       std::fabs(n.normal[2]) * (maxs.z - mins.z) * 0.5f;
+        dmin = center - radius;
+        dmax = center + radius;
+      }
+
+      if (dmin >= 0) {
+        node = n.children[0];
+      } else if (dmax < 0) {
+        node = n.children[1];
+      } else {
+        boxLeaves(n.children[0], mins, maxs, leaves, maxLeaves, count);
+        node = n.children[1];
+      }
+    }
+
+    int leaf = -(node + 1);
+    if (leaf == 0)
+      return;
+    if (count < maxLeaves)
+      leaves[count] = leaf;
+    count++;
+  }
+
+  int BspTree::BoxLeaves(const vec3f_t &mins, const vec3f_t &maxs, int *leaves, int maxLeaves) const {
+    int count = 0;
+    if (m_root >= 0)
+      boxLeaves(m_root, mins, maxs, leaves, maxLeaves, count);
+    return count;
+  }
+} // namespace quakelib::bsp
@@ -0,0 +1,167 @@
+#include "../common/parallel.h"
+#include <algorithm>
+#include <quakelib/bsp/collision.h>
+
+namespace quakelib::bsp {
+  // keeps trace end points off the planes, same as the Quake engine
+  static constexpr float DIST_EPSILON = 0.03125f;
+
+  BspCollision::BspCollision(const bspFileContent &ctx, bool oglCoords) {
+    m_renderNodes.resize(ctx.nodes.size());
+    for (size_t i = 0; i < ctx.nodes.size(); i++) {
+      const fNode_t &src = ctx.nodes[i];
+      Node &node = m_renderNodes[i];
+      node.SetPlane(ctx.planes[src.plane_id], oglCoords);
+
+      // hull 0 stores leaf contents directly, like Mod_MakeHull0
+      int children[2] = {src.front, src.back};
+      for (int c = 0; c < 2; c++) {
+        if (children[c] >= 0) {
+          node.children[c] = children[c] < (int)ctx.nodes.size() ? children[c] : CONTENTS_SOLID;
+          continue;
+        }
+        int leaf = -(children[c] + 1);
+        node.children[c] = leaf < (int)ctx.leafs.size() ? ctx.leafs[leaf].type : CONTENTS_SOLID;
+      }
+    }
+
+    m_clipNodes.resize(ctx.clipNodes.size());
+    for (size_t i = 0; i < ctx.clipNodes.size(); i++) {
+      const fClipNode_t &src = ctx.clipNodes[i];
+      Node &node = m_clipNodes[i];
+      node.SetPlane(ctx.planes[src.plane_id], oglCoords);
+
+      int children[2] = {src.front, src.back};
+      for (int c = 0; c < 2; c++) {
+        bool valid = children[c] < (int)ctx.clipNodes.size() && children[c] >= CONTENTS_SKY;
+        node.children[c] = valid ? children[c] : CONTENTS_SOLID;
+      }
+    }
+
+    m_roots.resize(ctx.models.size());
+    for (size_t i = 0; i < ctx.models.size(); i++) {
+      const fModel_t &model = ctx.models[i];
+      m_roots[i] = {model.node_id0, model.node_id1, model.node_id2, model.node_id3};
+    }
+  }
+
+  bool BspCollision::hull(int hullIndex, int model, Hull &out) const {
+    if (model < 0 || model >= (int)m_roots.size() || hullIndex < 0 || hullIndex >= MAX_HULLS)
+      return false;
+
+    out.nodes = hullIndex == 0 ? &m_renderNodes : &m_clipNodes;
+    out.root = m_roots[model][hullIndex];
+
+    // Quake leaves the unused fourth hull at zero, which is the first clipnode of hull 1
+    if (hullIndex == MAX_HULLS - 1 && out.root == 0)
+      return false;
+    return out.root >= 0 && out.root < (int)out.nodes->size();
+  }
+
+  int BspCollision::contents(const Hull &hull, int node, const vec3f_t &p) const {
+    const auto &nodes = *hull.nodes;
+    while (node >= 0) {
+      const Node &n = nodes[node];
+      node = n.children[n.Distance(p) < 0 ? 1 : 0];
+    }
+    return node;
+  }
+
+  int BspCollision::PointContents(const vec3f_t &point, int hullIndex, int model) const {
+    Hull h;
+    if (!hull(hullIndex, model, h))
+      return CONTENTS_EMPTY;
+    return contents(h, h.root, point);
+  }
+
+  static bool blocks(int contents) { return contents == CONTENTS_SOLID || contents == CONTENTS_SKY; }
+
+  bool BspCollision::recursiveCheck(const Hull &hull, int node, float p1f, float p2f, const vec3f_t &p1,
+                                    const vec3f_t &p2, BspTrace &trace) const {
+    if (node < 0) {
+      if (blocks(node)) {
+        trace.startSolid = true;
+      } else {
+        trace.allSolid = false;
+        trace.inWater |= node != CONTENTS_EMPTY;
+      }
+      return true;
+    }
+
+    const Node &n = (*hull.nodes)[node];
+    float t1 = n.Distance(p1);
+    float t2 = n.Distance(p2);
+
+    if (t1 >= 0 && t2 >= 0)
+      return recursiveCheck(hull, n.children[0], p1f, p2f, p1, p2, trace);
+    if (t1 < 0 && t2 < 0)
+      return recursiveCheck(hull, n.children[1], p1f, p2f, p1, p2, trace);
+
+    // put the crosspoint DIST_EPSILON pixels on the near side
+    float frac = t1 < 0 ? (t1 + DIST_EPSILON) / (t1 - t2) : (t1 - DIST_EPSILON) / (t1 - t2);
+    frac = std::clamp(frac, 0.0f, 1.0f);
+
+    float midf = p1f + (p2f - p1f) * frac;
+    vec3f_t mid = {p1.x + frac * (p2.x - p1.x), p1.y + frac * (p2.y - p1.y), p1.z + frac * (p2.z - p1.z)};
+    int side = t1 < 0;
+
+    if (!recursiveCheck(hull, n.children[side], p1f, midf, p1, mid, trace))
+      return false;
+
+    int farContents = contents(hull, n.children[side ^ 1], mid);
+    if (!blocks(farContents))
+      return recursiveCheck(hull, n.children[side ^ 1], midf, p2f, mid, p2, trace);
+
+    // never got out of the solid area
+    if (trace.allSolid)
+      return false;
+
+    // the other side of the node is solid, this is the impact point
+    float sign = side ? -1.0f : 1.0f;
+    trace.planeNormal = {n.normal[0] * sign, n.normal[1] * sign, n.normal[2] * sign};
+    trace.planeDist = n.dist * sign;
+    trace.contents = farContents;
+
+    // the epsilon may have pushed the point into another solid, back up until it is outside
+    while (blocks(contents(hull, hull.root, mid))) {
+      frac -= 0.1f;
+      if (frac < 0) {
+        trace.fraction = midf;
+        trace.endPos = mid;
+        return false;
+      }
+      midf = p1f + (p2f - p1f) * frac;
+      mid = {p1.x + frac * (p2.x - p1.x), p1.y + frac * (p2.y - p1.y), p1.z + frac * (p2.z - p1.z)};
+    }
+
+    trace.fraction = midf;
+    trace.endPos = mid;
+    return false;
+  }
+
+  BspTrace BspCollision::Trace(const vec3f_t &start, const vec3f_t &end, int hullIndex, int model) const {
+    BspTrace trace;
+    trace.endPos = end;
+
+    Hull h;
+    if (!hull(hullIndex, model, h))
+      return trace;
+
+    trace.allSolid = true;
+    recursiveCheck(h, h.root, 0.0f, 1.0f, start, end, trace);
+
+    if (trace.allSolid) {
+      trace.startSolid = true;
+      trace.fraction = 0.0f;
+      trace.endPos = start;
+      trace.contents = contents(h, h.root, start);
+    }
+    return trace;
+  }
+
+  void BspCollision::TraceBatch(std::span<const BspRay> rays, std::span<BspTrace> out, int hullIndex,
+                                int model) const {
+    size_t count = std::min(rays.size(), out.size());
+    ParallelFor(count, [&](size_t i) { out[i] = Trace(rays[i].start, rays[i].end, hullIndex, model); }, 64);
+  }
+} // namespace quakelib::bsp
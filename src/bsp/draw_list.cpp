@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cmath>
+#include <float.h>
+#include <quakelib/bsp/draw_list.h>
+#include <quakelib/bsp/qbsp.h>
+
+namespace quakelib::bsp {
+  BspFrustum BspFrustum::FromMatrix(const float *m) {
+    // Gribb and Hartmann, rows of the column-major matrix combined with the w row
+    auto row = [m](int r) { return vec4f_t{m[r], m[4 + r], m[8 + r], m[12 + r]}; };
+    vec4f_t w = row(3);
+
+    BspFrustum f;
+    for (int axis = 0; axis < 3; axis++) {
+      vec4f_t r = row(axis);
+      f.planes[f.count++] = {w.x + r.x, w.y + r.y, w.z + r.z, w.w + r.w};
+      f.planes[f.count++] = {w.x - r.x, w.y - r.y, w.z - r.z, w.w - r.w};
+    }
+
+    for (int i = 0; i < f.count; i++) {
+      vec4f_t &p = f.planes[i];
+      float len = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+      if (len > 0) {
+        p = {p.x / len, p.y / len, p.z / len, p.w / len};
+      }
+    }
+    return f;
+  }
+
+  bool BspFrustum::IntersectsBox(const vec3f_t &mins, const vec3f_t &maxs) const {
+    for (int i = 0; i < count; i++) {
+      const vec4f_t &p = planes[i];
+      // corner furthest along the plane normal
+      float x = p.x >= 0 ? maxs.x : mins.x;
+      float y = p.y >= 0 ? maxs.y : mins.y;
+      float z = p.z >= 0 ? maxs.z : mins.z;
+      if (p.x * x + p.y * y + p.z * z + p.w < 0)
+        return false;
+    }
+    return true;
+  }
+
+  BspDrawListBuilder::BspDrawListBuilder(const QBsp &bsp) : m_ctx(&bsp.Content()), m_vis(&bsp.Vis()) {
+    const bspFileContent &ctx = *m_ctx;
+    bool ogl = bsp.Config().convertCoordToOGL;
+
+    auto bounds = [ogl](const bbox3f_t &box) {
+      Bounds b = {box.min, box.max};
+      if (ogl) {
+        // y and z swap, the new z is the negated old y so min and max trade places
+        b = {{b.mins.x, b.mins.z, -b.maxs.y}, {b.maxs.x, b.maxs.z, -b.mins.y}};
+      }
+      return b;
+    };
+
+    m_nodes.resize(ctx.nodes.size());
+    m_leaves.resize(ctx.leafs.size());
+    for (size_t i = 0; i < ctx.leafs.size(); i++) {
+      const fLeaf_t &src = ctx.leafs[i];
+      m_leaves[i] = {bounds(src.bound), (int)src.lface_id, (int)src.lface_num, -1, 0};
+    }
+    for (size_t i = 0; i < ctx.nodes.size(); i++) {
+      const fNode_t &src = ctx.nodes[i];
+      Node &node = m_nodes[i];
+      node.bounds = bounds(src.box);
+      node.parent = -1;
+      node.visFrame = 0;
+
+      int children[2] = {src.front, src.back};
+      for (int c = 0; c < 2; c++) {
+        int child = children[c];
+        bool valid = child >= 0 ? child < (int)ctx.nodes.size() : -(child + 1) < (int)ctx.leafs.size();
+        node.children[c] = valid ? child : -1;
+      }
+    }
+    for (size_t i = 0; i < m_nodes.size(); i++) {
+      for (int child : m_nodes[i].children) {
+        if (child >= 0)
+          m_nodes[child].parent = (int)i;
+        else
+          m_leaves[-(child + 1)].parent = (int)i;
+      }
+    }
+
+    m_faces.assign(ctx.faces.size(), Face{{}, 0, 0, -1, 0});
+    if (ctx.models.empty() || !bsp.WorldSpawn())
+      return;
+
+    const fModel_t &world = ctx.models[0];
+    if (world.node_id0 >= 0 && world.node_id0 < (int)m_nodes.size())
+      m_root = world.node_id0;
+
+    const auto &surfaces = bsp.WorldSpawn()->Faces();
+    vector<int> order;
+    for (int i = 0; i < (int)surfaces.size() && world.face_id + i < (int)m_faces.size(); i++)
+      order.push_back(i);
+
+    // texture major, file order within a texture
+    auto texture = [&](int i) { return surfaces[i]->info ? (int)surfaces[i]->info->texture_id : -1; };
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return texture(a) < texture(b); });
+
+    // ranges carry no page, the lightmap coordinates refer to the stacked atlas like the provider's meshes
+    const Lightmap *lm = bsp.LightMap();
+    int pages = lm ? lm->Pages() : 0;
+
+    for (int i : order) {
+      const Surface &surf = *surfaces[i];
+      Face &face = m_faces[world.face_id + i];
+      face.texture = texture(i);
+      face.firstIndex = (uint32_t)m_indices.size();
+      face.indexCount = (uint32_t)surf.indices.size();
+      face.bounds = {{FLT_MAX, FLT_MAX, FLT_MAX}, {-FLT_MAX, -FLT_MAX, -FLT_MAX}};
+
+      uint32_t base = (uint32_t)m_vertices.size();
+      for (const auto &v : surf.verts) {
+        m_vertices.push_back(v);
+        if (pages > 1)
+          m_vertices.back().lm_uv.y = (v.lm_uv.y + surf.lm_tex_num) / pages;
+        face.bounds.mins = {std::min(face.bounds.mins.x, v.point.x), std::min(face.bounds.mins.y, v.point.y),
+                            std::min(face.bounds.mins.z, v.point.z)};
+        face.bounds.maxs = {std::max(face.bounds.maxs.x, v.point.x), std::max(face.bounds.maxs.y, v.point.y),
+                            std::max(face.bounds.maxs.z, v.point.z)};
+      }
+      for (uint32_t idx : surf.indices)
+        m_indices.push_back(base + idx);
+    }
+  }
+
+  void BspDrawListBuilder::markLeaves(int pvsLeaf) {
+    // like R_MarkLeaves, only redone when the view leaf changes
+    if (pvsLeaf == m_pvsLeaf)
+      return;
+    m_pvsLeaf = pvsLeaf;
+    m_visFrame++;
+
+    for (int leaf : m_vis->VisibleLeaves(pvsLeaf)) {
+      if (leaf >= (int)m_leaves.size())
+        continue;
+      m_leaves[leaf].visFrame = m_visFrame;
+      for (int node = m_leaves[leaf].parent; node >= 0; node = m_nodes[node].parent) {
+        if (m_nodes[node].visFrame == m_visFrame)
+          break;
+        m_nodes[node].visFrame = m_visFrame;
+      }
+    }
+  }
+
+  int BspDrawListBuilder::clipBox(const BspFrustum &frustum, const Bounds &bounds, int &clipMask) {
+    for (int i = 0; i < frustum.count; i++) {
+      if (!(clipMask & (1 << i)))
+        continue;
+
+      const vec4f_t &p = frustum.planes[i];
+      float dmax = p.x * (p.x >= 0 ? bounds.maxs.x : bounds.mins.x) +
+                   p.y * (p.y >= 0 ? bounds.maxs.y : bounds.mins.y) +
+                   p.z * (p.z >= 0 ? bounds.maxs.z : bounds.mins.z) + p.w;
+      if (dmax < 0)
+        return -1;
+
+      float dmin = p.x * (p.x >= 0 ? bounds.mins.x : bounds.maxs.x) +
+                   p.y * (p.y >= 0 ? bounds.mins.y : bounds.maxs.y) +
+                   p.z * (p.z >= 0 ? bounds.mins.z : bounds.maxs.z) + p.w;
+      if (dmin >= 0)
+        clipMask &= ~(1 << i);
+    }
+    return clipMask;
+  }
+
+  void BspDrawListBuilder::addLeaf(int leaf, int clipMask) {
+    if (leaf <= 0)
+      return;
+
+    const Leaf &l = m_leaves[leaf];
+    if (m_usePvs && l.visFrame != m_visFrame)
+      return;
+    if (clipMask && clipBox(*m_frustum, l.bounds, clipMask) < 0)
+      return;
+
+    const auto &marks = m_ctx->markSurfaces;
+    for (int m = l.firstMark; m < l.firstMark + l.numMarks && m < (int)marks.size(); m++) {
+      int id = marks[m];
+      if (id >= (int)m_faces.size())
+        continue;
+
+      Face &face = m_faces[id];
+      if (face.frame == m_frame || face.indexCount == 0)
+        continue;
+      face.frame = m_frame;
+
+      int faceMask = clipMask;
+      if (faceMask && clipBox(*m_frustum, face.bounds, faceMask) < 0)
+        continue;
+      m_list.surfaces.push_back(id);
+    }
+  }
+
+  void BspDrawListBuilder::walk(int node, int clipMask) {
+    while (node >= 0) {
+      const Node &n = m_nodes[node];
+      if (m_usePvs && n.visFrame != m_visFrame)
+        return;
+      if (clipMask && clipBox(*m_frustum, n.bounds, clipMask) < 0)
+        return;
+
+      walk(n.children[0], clipMask);
+      node = n.children[1];
+    }
+    addLeaf(-(node + 1), clipMask);
+  }
+
+  const BspDrawList &BspDrawListBuilder::Build(const BspFrustum &frustum, int pvsLeaf) {
+    m_list.surfaces.clear();
+    m_list.ranges.clear();
+    if (m_root < 0)
+      return m_list;
+
+    m_frame++;
+    m_frustum = &frustum;
+    m_usePvs = pvsLeaf >= 0;
+    if (m_usePvs)
+      markLeaves(pvsLeaf);
+
+    walk(m_root, (1 << frustum.count) - 1);
+
+    // buffer order groups the faces by texture, adjacent faces merge into one range
+    std::sort(m_list.surfaces.begin(), m_list.surfaces.end(),
+              [this](int a, int b) { return m_faces[a].firstIndex < m_faces[b].firstIndex; });
+    for (int id : m_list.surfaces) {
+      const Face &face = m_faces[id];
+      if (!m_list.ranges.empty()) {
+        BspDrawRange &last = m_list.ranges.back();
+        if (last.texture == face.texture && last.firstIndex + last.indexCount == face.firstIndex) {
+          last.indexCount += face.indexCount;
+          continue;
+        }
+      }
+      m_list.ranges.push_back({face.texture, face.firstIndex, face.indexCount});
+    }
+    return m_list;
+  }
+} // namespace quakelib::bsp
@@ -1,7 +1,11 @@
+#include <algorithm>
 #include <memory>
 #include <quakelib/bsp/entity_solid.h>
 
 namespace quakelib::bsp {
+  // faces with fewer than three edges build no geometry, see Surface::Build
+  static int faceVertexCount(const fFace_t &face) { return face.ledge_num < 3 ? 0 : face.ledge_num; }
+
   SolidEntity::SolidEntity(const bspFileContent &ctx, ParsedEntity *pe) {
     FillFromParsed(pe);
 
@@ -12,25 +16,80 @@ namespace quakelib::bsp {
       m_modelId = 0;
     }
 
-    auto &m = ctx.models[m_modelId];
-    for (int fid = m.face_id; fid < m.face_id + m.face_num; fid++) {
-      auto mface = std::make_shared<Surface>();
-      mface->Build(ctx, &ctx.faces[fid]);
-      m_faces.push_back(mface);
+    m_ctx = &ctx;
+  }
+
+  int SolidEntity::allocateFaces() {
+    if (m_facesBuilt)
+      return 0;
+    m_facesBuilt = true;
+
+    if (m_modelId < 0 || m_modelId >= (int)m_ctx->models.size())
+      return 0;
+
+    auto &m = m_ctx->models[m_modelId];
+    int first = std::clamp(m.face_id, 0, (int)m_ctx->faces.size());
+    int last = std::clamp(m.face_id + m.face_num, first, (int)m_ctx->faces.size());
+    m_firstFace = first;
+
+    // size the arrays up front, so every face is a slice and nothing reallocates
+    size_t numVerts = 0, numIndices = 0;
+    for (int fid = first; fid < last; fid++) {
+      int edges = faceVertexCount(m_ctx->faces[fid]);
+      numVerts += edges;
+      numIndices += std::max(edges - 2, 0) * 3;
+    }
+
+    m_store = std::make_shared<SurfaceStore>();
+    m_store->vertices.resize(numVerts);
+    m_store->indices.resize(numIndices);
+    m_store->surfaces.resize(last - first);
+    m_faces.reserve(last - first);
+
+    uint32_t vertOfs = 0, indexOfs = 0;
+    for (int fid = first; fid < last; fid++) {
+      int edges = faceVertexCount(m_ctx->faces[fid]);
+      size_t tris = std::max(edges - 2, 0) * 3;
+
+      Surface &surf = m_store->surfaces[fid - first];
+      surf.firstVertex = vertOfs;
+      surf.firstIndex = indexOfs;
+      surf.verts = std::span(m_store->vertices).subspan(vertOfs, edges);
+      surf.indices = std::span(m_store->indices).subspan(indexOfs, tris);
+      vertOfs += edges;
+      indexOfs += tris;
+
+      // aliasing pointer, no allocation per face
+      m_faces.emplace_back(m_store, &surf);
     }
+    return last - first;
+  }
+
+  void SolidEntity::buildFace(int face) {
+    Surface &surf = m_store->surfaces[face];
+    surf.Build(*m_ctx, m_ctx->faces[m_firstFace + face], surf.verts, surf.indices);
   }
 
   void SolidEntity::convertToOpenGLCoords() {
-    for (auto &surf : m_faces) {
-      for (auto &v : surf->verts) {
-        auto temp = v.point.y;
-        v.point.y = v.point.z;
-        v.point.z = -temp;
-      }
+    if (!m_store)
+      return;
+    for (auto &v : m_store->vertices) {
+      auto temp = v.point.y;
+      v.point.y = v.point.z;
+      v.point.z = -temp;
     }
   }
 
-  const std::vector<SurfacePtr> &SolidEntity::Faces() { return m_faces; }
+  const std::vector<SurfacePtr> &SolidEntity::Faces() {
+    if (!m_facesBuilt && m_requestGeometry)
+      m_requestGeometry();
+    return m_faces;
+  }
+
+  const SurfaceStore *SolidEntity::Surfaces() {
+    Faces();
+    return m_store.get();
+  }
 
   bool SolidEntity::IsWorldSpawn() { return m_classname == "worldspawn"; };
 } // namespace quakelib::bsp
\ No newline at end of file
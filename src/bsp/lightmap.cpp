@@ -1,12 +1,124 @@
+#include <algorithm>
+#include <climits>
 #include <cmath>
 #include <quakelib/bsp/lightmap.h>
 #include <string.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QLIB_LIGHTMAP_SSE2 1
+#endif
+
 namespace quakelib::bsp {
-  Lightmap::Lightmap(uint8_t *data, size_t sz) {
+  // acc[i] += src[i] * scale, scale must fit in 15 bits
+  static void accumulateSamples(uint32_t *acc, const uint8_t *src, int count, int scale) {
+    int i = 0;
+#ifdef QLIB_LIGHTMAP_SSE2
+    // bytes are widened to 32 bit lanes holding (sample, 0) pairs, madd against (scale, 0) pairs
+    // yields the products without a 32 bit multiply
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i s = _mm_set1_epi32(scale);
+    for (; i + 16 <= count; i += 16) {
+      __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+      __m128i lo = _mm_unpacklo_epi8(b, zero);
+      __m128i hi = _mm_unpackhi_epi8(b, zero);
+      __m128i words[4] = {_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                          _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+      for (int k = 0; k < 4; k++) {
+        __m128i *dst = (__m128i *)(acc + i + k * 4);
+        _mm_storeu_si128(dst, _mm_add_epi32(_mm_loadu_si128(dst), _mm_madd_epi16(words[k], s)));
+      }
+    }
+#endif
+    for (; i < count; i++)
+      acc[i] += src[i] * scale;
+  }
+
+  // dst[i] = min(acc[i] >> 8, 255)
+  static void resolveSamples(const uint32_t *acc, uint8_t *dst, int count) {
+    int i = 0;
+#ifdef QLIB_LIGHTMAP_SSE2
+    for (; i + 16 <= count; i += 16) {
+      const __m128i *src = (const __m128i *)(acc + i);
+      __m128i a = _mm_packs_epi32(_mm_srli_epi32(_mm_loadu_si128(src + 0), 8),
+                                  _mm_srli_epi32(_mm_loadu_si128(src + 1), 8));
+      __m128i b = _mm_packs_epi32(_mm_srli_epi32(_mm_loadu_si128(src + 2), 8),
+                                  _mm_srli_epi32(_mm_loadu_si128(src + 3), 8));
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+    }
+#endif
+    for (; i < count; i++)
+      dst[i] = (uint8_t)std::min<uint32_t>(acc[i] >> 8, 255);
+  }
+
+  LightmapSkyline::LightmapSkyline(int width, int height) : width(width), height(height) {
+    segments.push_back({0, 0, width});
+  }
+
+  bool LightmapSkyline::Insert(int w, int h, int &outx, int &outy) {
+    int best = -1;
+    int bestTop = INT_MAX;
+    int bestY = 0;
+
+    // bottom-left: the position with the lowest top edge wins, ties go to the leftmost
+    for (size_t i = 0; i < segments.size(); i++) {
+      int x = segments[i].x;
+      if (x + w > width)
+        break;
+
+      int y = 0;
+      int covered = 0;
+      for (size_t j = i; covered < w; j++) {
+        y = std::max(y, segments[j].y);
+        covered += segments[j].width;
+      }
+      if (y + h > height || y + h >= bestTop)
+        continue;
+
+      best = (int)i;
+      bestTop = y + h;
+      bestY = y;
+    }
+
+    if (best < 0)
+      return false;
+
+    outx = segments[best].x;
+    outy = bestY;
+
+    // the new segment replaces everything it covers, a partly covered segment is trimmed
+    int right = outx + w;
+    size_t end = best;
+    while (end < segments.size() && segments[end].x + segments[end].width <= right)
+      end++;
+    if (end < segments.size() && segments[end].x < right) {
+      segments[end].width -= right - segments[end].x;
+      segments[end].x = right;
+    }
+    segments.erase(segments.begin() + best, segments.begin() + end);
+    segments.insert(segments.begin() + best, Segment{outx, bestTop, w});
+
+    for (size_t i = 1; i < segments.size();) {
+      if (segments[i].y == segments[i - 1].y) {
+        segments[i - 1].width += segments[i].width;
+        segments.erase(segments.begin() + i);
+      } else {
+        i++;
+      }
+    }
+
+    usedWidth = std::max(usedWidth, right);
+    usedHeight = std::max(usedHeight, bestTop);
+    return true;
+  }
+
+  Lightmap::Lightmap(const uint8_t *data, size_t sz, int pageSize, bool luminance) {
     this->m_rawData = data;
     m_size = sz;
-    m_chart = LightmapChart{0};
+    m_pageSize = std::max(pageSize, 0);
+    m_luminance = luminance;
+    std::fill(std::begin(m_styleValues), std::end(m_styleValues), 256);
+    m_styleSurfaces.assign(MAX_LIGHTSTYLES, {});
   };
 
   const int Lightmap::Width() const { return m_width; }
@@ -15,102 +127,252 @@ namespace quakelib::bsp {
 
   const vector<Color> &Lightmap::RGBA() const { return m_lightmapData; }
 
-  void Lightmap::PackLitSurfaces(std::vector<SolidEntityPtr> ents) {
-    int maxblack[2] = {0, 0};
-    short blackofs[2] = {0, 0};
-    int blacklm;
+  std::span<const uint8_t> Lightmap::Data() const {
+    static_assert(sizeof(Color) == 4);
+    if (m_luminance)
+      return m_luminanceData;
+    return {reinterpret_cast<const uint8_t *>(m_lightmapData.data()), m_lightmapData.size() * sizeof(Color)};
+  }
+
+  int Lightmap::StyleValue(int style) const {
+    return style >= 0 && style < MAX_LIGHTSTYLES ? m_styleValues[style] : 0;
+  }
+
+  int Lightmap::EvaluateStyle(std::string_view pattern, float time) {
+    if (pattern.empty())
+      return 256;
+    int frame = (int)(std::max(time, 0.0f) * 10.0f) % (int)pattern.size();
+    return std::clamp(pattern[frame] - 'a', 0, 25) * 22;
+  }
+
+  const vector<LightmapRect> &Lightmap::UpdateStyles(std::span<const int> values) {
+    m_dirty.clear();
+    m_frame++;
+
+    size_t count = std::min(values.size(), (size_t)MAX_LIGHTSTYLES);
+    for (size_t style = 0; style < count; style++) {
+      int value = std::clamp(values[style], 0, 0x7fff);
+      if (value == m_styleValues[style])
+        continue;
+      m_styleValues[style] = value;
+
+      // a surface with several changed styles is only recomposited once
+      for (int surf : m_styleSurfaces[style]) {
+        if (m_stamp[surf] == m_frame)
+          continue;
+        m_stamp[surf] = m_frame;
+        fillSurfaceLightmap(surf);
+
+        const auto &ls = m_litSurfs[surf];
+        m_dirty.push_back({ls->lm_s, ls->lm_tex_num * m_pageHeight + ls->lm_t, (ls->extents[0] >> 4) + 1,
+                           (ls->extents[1] >> 4) + 1});
+      }
+    }
+    return m_dirty;
+  }
 
+  bool Lightmap::packPages(vector<Rect> &rects, int width, int height,
+                           vector<LightmapSkyline> &pages) const {
+    pages.clear();
+    for (auto &r : rects) {
+      // first fit over the open pages, a new page is started when none has room
+      size_t p = 0;
+      for (; p < pages.size(); p++) {
+        if (pages[p].Insert(r.w, r.h, r.x, r.y))
+          break;
+      }
+      if (p == pages.size()) {
+        pages.emplace_back(width, height);
+        if (!pages.back().Insert(r.w, r.h, r.x, r.y))
+          return false;
+      }
+      r.page = (int)p;
+    }
+    return true;
+  }
+
+  void Lightmap::PackLitSurfaces(std::vector<SolidEntityPtr> ents) {
     // generate surface list
     for (auto m : ents) {
       for (auto surf : m->Faces()) {
-        if (surf->fsurface->lightmap != -1) {
-          surf->lm_samples = m_rawData + (surf->fsurface->lightmap * 3);
+        if (surf->fsurface.lightmap != -1) {
+          surf->lm_samples = m_rawData + (surf->fsurface.lightmap * (m_luminance ? 1 : 3));
         }
         m_litSurfs.push_back(surf);
       }
     }
 
-    blacklm = allocateBlock(maxblack[0] + 1, maxblack[1] + 1, &blackofs[0], &blackofs[1]);
-
+    // UpdateStyles indexes these even when there is nothing to pack
+    m_styleCount.assign(m_litSurfs.size(), 0);
+    m_styleSurfaces.assign(MAX_LIGHTSTYLES, {});
+    m_stamp.assign(m_litSurfs.size(), 0);
     if (m_litSurfs.size() == 0)
       return;
 
-    // TODO: do a heap sort
+    // count the sample layers of each surface, layers past the end of the lighting data are dropped
+    for (size_t i = 0; i < m_litSurfs.size(); i++) {
+      const auto &surf = m_litSurfs[i];
+      if (!surf->lm_samples)
+        continue;
+
+      size_t area = ((surf->extents[0] >> 4) + 1) * ((surf->extents[1] >> 4) + 1);
+      int n = 0;
+      while (n < MAX_LIGHTMAPS && surf->fsurface.light[n] != 255 &&
+             (size_t)surf->fsurface.lightmap + (n + 1) * area <= m_size) {
+        m_styleSurfaces[surf->fsurface.light[n]].push_back((int)i);
+        n++;
+      }
+      m_styleCount[i] = n;
+    }
+
+    vector<Rect> rects;
+    int widest = 2, tallest = 1;
+    int area = 2;
     for (auto surf : m_litSurfs) {
       int smax = (surf->extents[0] >> 4) + 1;
       int tmax = (surf->extents[1] >> 4) + 1;
       this->m_sampleCount += smax * tmax;
 
-      if (surf->lm_samples) {
-        surf->lm_tex_num = allocateBlock(smax, tmax, &surf->lm_s, &surf->lm_t);
+      if (!surf->lm_samples)
         continue;
-      } else {
-        surf->lm_tex_num = blacklm;
-        surf->lm_s = blackofs[0];
-        surf->lm_t = blackofs[1];
-      }
+      rects.push_back({surf, smax, tmax});
+      widest = std::max(widest, smax);
+      tallest = std::max(tallest, tmax);
+      area += smax * tmax;
     }
 
-    // determine combined texture size and allocate memory for it
-    int xblocks = (int)std::ceil(std::sqrt(m_count));
-    int yblocks = (m_count + xblocks - 1) / xblocks;
-    m_width = xblocks * LM_BLOCK_WIDTH;
-    m_height = yblocks * LM_BLOCK_HEIGHT;
-    int lmsize = m_width * m_height;
+    // tallest first keeps the skyline flat, ties are broken on width and then face order
+    std::stable_sort(rects.begin(), rects.end(), [](const Rect &a, const Rect &b) {
+      return a.h != b.h ? a.h > b.h : a.w > b.w;
+    });
+
+    // a grey texel at (0, 0) and the black texel at (1, 0) shared by all unlit surfaces
+    rects.insert(rects.begin(), Rect{nullptr, 2, 1});
 
-    m_lightmapData.resize(lmsize);
-    // compute offsets for each lightmap block
-    for (int i = 0; i < m_count; i++) {
-      auto *lm = &m_offsets[i];
-      lm->x = (i % xblocks) * LM_BLOCK_WIDTH;
-      lm->y = (i / xblocks) * LM_BLOCK_HEIGHT;
+    vector<LightmapSkyline> pages;
+    if (m_pageSize > 0) {
+      // a face larger than a page gets a page of its own size rather than being dropped
+      int pageW = std::max(m_pageSize, widest);
+      int pageH = std::max(m_pageSize, tallest);
+      packPages(rects, pageW, pageH, pages);
+    } else {
+      // try a few atlas widths from the square estimate upwards, keep the smallest area
+      int start = std::max(widest, (int)std::ceil(std::sqrt((double)area)));
+      int step = std::max(1, start / 8);
+      long bestArea = LONG_MAX;
+      int bestWidth = start;
+      for (int w = start; w <= start * 2; w += step) {
+        vector<Rect> trial = rects;
+        if (!packPages(trial, w, INT_MAX, pages))
+          continue;
+        long used = (long)pages[0].usedWidth * pages[0].usedHeight;
+        if (used < bestArea) {
+          bestArea = used;
+          bestWidth = w;
+        }
+      }
+      packPages(rects, bestWidth, INT_MAX, pages);
     }
 
+    // every page shares the size of the largest one, pages are stacked vertically
+    m_pages = (int)pages.size();
+    m_width = 0;
+    m_pageHeight = 0;
+    for (auto &p : pages) {
+      m_width = std::max(m_width, p.usedWidth);
+      m_pageHeight = std::max(m_pageHeight, p.usedHeight);
+    }
+    m_height = m_pageHeight * m_pages;
+
     // fill reserved texel
-    m_lightmapData[0].Set(0x80, 0x80, 0x80, 0xff);
+    if (m_luminance) {
+      m_luminanceData.resize(m_width * m_height);
+      m_luminanceData[0] = 0x80;
+    } else {
+      m_lightmapData.resize(m_width * m_height);
+      m_lightmapData[0].Set(0x80, 0x80, 0x80, 0xff);
+    }
+
+    for (auto &r : rects) {
+      if (!r.surf)
+        continue;
+      r.surf->lm_tex_num = r.page;
+      r.surf->lm_s = r.x;
+      r.surf->lm_t = r.y;
+    }
 
     // fill lightmap samples
-    for (auto ls : m_litSurfs) {
-      auto lmofs = ((ls->extents[0] >> 4) + 1) / (float)m_width;
-      auto lm = &m_offsets[ls->lm_tex_num];
+    for (size_t i = 0; i < m_litSurfs.size(); i++) {
+      const auto &ls = m_litSurfs[i];
+      if (!ls->lm_samples) {
+        // every vertex samples the centre of the black texel, so unlit faces share their vertices
+        ls->lm_tex_num = 0;
+        ls->lm_s = 1;
+        ls->lm_t = 0;
+        for (auto &v : ls->verts) {
+          v.lm_uv.x = 1.5f / m_width;
+          v.lm_uv.y = 0.5f / m_pageHeight;
+        }
+        continue;
+      }
+
       float lmscalex = 1.f / 16.f / m_width;
-      float lmscaley = 1.f / 16.f / m_height;
+      float lmscaley = 1.f / 16.f / m_pageHeight;
 
       for (auto &v : ls->verts) {
         auto s = v.point.dot(ls->info->u_axis) + ls->info->u_offset;
         s -= ls->texturemins[0];
-        s += (ls->lm_s + lm->x) * 16;
+        s += ls->lm_s * 16;
         s += 8;
         s *= lmscalex;
 
         auto t = v.point.dot(ls->info->v_axis) + ls->info->v_offset;
         t -= ls->texturemins[1];
-        t += (ls->lm_t + lm->y) * 16;
+        t += ls->lm_t * 16;
         t += 8;
         t *= lmscaley;
 
         v.lm_uv.x = s;
         v.lm_uv.y = t;
       }
-      fillSurfaceLightmap(ls);
+      fillSurfaceLightmap(i);
     }
 
     return;
   }
 
-  void Lightmap::fillSurfaceLightmap(SurfacePtr surf) {
-    if (!m_rawData || !surf->lm_samples || surf->fsurface->light[0] == 255) {
+  void Lightmap::fillSurfaceLightmap(size_t index) {
+    const auto &surf = m_litSurfs[index];
+    int layers = m_styleCount[index];
+    if (!m_rawData || layers == 0) {
       return;
     }
 
-    auto &lm = m_offsets[surf->lm_tex_num];
     auto smax = (surf->extents[0] / 16) + 1;
     auto tmax = (surf->extents[1] / 16) + 1;
-    auto xofs = lm.x + surf->lm_s;
-    auto yofs = lm.y + surf->lm_t;
-    auto facesize = smax * tmax * 3;
+    auto xofs = surf->lm_s;
+    auto yofs = surf->lm_tex_num * m_pageHeight + surf->lm_t;
+    auto facesize = smax * tmax * (m_luminance ? 1 : 3);
+
+    // sum the style layers scaled by their current intensity
+    m_accum.assign(facesize, 0);
+    m_composite.resize(facesize);
+    for (int l = 0; l < layers; l++) {
+      int scale = m_styleValues[surf->fsurface.light[l]];
+      if (scale > 0)
+        accumulateSamples(m_accum.data(), surf->lm_samples + l * facesize, facesize, scale);
+    }
+    resolveSamples(m_accum.data(), m_composite.data(), facesize);
+
+    auto src = m_composite.data();
+    if (m_luminance) {
+      auto dst = m_luminanceData.data() + yofs * m_width + xofs;
+      for (int t = 0; t < tmax; t++, dst += m_width, src += smax) {
+        memcpy(dst, src, smax);
+      }
+      return;
+    }
 
-    auto src = surf->lm_samples;
     auto dst = &m_lightmapData.front() + yofs * m_width + xofs;
 
     // fill our RGBA lightmap pixel buffer
@@ -120,80 +382,4 @@ namespace quakelib::bsp {
       }
     }
   }
-
-  void Lightmap::initChart(LightmapChart *chart, int width, int height) {
-    if (chart->width != width) {
-      chart->allocated = (int *)realloc(chart->allocated, sizeof(chart->allocated[0]) * width);
-    }
-    memset(chart->allocated, 0, sizeof(chart->allocated[0]) * width);
-    chart->width = width;
-    chart->height = height;
-    chart->x = 0;
-    chart->reverse = false;
-  }
-
-  bool Lightmap::addChart(LightmapChart *chart, int w, int h, short *outx, short *outy) {
-    int i, x, y;
-    if (chart->width < w || chart->height < h) {
-      return false;
-    }
-
-    // advance horizontally, reversing direction at the edges
-    if (chart->reverse) {
-      if (chart->x < w) {
-        chart->x = 0;
-        chart->reverse = false;
-        goto forward;
-      }
-    reverse:
-      x = chart->x - w;
-      chart->x = x;
-    } else {
-      if (chart->x + w > chart->width) {
-        chart->x = chart->width;
-        chart->reverse = true;
-        goto reverse;
-      }
-    forward:
-      x = chart->x;
-      chart->x += w;
-    }
-
-    // find lowest unoccupied vertical position
-    y = 0;
-    for (i = 0; i < w; i++)
-      y = std::max(y, chart->allocated[x + i]);
-    if (y + h > chart->height)
-      return false;
-
-    // update vertical position for each column
-    for (i = 0; i < w; i++)
-      chart->allocated[x + i] = y + h;
-
-    *outx = x;
-    *outy = y;
-
-    return true;
-  }
-
-  int Lightmap::allocateBlock(int w, int h, short *x, short *y) {
-    for (int texnum = m_lastAllocated; texnum < MAX_SANITY_LIGHTMAPS; texnum++) {
-      if (texnum == m_count) {
-        m_count++;
-        m_offsets.push_back(vec2i_t{0});
-        initChart(&m_chart, LM_BLOCK_WIDTH, LM_BLOCK_HEIGHT);
-        if (m_count == 1) {
-          m_chart.x = 1;
-          m_chart.allocated[0] = 1;
-        }
-      }
-
-      if (!addChart(&m_chart, w, h, x, y))
-        continue;
-
-      m_lastAllocated = texnum;
-      return texnum;
-    }
-    return 0;
-  }
-} // namespace quakelib::bsp
\ No newline at end of file
+} // namespace quakelib::bsp
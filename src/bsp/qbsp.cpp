@@ -1,53 +1,166 @@
+#include "../common/parallel.h"
+#include <cstring>
 #include <filesystem>
 #include <quakelib/bsp/qbsp.h>
 #include <quakelib/entity_parser.h>
 
 namespace quakelib::bsp {
-  template <typename T> bool loadLumptoVector(std::ifstream &istream, const lump_t &lump, vector<T> &v) {
+  template <typename T> bool QBsp::viewLump(int lumpType, std::span<const T> &out) {
+    const lump_t &lump = m_content.header.lump[lumpType];
+    out = {};
     if (lump.length == 0) {
+      return true;
+    }
+
+    if (static_cast<uint64_t>(lump.offset) + lump.length > m_file.Size() || lump.length % sizeof(T) != 0) {
       return false;
     }
-    v.resize(lump.length / sizeof(T));
-    istream.seekg(lump.offset, istream.beg);
-    istream.read((char *)(&v[0]), lump.length);
+
+    const unsigned char *data = m_file.Data() + lump.offset;
+    if (reinterpret_cast<uintptr_t>(data) % alignof(T) != 0) {
+      // reinterpreting misaligned memory is undefined, keep one aligned copy instead
+      auto &copy = m_ownedLumps.emplace_back(data, data + lump.length);
+      data = copy.data();
+    }
+
+    out = std::span<const T>(reinterpret_cast<const T *>(data), lump.length / sizeof(T));
     return true;
   }
 
+  template <typename D, auto widen, typename T> bool QBsp::widenLump(int lumpType, LumpView<T> &out) {
+    const lump_t &lump = m_content.header.lump[lumpType];
+    out = {};
+    if (lump.length == 0) {
+      return true;
+    }
+
+    if (static_cast<uint64_t>(lump.offset) + lump.length > m_file.Size() || lump.length % sizeof(D) != 0) {
+      return false;
+    }
+
+    // elements are read with memcpy, so the lump needs no aligned copy either
+    out = LumpView<T>(m_file.Data() + lump.offset, lump.length / sizeof(D), sizeof(D),
+                      [](const unsigned char *data, size_t count) {
+                        D in;
+                        memcpy(&in, data, sizeof(D));
+                        return widen(in, count);
+                      });
+    return true;
+  }
+
+  template <typename T> bool QBsp::viewLump(int lumpType, LumpView<T> &out) {
+    std::span<const T> items;
+    bool ok = viewLump(lumpType, items);
+    out = items;
+    return ok;
+  }
+
+  static bbox3f_t widenBounds(const bbox3s_t &b) {
+    return {{(float)b.min.x, (float)b.min.y, (float)b.min.z},
+            {(float)b.max.x, (float)b.max.y, (float)b.max.z}};
+  }
+
+  // version 29 and 30, child references past the node count wrap around to leaves and contents
+  static int32_t widenChild(uint16_t c, size_t count) {
+    return c < count ? (int32_t)c : (int32_t)c - 0x10000;
+  }
+
+  template <typename L> static fLeaf_t widenLeaf(const L &l, size_t) {
+    fLeaf_t out;
+    out.type = l.type;
+    out.vislist = l.vislist;
+    out.bound = widenBounds(l.bound);
+    out.lface_id = l.lface_id;
+    out.lface_num = l.lface_num;
+    out.sndwater = l.ambient[0];
+    out.sndsky = l.ambient[1];
+    out.sndslime = l.ambient[2];
+    out.sndlava = l.ambient[3];
+    return out;
+  }
+
+  static fNode_t widenNode2PSB(const fNode2PSB_t &n, size_t) {
+    return {n.plane_id, n.front, n.back, widenBounds(n.box), n.face_id, n.face_num};
+  }
+
+  static fNode_t widenNode29(const fNode29_t &n, size_t count) {
+    return {n.plane_id,         widenChild(n.front, count), widenChild(n.back, count),
+            widenBounds(n.box), n.face_id,                  n.face_num};
+  }
+
+  static fClipNode_t widenClipNode29(const fClipNode29_t &n, size_t count) {
+    return {n.plane_id, widenChild(n.front, count), widenChild(n.back, count)};
+  }
+
+  static fFace_t widenFace29(const fFace29_t &f, size_t) {
+    fFace_t out;
+    out.plane_id = f.plane_id;
+    out.side = f.side;
+    out.ledge_id = f.ledge_id;
+    out.ledge_num = f.ledge_num;
+    out.texinfo_id = f.texinfo_id;
+    memcpy(out.light, f.light, sizeof(out.light));
+    out.lightmap = f.lightmap;
+    return out;
+  }
+
+  static fEdge_t widenEdge29(const fEdge29_t &e, size_t) { return {e.vertex0, e.vertex1}; }
+
+  static uint32_t widenMark29(const uint16_t &m, size_t) { return m; }
+
+  bool QBsp::loadIndexedLumps() {
+    uint32_t version = m_content.header.version;
+    if (version == MAGIC_BSP2) {
+      return viewLump(LUMP_NODES, m_content.nodes) && viewLump(LUMP_CLIPNODES, m_content.clipNodes) &&
+             viewLump(LUMP_LEAFS, m_content.leafs) && viewLump(LUMP_FACES, m_content.faces) &&
+             viewLump(LUMP_EDGES, m_content.edges) && viewLump(LUMP_MARKSURFACES, m_content.markSurfaces);
+    }
+
+    if (version == MAGIC_2PSB) {
+      return viewLump(LUMP_CLIPNODES, m_content.clipNodes) && viewLump(LUMP_FACES, m_content.faces) &&
+             viewLump(LUMP_EDGES, m_content.edges) && viewLump(LUMP_MARKSURFACES, m_content.markSurfaces) &&
+             widenLump<fLeaf2PSB_t, widenLeaf<fLeaf2PSB_t>>(LUMP_LEAFS, m_content.leafs) &&
+             widenLump<fNode2PSB_t, widenNode2PSB>(LUMP_NODES, m_content.nodes);
+    }
+
+    return widenLump<fNode29_t, widenNode29>(LUMP_NODES, m_content.nodes) &&
+           widenLump<fClipNode29_t, widenClipNode29>(LUMP_CLIPNODES, m_content.clipNodes) &&
+           widenLump<fLeaf29_t, widenLeaf<fLeaf29_t>>(LUMP_LEAFS, m_content.leafs) &&
+           widenLump<fFace29_t, widenFace29>(LUMP_FACES, m_content.faces) &&
+           widenLump<fEdge29_t, widenEdge29>(LUMP_EDGES, m_content.edges) &&
+           widenLump<uint16_t, widenMark29>(LUMP_MARKSURFACES, m_content.markSurfaces);
+  }
+
   int QBsp::LoadFile(const char *fileName) {
-    m_istream.open(fileName, std::ios::binary);
-    m_istream.read((char *)(&m_content.header), sizeof(header_t));
+    if (!m_file.Open(fileName, m_config.memoryMap) || m_file.Size() < sizeof(header_t)) {
+      return QBSP_ERR_OPEN_FAILED;
+    }
+    memcpy(&m_content.header, m_file.Data(), sizeof(header_t));
 
-    if (m_content.header.version != MAGIC_V29 && m_content.header.version != MAGIC_V30) {
+    uint32_t version = m_content.header.version;
+    if (version != MAGIC_V29 && version != MAGIC_V30 && version != MAGIC_BSP2 && version != MAGIC_2PSB) {
       return QBSP_ERR_WRONG_VERSION;
     }
 
     std::filesystem::path p = fileName;
     m_mapPath = p.replace_extension().string();
 
-    loadLumptoVector(m_istream, m_content.header.lump[LUMP_VERTICES], m_content.vertices);
-    loadLumptoVector(m_istream, m_content.header.lump[LUMP_EDGES], m_content.edges);
-    loadLumptoVector(m_istream, m_content.header.lump[LUMP_FACES], m_content.faces);
-    loadLumptoVector(m_istream, m_content.header.lump[LUMP_TEXINFO], m_content.surfaces);
-    loadLumptoVector(m_istream, m_content.header.lump[LUMP_SURFEDGES], m_content.surfEdges);
-    loadLumptoVector(m_istream, m_content.header.lump[LUMP_MODELS], m_content.models);
-
-    loadLumptoVector(m_istream, m_content.header.lump[LUMP_PLANES], m_content.planes);
-    loadLumptoVector(m_istream, m_content.header.lump[LUMP_NODES], m_content.nodes);
-    loadLumptoVector(m_istream, m_content.header.lump[LUMP_LEAFS], m_content.leafs);
-
-    if (m_config.loadTextures) {
-      loadTextureInfo();
+    bool lumpsValid =
+        viewLump(LUMP_VERTICES, m_content.vertices) && viewLump(LUMP_TEXINFO, m_content.surfaces) &&
+        viewLump(LUMP_SURFEDGES, m_content.surfEdges) && viewLump(LUMP_MODELS, m_content.models) &&
+        viewLump(LUMP_PLANES, m_content.planes) && viewLump(LUMP_LIGHTING, m_content.lighting) &&
+        viewLump(LUMP_VISIBILITY, m_content.visibility) && viewLump(LUMP_ENTITIES, m_content.entities) &&
+        loadIndexedLumps();
+    if (!lumpsValid) {
+      return QBSP_ERR_CORRUPT_LUMP;
     }
 
-    if (m_content.header.lump[LUMP_ENTITIES].length > 0) {
-      m_istream.seekg(m_content.header.lump[LUMP_ENTITIES].offset, m_istream.beg);
-      std::string entData;
-      entData.resize(m_content.header.lump[LUMP_ENTITIES].length);
-      m_istream.read(entData.data(), m_content.header.lump[LUMP_ENTITIES].length);
+    if (!m_content.entities.empty()) {
+      std::string entData(m_content.entities.begin(), m_content.entities.end());
 
       EntityParser::ParseEntites(entData, [&](ParsedEntity *pe) {
         if (pe->type == EntityType::SOLID || pe->type == EntityType::WORLDSPAWN) {
-          auto se = std::make_shared<SolidEntity>(this->Content(), pe);
+          auto se = std::make_shared<SolidEntity>(this->m_content, pe);
           this->m_solidEntities.emplace_back(se);
           this->m_entities[se->ClassName()].push_back(se);
           if (se->IsWorldSpawn()) {
@@ -62,63 +175,122 @@ namespace quakelib::bsp {
       });
     }
 
-    prepareLightMaps();
     prepareLevel();
-    m_istream.close();
+
+    if (m_config.lazyLoad) {
+      for (auto &se : m_solidEntities) {
+        se->m_requestGeometry = [this]() { ensureGeometry(); };
+      }
+    } else {
+      Vis();
+      Collision();
+      ensureGeometry();
+    }
 
     return QBSP_OK;
   }
 
-  void QBsp::prepareLightMaps() {
-    int lm_size = m_content.header.lump[LUMP_LIGHTING].length;
-    uint8_t *lm_dataBW = (uint8_t *)calloc(sizeof(uint8_t), lm_size);
-    m_istream.seekg(m_content.header.lump[LUMP_LIGHTING].offset, m_istream.beg);
-    m_istream.read((char *)lm_dataBW, m_content.header.lump[LUMP_LIGHTING].length);
+  QBsp::~QBsp() {
+    for (auto &se : m_solidEntities) {
+      se->m_requestGeometry = nullptr;
+      se->m_ctx = nullptr;
+    }
+  }
+
+  void QBsp::ensureTextures() const {
+    if (m_texturesLoaded)
+      return;
+    m_texturesLoaded = true;
+
+    if (m_config.loadTextures) {
+      loadTextureInfo();
+    }
+  }
+
+  void QBsp::ensureGeometry() const {
+    if (m_geometryLoaded)
+      return;
+    m_geometryLoaded = true;
+
+    ensureTextures();
+
+    // every face writes its own slice of its model's store, so faces of all models build independently
+    vector<std::pair<SolidEntity *, int>> faces;
+    for (auto &se : m_solidEntities) {
+      int count = se->allocateFaces();
+      for (int i = 0; i < count; i++)
+        faces.emplace_back(se.get(), i);
+    }
+    auto build = [&](size_t i) { faces[i].first->buildFace(faces[i].second); };
+    if (m_config.parallelLoad) {
+      ParallelFor(faces.size(), build, m_config.parallelChunkSize ? m_config.parallelChunkSize : 256);
+    } else {
+      for (size_t i = 0; i < faces.size(); i++)
+        build(i);
+    }
+
+    prepareLightMaps();
+
+    if (m_config.convertCoordToOGL) {
+      for (auto &se : m_solidEntities) {
+        se->convertToOpenGLCoords();
+      }
+    }
+  }
+
+  void QBsp::prepareLightMaps() const {
+    int lm_size = m_content.lighting.size();
+    const uint8_t *lm_dataBW = m_content.lighting.data();
+
+    // the lightmap keeps pointing at the samples for later style updates
+    m_lm.reset();
+    m_lmSamples.clear();
 
-    uint8_t *lm_dataRGB = nullptr;
     auto litFile = m_mapPath + ".lit";
     bool hasLitFile = false;
     if (std::filesystem::exists(litFile)) {
       auto length = std::filesystem::file_size(litFile);
-      if (length > 0) {
+      if (length > 8) {
         std::ifstream litStream(litFile, std::ios_base::binary);
         char magic[5] = {0};
         litStream.read(reinterpret_cast<char *>(&magic), 4);
         if (string(magic).compare("QLIT") == 0) {
-          lm_dataRGB = (uint8_t *)calloc(sizeof(uint8_t), length - 4);
-          litStream.read(reinterpret_cast<char *>(lm_dataRGB), length - 4);
-          lm_dataRGB = lm_dataRGB + 4;
-          lm_size = length - 8;
+          // the RGB samples follow the magic and the version
+          m_lmSamples.resize(length - 8);
+          litStream.seekg(8);
+          litStream.read(reinterpret_cast<char *>(m_lmSamples.data()), m_lmSamples.size());
+          lm_size = (length - 8) / 3;
           hasLitFile = true;
         }
       }
     }
+    if (!hasLitFile && m_config.luminanceLightmap) {
+      // grey samples are used as they are, straight from the lighting lump
+      m_lm = std::make_unique<Lightmap>(lm_dataBW, lm_size, m_config.lightmapPageSize, true);
+      m_lm->PackLitSurfaces(m_solidEntities);
+      return;
+    }
     if (!hasLitFile) {
-      if (lm_dataRGB != nullptr) {
-        free(lm_dataRGB);
-      }
-      lm_dataRGB = (uint8_t *)calloc(sizeof(uint8_t), lm_size * 3);
+      m_lmSamples.resize(static_cast<size_t>(lm_size) * 3);
       int i2 = 0;
       for (int i = 0; i < lm_size; i++) {
         uint8_t d = lm_dataBW[i];
-        lm_dataRGB[i2++] = d;
-        lm_dataRGB[i2++] = d;
-        lm_dataRGB[i2++] = d;
+        m_lmSamples[i2++] = d;
+        m_lmSamples[i2++] = d;
+        m_lmSamples[i2++] = d;
       }
-      free(lm_dataBW);
     }
 
-    m_lm = new Lightmap(lm_dataRGB, lm_size);
+    m_lm = std::make_unique<Lightmap>(m_lmSamples.data(), lm_size, m_config.lightmapPageSize);
     m_lm->PackLitSurfaces(m_solidEntities);
   }
 
   void QBsp::prepareLevel() {
     if (m_config.convertCoordToOGL) {
+      // brush model surfaces are converted once they are built, see ensureGeometry
       for (auto pe : m_entities) {
         for (auto &e : pe.second) {
-          if (auto se = std::dynamic_pointer_cast<SolidEntity>(e)) {
-            se->convertToOpenGLCoords();
-          } else if (auto pt = std::dynamic_pointer_cast<quakelib::PointEntity>(e)) {
+          if (auto pt = std::dynamic_pointer_cast<quakelib::PointEntity>(e)) {
             auto o = pt->Origin();
             auto temp = o[1];
             o[1] = o[2];
@@ -130,48 +302,55 @@ namespace quakelib::bsp {
     }
   }
 
-  int QBsp::loadTextureInfo() {
-    if (!m_istream.is_open() || m_content.header.version == 0) {
+  int QBsp::loadTextureInfo() const {
+    const lump_t &lump = m_content.header.lump[LUMP_TEXTURES];
+    if (m_file.Size() == 0 || lump.length < sizeof(int32_t) ||
+        static_cast<uint64_t>(lump.offset) + lump.length > m_file.Size()) {
+      return -1;
+    }
+
+    const unsigned char *base = m_file.Data() + lump.offset;
+    int32_t numtex;
+    memcpy(&numtex, base, sizeof(int32_t));
+    if (numtex < 0 || sizeof(int32_t) * (1 + static_cast<uint64_t>(numtex)) > lump.length) {
       return -1;
     }
 
-    mipheader_t mh;
-    m_istream.seekg(m_content.header.lump[LUMP_TEXTURES].offset, m_istream.beg);
-    m_istream.read((char *)(&mh.numtex), sizeof(int32_t));
-    mh.offset = (int32_t *)malloc(sizeof(int32_t) * mh.numtex);
-    m_istream.read((char *)(mh.offset), sizeof(int32_t) * mh.numtex);
+    m_content.miptextures.resize(numtex);
+    m_textures.resize(numtex);
+    auto decode = [&](size_t i) {
+      int32_t offset;
+      memcpy(&offset, base + sizeof(int32_t) * (1 + i), sizeof(int32_t));
+      if (offset < 0 || static_cast<uint64_t>(offset) + sizeof(miptex_t) > lump.length)
+        return;
 
-    m_content.miptextures.resize(mh.numtex);
-    m_textures.resize(mh.numtex);
-    for (int i = 0; i < mh.numtex; i++) {
-      auto mho = mh.offset[i];
-      if (mh.offset[i] < 0)
-        continue;
       miptex_t miptex;
-      auto t = mh.offset[i];
-      m_istream.seekg(m_content.header.lump[LUMP_TEXTURES].offset + mh.offset[i], m_istream.beg);
-      m_istream.read((char *)(&miptex), sizeof(miptex_t));
+      memcpy(&miptex, base + offset, sizeof(miptex_t));
       m_content.miptextures[i] = miptex;
       bspTexure tex(miptex);
-      if (m_config.loadTextureData) {
-        auto texOffset = m_content.header.lump[LUMP_TEXTURES].offset + mh.offset[i] + miptex.offset[0];
-        loadTexelBuff(&tex.data, texOffset, miptex.width * miptex.height);
+
+      // pixels are referenced in place, textures stored in an external wad have no offset
+      uint64_t texels = static_cast<uint64_t>(offset) + miptex.offset[0];
+      if (m_config.loadTextureData && miptex.offset[0] != 0 &&
+          texels + static_cast<uint64_t>(miptex.width) * miptex.height <= lump.length) {
+        tex.data = base + texels;
         tex.hasData = true;
         tex.name = miptex.name;
       }
       m_textures[i] = tex;
+    };
+
+    // the lump is one buffer, every texture reads its own header and writes its own slot
+    if (m_config.parallelLoad) {
+      ParallelFor(numtex, decode, m_config.parallelChunkSize ? m_config.parallelChunkSize : 16);
+    } else {
+      for (int i = 0; i < numtex; i++)
+        decode(i);
     }
 
     return 0;
   }
 
-  void QBsp::loadTexelBuff(unsigned char **buffOut, uint32_t offset, uint32_t len) {
-    m_istream.seekg(offset, m_istream.beg);
-    *buffOut = (unsigned char *)malloc(len);
-    m_istream.read((char *)(*buffOut), len);
-    return;
-  }
-
   bool QBsp::Entities(const string &className, std::function<bool(EntityPtr)> cb) const {
     if (auto ev = m_entities.find(className); ev != m_entities.end()) {
       for (const auto e : m_entities.find(className)->second) {
@@ -197,10 +376,48 @@ namespace quakelib::bsp {
     return std::dynamic_pointer_cast<SolidEntity>(ent);
   };
 
-  const bspFileContent &QBsp::Content() const { return m_content; }
+  const bspFileContent &QBsp::Content() const {
+    ensureTextures();
+    return m_content;
+  }
+
+  const vector<bspTexure> &QBsp::Textures() const {
+    ensureTextures();
+    return m_textures;
+  };
+
+  const Lightmap *QBsp::LightMap() const {
+    ensureGeometry();
+    return m_lm.get();
+  };
+
+  Lightmap *QBsp::LightMap() {
+    ensureGeometry();
+    return m_lm.get();
+  };
 
-  const vector<bspTexure> &QBsp::Textures() const { return m_textures; };
+  const BspVisibility &QBsp::Vis() const {
+    if (!m_visBuilt) {
+      m_vis = BspVisibility(m_content, Tree());
+      m_visBuilt = true;
+    }
+    return m_vis;
+  }
 
-  const Lightmap *QBsp::LightMap() const { return m_lm; };
+  const BspTree &QBsp::Tree() const {
+    if (!m_treeBuilt) {
+      m_tree = BspTree(m_content, m_config.convertCoordToOGL);
+      m_treeBuilt = true;
+    }
+    return m_tree;
+  }
+
+  const BspCollision &QBsp::Collision() const {
+    if (!m_collisionBuilt) {
+      m_collision = BspCollision(m_content, m_config.convertCoordToOGL);
+      m_collisionBuilt = true;
+    }
+    return m_collision;
+  }
 
 } // namespace quakelib::bsp
\ No newline at end of file
@@ -1,16 +1,47 @@
 #include <algorithm> // for transform
+#include <cstring>
 #include <iostream>
 #include <quakelib/bsp/lightmap.h>
 #include <quakelib/bsp/qbsp_provider.h>
+#include <quakelib/face_merge.h>
+#include <quakelib/mesh_optimize.h>
 #include <quakelib/wad/palette.h>
+#include <unordered_map>
 
 namespace quakelib {
+  // Faces of the same plane meet at the same BSP vertex, they share it when the texture and
+  // lightmap coordinates agree as well
+  struct SharedVertexKey {
+    uint32_t vertex;
+    uint32_t plane; // plane * 2 + side
+    int32_t page;   // lightmap page, lm_uv of different pages address different texels
+    float uv[2];
+    float lm_uv[2];
+
+    bool operator==(const SharedVertexKey &o) const {
+      return vertex == o.vertex && plane == o.plane && page == o.page && memcmp(uv, o.uv, sizeof(uv)) == 0 &&
+             memcmp(lm_uv, o.lm_uv, sizeof(lm_uv)) == 0;
+    }
+  };
+
+  struct SharedVertexHash {
+    size_t operator()(const SharedVertexKey &k) const {
+      uint32_t bits[4];
+      memcpy(bits, k.uv, sizeof(k.uv));
+      memcpy(bits + 2, k.lm_uv, sizeof(k.lm_uv));
+      size_t h = (size_t)k.vertex * 0x9E3779B1u ^ (size_t)k.plane * 0x85EBCA77u ^ (size_t)(uint32_t)k.page;
+      for (uint32_t b : bits)
+        h = (h ^ b) * 0x100000001B3ull;
+      return h;
+    }
+  };
 
   QBspProvider::QBspProvider() : m_bsp(std::make_unique<quakelib::bsp::QBsp>()) {}
 
   bool QBspProvider::Load(const std::string &path) { return Load(path, quakelib::bsp::QBspConfig()); }
 
   bool QBspProvider::Load(const std::string &path, const quakelib::bsp::QBspConfig &cfg) {
+    m_meshCache.clear();
     m_bsp = std::make_unique<quakelib::bsp::QBsp>(cfg);
     return m_bsp->LoadFile(path.c_str()) == quakelib::bsp::QBSP_OK;
   }
@@ -20,6 +51,7 @@ namespace quakelib {
   }
 
   void QBspProvider::SetFaceType(const std::string &textureName, SurfaceType type) {
+    m_meshCache.clear();
     m_faceTypes[textureName] = type;
     std::string lower = textureName;
     std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
@@ -79,6 +111,10 @@ namespace quakelib {
     if (!bspEnt)
       return {};
 
+    auto cached = m_meshCache.find(bspEnt.get());
+    if (cached != m_meshCache.end())
+      return cached->second;
+
     std::map<std::string, std::vector<std::shared_ptr<bsp::Surface>>> facesByName;
 
     for (const auto &face : bspEnt->Faces()) {
@@ -91,8 +127,48 @@ namespace quakelib {
       facesByName[name].push_back(face);
     }
 
+    // GetLightmapData exports the pages stacked into one image
+    const auto *lm = m_bsp->LightMap();
+    int pages = lm ? lm->Pages() : 0;
+
+    auto toVertex = [pages](const bsp::SurfacePtr &face, const bsp::Vertex &v) {
+      Vertex qv;
+      qv.point = {v.point.x, v.point.y, v.point.z};
+      qv.normal = {v.normal.x, v.normal.y, v.normal.z};
+      qv.uv = {v.uv.x, v.uv.y};
+      qv.lightmap_uv = {v.lm_uv.x, v.lm_uv.y};
+      if (pages > 1)
+        qv.lightmap_uv.Y = (v.lm_uv.y + face->lm_tex_num) / pages;
+      qv.tangent = {0, 0, 0, 0};
+      return qv;
+    };
+
+    // all textures are merged in one pass grouped by texture, so corners that faces of another
+    // texture rely on are kept
+    const auto &cfg = m_bsp->Config();
+    std::vector<std::vector<MergePolygon>> merged;
+    if (cfg.mergeCoplanarFaces) {
+      std::vector<MergePolygon> polygons;
+      int group = 0;
+      for (const auto &[name, faces] : facesByName) {
+        for (const auto &face : faces) {
+          MergePolygon &polygon = polygons.emplace_back();
+          polygon.group = group;
+          for (const auto &v : face->verts)
+            polygon.vertices.push_back(toVertex(face, v));
+        }
+        group++;
+      }
+      MergeCoplanarPolygons(polygons);
+      merged.resize(facesByName.size());
+      for (auto &polygon : polygons)
+        merged[polygon.group].push_back(std::move(polygon));
+    }
+
     std::vector<RenderMesh> result;
+    size_t batch = 0;
     for (const auto &[name, faces] : facesByName) {
+      size_t group = batch++;
       RenderMesh mesh;
       mesh.textureName = name;
 
@@ -111,26 +187,46 @@ namespace quakelib {
         mesh.textureHeight = faces[0]->textureReference->height;
       }
 
-      uint32_t currentVertexOffset = 0;
+      if (cfg.mergeCoplanarFaces) {
+        AppendPolygons(mesh, merged[group]);
+        if (cfg.optimizeVertexCache)
+          mesh.stats = OptimizeMesh(mesh, cfg.optimizeOverdraw);
+        result.push_back(mesh);
+        continue;
+      }
+
+      const auto &ctx = m_bsp->Content();
+      std::unordered_map<SharedVertexKey, uint32_t, SharedVertexHash> shared;
+      std::vector<uint32_t> remap;
       for (const auto &face : faces) {
-        for (const auto &v : face->verts) {
-          Vertex qv;
-          qv.point = {v.point.x, v.point.y, v.point.z};
-          qv.normal = {v.normal.x, v.normal.y, v.normal.z};
-          qv.uv = {v.uv.x, v.uv.y};
-          qv.lightmap_uv = {v.lm_uv.x, v.lm_uv.y};
-          qv.tangent = {0, 0, 0, 0};
-
-          mesh.vertices.push_back(qv);
+        remap.resize(face->verts.size());
+        for (size_t i = 0; i < face->verts.size(); i++) {
+          const auto &v = face->verts[i];
+          int e = ctx.surfEdges[face->fsurface.ledge_id + i];
+          SharedVertexKey key;
+          key.vertex = e >= 0 ? ctx.edges[e].vertex0 : ctx.edges[-e].vertex1;
+          key.plane = face->fsurface.plane_id * 2 + (face->fsurface.side ? 1 : 0);
+          key.page = face->lm_tex_num;
+          key.uv[0] = v.uv.x;
+          key.uv[1] = v.uv.y;
+          key.lm_uv[0] = v.lm_uv.x;
+          key.lm_uv[1] = v.lm_uv.y;
+
+          auto [it, inserted] = shared.try_emplace(key, (uint32_t)mesh.vertices.size());
+          remap[i] = it->second;
+          if (inserted)
+            mesh.vertices.push_back(toVertex(face, v));
         }
 
         for (auto idx : face->indices) {
-          mesh.indices.push_back(idx + currentVertexOffset);
+          mesh.indices.push_back(remap[idx]);
         }
-        currentVertexOffset += face->verts.size();
       }
+      if (cfg.optimizeVertexCache)
+        mesh.stats = OptimizeMesh(mesh, cfg.optimizeOverdraw);
       result.push_back(mesh);
     }
+    m_meshCache[bspEnt.get()] = result;
     return result;
   }
 
@@ -170,24 +266,23 @@ namespace quakelib {
   }
 
   std::optional<TextureData> QBspProvider::GetLightmapData() const {
-    const auto *lm = m_bsp->LightMap();
-    if (!lm)
+    auto view = GetLightmapView();
+    if (!view)
       return std::nullopt;
 
     TextureData td;
-    td.width = lm->Width();
-    td.height = lm->Height();
-    const auto &rgba = lm->RGBA();
-    td.data.resize(rgba.size() * 4);
-
-    // Copy data
-    for (size_t i = 0; i < rgba.size(); ++i) {
-      td.data[i * 4 + 0] = rgba[i].rgba[0];
-      td.data[i * 4 + 1] = rgba[i].rgba[1];
-      td.data[i * 4 + 2] = rgba[i].rgba[2];
-      td.data[i * 4 + 3] = rgba[i].rgba[3];
-    }
+    td.width = view->width;
+    td.height = view->height;
+    td.channels = view->channels;
+    td.data.assign(view->data.begin(), view->data.end());
     return td;
   }
 
+  std::optional<TextureView> QBspProvider::GetLightmapView() const {
+    const auto *lm = m_bsp->LightMap();
+    if (!lm)
+      return std::nullopt;
+    return TextureView{lm->Width(), lm->Height(), lm->Channels(), lm->Data()};
+  }
+
 } // namespace quakelib
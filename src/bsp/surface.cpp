@@ -5,7 +5,8 @@
 
 namespace quakelib::bsp {
 
-  void Surface::Build(const bspFileContent &ctx, const fFace_t *fsurf) {
+  void Surface::Build(const bspFileContent &ctx, const fFace_t &fsurf, std::span<Vertex> outVerts,
+                      std::span<uint32_t> outIndices) {
     float mins[2], maxs[2], val;
     int bmins[2], bmaxs[2];
 
@@ -16,13 +17,13 @@ namespace quakelib::bsp {
     float min_u = 0, min_v = 0;
 
     fsurface = fsurf;
-    info = &ctx.surfaces[fsurface->texinfo_id];
+    info = &ctx.surfaces[fsurface.texinfo_id];
     const auto &tex = ctx.miptextures[info->texture_id];
 
     // Calculate normal from plane
-    const auto &plane = ctx.planes[fsurface->plane_id];
+    const auto &plane = ctx.planes[fsurface.plane_id];
     vec3f_t planeNormal = plane.normal;
-    if (fsurface->side == 1) {
+    if (fsurface.side == 1) {
       planeNormal.x = -planeNormal.x;
       planeNormal.y = -planeNormal.y;
       planeNormal.z = -planeNormal.z;
@@ -35,9 +36,18 @@ namespace quakelib::bsp {
         {info->v_axis.x, info->v_axis.y, info->v_axis.z, info->v_offset},
     };
 
-    verts.resize(fsurface->ledge_num);
-    for (int i = 0; i < fsurface->ledge_num; i++) {
-      int e = ctx.surfEdges[fsurface->ledge_id + i];
+    verts = outVerts;
+    indices = outIndices;
+
+    // faces with fewer than three edges have no triangles and no lightmap
+    if (verts.size() < 3) {
+      extents[0] = extents[1] = 0;
+      texturemins[0] = texturemins[1] = 0;
+      return;
+    }
+
+    for (int i = 0; i < fsurface.ledge_num; i++) {
+      int e = ctx.surfEdges[fsurface.ledge_id + i];
       auto &v = verts[i];
       if (e >= 0)
         v.point = ctx.vertices[ctx.edges[e].vertex0];
@@ -74,9 +84,8 @@ namespace quakelib::bsp {
       extents[i] = (bmaxs[i] - bmins[i]) * 16;
     }
 
-    indices.resize((fsurface->ledge_num - 2) * 3);
     int tristep = 1;
-    for (int i = 1; i < verts.size() - 1; i++) {
+    for (uint32_t i = 1; i + 1 < verts.size(); i++) {
       indices[tristep - 1] = 0;
       indices[tristep] = i;
       indices[tristep + 1] = i + 1;
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <quakelib/bsp/visibility.h>
+
+namespace quakelib::bsp {
+  BspVisibility::BspVisibility(const bspFileContent &ctx, const BspTree &tree) : m_ctx(&ctx), m_tree(&tree) {
+    if (!ctx.models.empty()) {
+      m_numLeaves = std::clamp(ctx.models[0].numleafs, 0, std::max(0, (int)ctx.leafs.size() - 1));
+    }
+    m_cache.resize(m_numLeaves + 1);
+  }
+
+  void BspVisibility::decompress(int leaf, vector<uint8_t> &out) const {
+    int rowBytes = (m_numLeaves + 7) >> 3;
+    out.assign(rowBytes, 0);
+
+    int visofs = leaf > 0 ? m_ctx->leafs[leaf].vislist : -1;
+    const auto &vis = m_ctx->visibility;
+    if (visofs < 0 || visofs >= (int)vis.size()) {
+      // no vis data, everything is visible
+      std::fill(out.begin(), out.end(), 0xff);
+      return;
+    }
+
+    // runs of zero bytes are stored as 0 followed by the run length
+    size_t in = visofs;
+    int o = 0;
+    while (o < rowBytes && in < vis.size()) {
+      if (vis[in]) {
+        out[o++] = vis[in++];
+        continue;
+      }
+
+      if (in + 1 >= vis.size())
+        break;
+      int run = vis[in + 1];
+      in += 2;
+      o = std::min(rowBytes, o + run);
+    }
+  }
+
+  const BspVisibility::LeafCache &BspVisibility::cached(int leaf) const {
+    if (leaf < 0 || leaf >= (int)m_cache.size())
+      leaf = 0;
+
+    LeafCache &c = m_cache[leaf];
+    if (c.ready)
+      return c;
+
+    if (m_cacheOrder.size() >= MAX_CACHED_LEAVES) {
+      m_cache[m_cacheOrder.front()] = LeafCache();
+      m_cacheOrder.pop_front();
+    }
+    m_cacheOrder.push_back(leaf);
+
+    decompress(leaf, c.pvs);
+
+    vector<bool> seen(m_ctx->faces.size(), false);
+    for (int l = 1; l <= m_numLeaves; l++) {
+      if (!(c.pvs[(l - 1) >> 3] & (1 << ((l - 1) & 7))))
+        continue;
+      c.leaves.push_back(l);
+
+      const fLeaf_t &lf = m_ctx->leafs[l];
+      size_t last = std::min((size_t)lf.lface_id + lf.lface_num, m_ctx->markSurfaces.size());
+      for (size_t m = lf.lface_id; m < last; m++) {
+        uint32_t face = m_ctx->markSurfaces[m];
+        if (face < seen.size() && !seen[face]) {
+          seen[face] = true;
+          c.surfaces.push_back((int)face);
+        }
+      }
+    }
+    std::sort(c.surfaces.begin(), c.surfaces.end());
+
+    c.ready = true;
+    return c;
+  }
+
+  const vector<uint8_t> &BspVisibility::LeafPVS(int leaf) const { return cached(leaf).pvs; }
+
+  bool BspVisibility::LeafSees(int fromLeaf, int toLeaf) const {
+    if (toLeaf < 1 || toLeaf > m_numLeaves)
+      return false;
+    const auto &pvs = cached(fromLeaf).pvs;
+    return pvs[(toLeaf - 1) >> 3] & (1 << ((toLeaf - 1) & 7));
+  }
+
+  const vector<int> &BspVisibility::VisibleLeaves(int leaf) const { return cached(leaf).leaves; }
+
+  const vector<int> &BspVisibility::VisibleSurfaces(int leaf) const { return cached(leaf).surfaces; }
+} // namespace quakelib::bsp
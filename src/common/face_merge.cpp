@@ -0,0 +1,294 @@
+#include <cmath>
+#include <cstring>
+#include <quakelib/face_merge.h>
+#include <unordered_map>
+
+namespace quakelib {
+  static constexpr float POS_QUANT = 64.0f; // positions closer than 1/64 unit are the same corner
+  static constexpr float NORMAL_EPSILON = 1e-4f;
+  static constexpr float DIST_EPSILON = 0.01f;
+  static constexpr float ATTR_EPSILON = 1e-3f;
+  static constexpr float COLINEAR_EPSILON = 1e-3f;
+
+  struct PosKey {
+    int32_t x, y, z;
+
+    bool operator==(const PosKey &o) const { return x == o.x && y == o.y && z == o.z; }
+  };
+
+  struct PosKeyHash {
+    size_t operator()(const PosKey &k) const {
+      return ((size_t)(uint32_t)k.x * 73856093u) ^ ((size_t)(uint32_t)k.y * 19349663u) ^
+             ((size_t)(uint32_t)k.z * 83492791u);
+    }
+  };
+
+  struct EdgeKey {
+    PosKey from, to;
+
+    bool operator==(const EdgeKey &o) const { return from == o.from && to == o.to; }
+  };
+
+  struct EdgeKeyHash {
+    size_t operator()(const EdgeKey &k) const {
+      PosKeyHash h;
+      return h(k.from) * 31 + h(k.to);
+    }
+  };
+
+  struct PolygonPlane {
+    Vec3 normal;
+    float dist;
+    bool alive;
+  };
+
+  static PosKey posKey(const Vec3 &p) {
+    return {(int32_t)std::lround(p[0] * POS_QUANT), (int32_t)std::lround(p[1] * POS_QUANT),
+            (int32_t)std::lround(p[2] * POS_QUANT)};
+  }
+
+  // Newell's method, follows the winding of the polygon
+  static Vec3 polygonNormal(const std::vector<Vertex> &verts) {
+    Vec3 n = {0, 0, 0};
+    for (size_t i = 0; i < verts.size(); i++) {
+      const Vec3 &a = verts[i].point;
+      const Vec3 &b = verts[(i + 1) % verts.size()].point;
+      n[0] += (a[1] - b[1]) * (a[2] + b[2]);
+      n[1] += (a[2] - b[2]) * (a[0] + b[0]);
+      n[2] += (a[0] - b[0]) * (a[1] + b[1]);
+    }
+    float len = math::Len(n);
+    return len > 0 ? n / len : n;
+  }
+
+  static bool nearlyEqual(const Vec2 &a, const Vec2 &b) {
+    return std::fabs(a[0] - b[0]) < ATTR_EPSILON && std::fabs(a[1] - b[1]) < ATTR_EPSILON;
+  }
+
+  // Texture and lightmap coordinates are affine over a face, b is compatible with a when the
+  // mapping of a predicts every vertex of b
+  static bool sameAttributes(const std::vector<Vertex> &a, const std::vector<Vertex> &b) {
+    if (math::Len(a[0].normal - b[0].normal) > NORMAL_EPSILON * 10)
+      return false;
+
+    // the corner with the largest area gives the best conditioned basis
+    size_t best = 1;
+    float bestArea = 0;
+    for (size_t i = 1; i + 1 < a.size(); i++) {
+      float area = math::Len(math::Cross(a[i].point - a[0].point, a[i + 1].point - a[0].point));
+      if (area > bestArea) {
+        bestArea = area;
+        best = i;
+      }
+    }
+    if (bestArea <= 0)
+      return false;
+
+    const Vertex &v0 = a[0], &v1 = a[best], &v2 = a[best + 1];
+    Vec3 e1 = v1.point - v0.point;
+    Vec3 e2 = v2.point - v0.point;
+    float d11 = math::Dot(e1, e1), d12 = math::Dot(e1, e2), d22 = math::Dot(e2, e2);
+    float det = d11 * d22 - d12 * d12;
+
+    for (const auto &v : b) {
+      Vec3 d = v.point - v0.point;
+      float d1 = math::Dot(d, e1), d2 = math::Dot(d, e2);
+      float s = (d22 * d1 - d12 * d2) / det;
+      float t = (d11 * d2 - d12 * d1) / det;
+
+      Vec2 uv = v0.uv + (v1.uv - v0.uv) * s + (v2.uv - v0.uv) * t;
+      Vec2 lm =
+          v0.lightmap_uv + (v1.lightmap_uv - v0.lightmap_uv) * s + (v2.lightmap_uv - v0.lightmap_uv) * t;
+      if (!nearlyEqual(uv, v.uv) || !nearlyEqual(lm, v.lightmap_uv))
+        return false;
+    }
+    return true;
+  }
+
+  static bool isConvex(const std::vector<Vertex> &verts, const Vec3 &normal) {
+    size_t n = verts.size();
+    for (size_t i = 0; i < n; i++) {
+      const Vec3 &prev = verts[(i + n - 1) % n].point;
+      const Vec3 &cur = verts[i].point;
+      const Vec3 &next = verts[(i + 1) % n].point;
+      Vec3 e1 = cur - prev;
+      Vec3 e2 = next - cur;
+      float turn = math::Dot(math::Cross(e1, e2), normal);
+      if (turn < -COLINEAR_EPSILON * math::Len(e1) * math::Len(e2))
+        return false;
+    }
+    return true;
+  }
+
+  static bool isColinear(const Vec3 &prev, const Vec3 &cur, const Vec3 &next) {
+    Vec3 e1 = cur - prev;
+    Vec3 e2 = next - cur;
+    return math::Len(math::Cross(e1, e2)) <= COLINEAR_EPSILON * math::Len(e1) * math::Len(e2) &&
+           math::Dot(e1, e2) > 0;
+  }
+
+  int MergeCoplanarPolygons(std::vector<MergePolygon> &polygons) {
+    std::vector<PolygonPlane> planes(polygons.size());
+    std::unordered_map<PosKey, int, PosKeyHash> useCount;
+    for (size_t i = 0; i < polygons.size(); i++) {
+      auto &verts = polygons[i].vertices;
+      planes[i].alive = verts.size() >= 3;
+      if (!planes[i].alive)
+        continue;
+      planes[i].normal = polygonNormal(verts);
+      planes[i].dist = math::Dot(planes[i].normal, verts[0].point);
+      for (const auto &v : verts)
+        useCount[posKey(v.point)]++;
+    }
+
+    int merges = 0;
+    std::unordered_map<EdgeKey, std::vector<std::pair<int, int>>, EdgeKeyHash> edges;
+    std::vector<char> touched(polygons.size());
+    for (bool changed = true; changed;) {
+      changed = false;
+      edges.clear();
+      std::fill(touched.begin(), touched.end(), 0);
+
+      for (size_t p = 0; p < polygons.size(); p++) {
+        if (!planes[p].alive)
+          continue;
+        const auto &verts = polygons[p].vertices;
+        for (size_t i = 0; i < verts.size(); i++) {
+          EdgeKey key = {posKey(verts[i].point), posKey(verts[(i + 1) % verts.size()].point)};
+          edges[key].push_back({(int)p, (int)i});
+        }
+      }
+
+      for (size_t a = 0; a < polygons.size(); a++) {
+        if (!planes[a].alive || touched[a])
+          continue;
+
+        auto &av = polygons[a].vertices;
+        for (size_t i = 0; i < av.size() && !touched[a]; i++) {
+          size_t n = av.size();
+          EdgeKey reverse = {posKey(av[(i + 1) % n].point), posKey(av[i].point)};
+          auto found = edges.find(reverse);
+          if (found == edges.end())
+            continue;
+
+          for (auto [b, j] : found->second) {
+            if (b == (int)a || !planes[b].alive || touched[b] || polygons[b].group != polygons[a].group)
+              continue;
+            if (math::Dot(planes[a].normal, planes[b].normal) < 1.0f - NORMAL_EPSILON ||
+                std::fabs(planes[a].dist - planes[b].dist) > DIST_EPSILON)
+              continue;
+
+            const auto &bv = polygons[b].vertices;
+            if (!sameAttributes(av, bv))
+              continue;
+
+            // a from the end of the shared edge all the way round, then b without the shared edge
+            size_t m = bv.size();
+            std::vector<Vertex> merged;
+            merged.reserve(n + m - 2);
+            for (size_t k = 1; k <= n; k++)
+              merged.push_back(av[(i + k) % n]);
+            for (size_t k = 2; k < m; k++)
+              merged.push_back(bv[(j + k) % m]);
+
+            if (!isConvex(merged, planes[a].normal))
+              continue;
+
+            // the shared corners were counted once for each polygon
+            useCount[posKey(av[i].point)]--;
+            useCount[posKey(av[(i + 1) % n].point)]--;
+
+            // drop corners on a straight edge that no other polygon relies on
+            for (size_t k = 0; k < merged.size() && merged.size() > 3;) {
+              size_t count = merged.size();
+              const Vec3 &prev = merged[(k + count - 1) % count].point;
+              const Vec3 &next = merged[(k + 1) % count].point;
+              PosKey key = posKey(merged[k].point);
+              if (useCount[key] == 1 && isColinear(prev, merged[k].point, next)) {
+                useCount[key]--;
+                merged.erase(merged.begin() + k);
+                k = 0;
+              } else {
+                k++;
+              }
+            }
+
+            av = std::move(merged);
+            planes[b].alive = false;
+            touched[a] = touched[b] = 1;
+            changed = true;
+            merges++;
+            break;
+          }
+        }
+      }
+    }
+
+    size_t out = 0;
+    for (size_t p = 0; p < polygons.size(); p++) {
+      if (!planes[p].alive)
+        continue;
+      if (out != p)
+        polygons[out] = std::move(polygons[p]);
+      out++;
+    }
+    polygons.resize(out);
+    return merges;
+  }
+
+  // Bit pattern of every attribute of a vertex, padding excluded
+  struct VertexKey {
+    uint32_t bits[14];
+
+    explicit VertexKey(const Vertex &v) {
+      memcpy(bits, v.point.Elements, sizeof(v.point.Elements));
+      memcpy(bits + 3, v.normal.Elements, sizeof(v.normal.Elements));
+      memcpy(bits + 6, v.uv.Elements, sizeof(v.uv.Elements));
+      memcpy(bits + 8, v.lightmap_uv.Elements, sizeof(v.lightmap_uv.Elements));
+      memcpy(bits + 10, v.tangent.Elements, sizeof(v.tangent.Elements));
+    }
+
+    bool operator==(const VertexKey &o) const { return memcmp(bits, o.bits, sizeof(bits)) == 0; }
+  };
+
+  struct VertexKeyHash {
+    size_t operator()(const VertexKey &k) const {
+      size_t h = 0xCBF29CE484222325ull;
+      for (uint32_t b : k.bits)
+        h = (h ^ b) * 0x100000001B3ull;
+      return h;
+    }
+  };
+
+  void AppendPolygons(RenderMesh &mesh, const std::vector<MergePolygon> &polygons) {
+    std::unordered_map<VertexKey, uint32_t, VertexKeyHash> shared;
+    std::vector<Vertex> &verts = mesh.vertices;
+
+    size_t total = verts.size();
+    for (const auto &poly : polygons)
+      total += poly.vertices.size();
+    verts.reserve(total);
+    for (size_t i = 0; i < verts.size(); i++)
+      shared.try_emplace(VertexKey(verts[i]), (uint32_t)i);
+
+    std::vector<uint32_t> remap;
+    for (const auto &poly : polygons) {
+      if (poly.vertices.size() < 3)
+        continue;
+
+      remap.clear();
+      for (const auto &v : poly.vertices) {
+        auto [it, added] = shared.try_emplace(VertexKey(v), (uint32_t)verts.size());
+        if (added)
+          verts.push_back(v);
+        remap.push_back(it->second);
+      }
+
+      for (size_t i = 1; i + 1 < remap.size(); i++) {
+        mesh.indices.push_back(remap[0]);
+        mesh.indices.push_back(remap[i]);
+        mesh.indices.push_back(remap[i + 1]);
+      }
+    }
+  }
+} // namespace quakelib
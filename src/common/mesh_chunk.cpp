@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <map>
+#include <quakelib/mesh_chunk.h>
+#include <tuple>
+
+namespace quakelib {
+  struct ChunkTriangle {
+    uint32_t mesh;
+    uint32_t triangle;
+    Vec3 centroid;
+  };
+
+  static std::vector<ChunkTriangle> gatherTriangles(const std::vector<RenderMesh> &meshes) {
+    std::vector<ChunkTriangle> tris;
+    for (size_t m = 0; m < meshes.size(); m++) {
+      const auto &mesh = meshes[m];
+      for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+        Vec3 c = (mesh.vertices[mesh.indices[t]].point + mesh.vertices[mesh.indices[t + 1]].point +
+                  mesh.vertices[mesh.indices[t + 2]].point) /
+                 3.0f;
+        tris.push_back({(uint32_t)m, (uint32_t)(t / 3), c});
+      }
+    }
+    return tris;
+  }
+
+  // Copies the triangles into per-texture meshes, keeping their order within each mesh.
+  // remap is sized to the largest input mesh and left all UINT32_MAX again.
+  static MeshChunk buildChunk(const std::vector<RenderMesh> &meshes, std::vector<ChunkTriangle> &tris,
+                              std::vector<uint32_t> &remap) {
+    std::sort(tris.begin(), tris.end(), [](const ChunkTriangle &a, const ChunkTriangle &b) {
+      return a.mesh != b.mesh ? a.mesh < b.mesh : a.triangle < b.triangle;
+    });
+
+    MeshChunk chunk;
+    chunk.mins = {FLT_MAX, FLT_MAX, FLT_MAX};
+    chunk.maxs = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (size_t i = 0; i < tris.size();) {
+      const RenderMesh &src = meshes[tris[i].mesh];
+      RenderMesh out;
+      out.textureName = src.textureName;
+      out.textureWidth = src.textureWidth;
+      out.textureHeight = src.textureHeight;
+      out.type = src.type;
+
+      size_t first = i;
+      for (; i < tris.size() && tris[i].mesh == tris[first].mesh; i++) {
+        for (int k = 0; k < 3; k++) {
+          uint32_t v = src.indices[tris[i].triangle * 3 + k];
+          if (remap[v] == UINT32_MAX) {
+            remap[v] = (uint32_t)out.vertices.size();
+            out.vertices.push_back(src.vertices[v]);
+            for (int a = 0; a < 3; a++) {
+              chunk.mins[a] = std::min(chunk.mins[a], src.vertices[v].point[a]);
+              chunk.maxs[a] = std::max(chunk.maxs[a], src.vertices[v].point[a]);
+            }
+          }
+          out.indices.push_back(remap[v]);
+        }
+      }
+
+      for (size_t j = first; j < i; j++) {
+        for (int k = 0; k < 3; k++)
+          remap[src.indices[tris[j].triangle * 3 + k]] = UINT32_MAX;
+      }
+      chunk.meshes.push_back(std::move(out));
+    }
+    return chunk;
+  }
+
+  static std::vector<uint32_t> makeRemap(const std::vector<RenderMesh> &meshes) {
+    size_t largest = 0;
+    for (const auto &mesh : meshes)
+      largest = std::max(largest, mesh.vertices.size());
+    return std::vector<uint32_t>(largest, UINT32_MAX);
+  }
+
+  std::vector<MeshChunk> ChunkMeshesGrid(const std::vector<RenderMesh> &meshes, float cellSize) {
+    std::vector<MeshChunk> chunks;
+    auto tris = gatherTriangles(meshes);
+    if (tris.empty())
+      return chunks;
+
+    std::map<std::tuple<int, int, int>, std::vector<ChunkTriangle>> cells;
+    for (const auto &t : tris) {
+      if (cellSize <= 0) {
+        cells[{0, 0, 0}].push_back(t);
+        continue;
+      }
+      auto cell = std::make_tuple((int)std::floor(t.centroid[0] / cellSize),
+                                  (int)std::floor(t.centroid[1] / cellSize),
+                                  (int)std::floor(t.centroid[2] / cellSize));
+      cells[cell].push_back(t);
+    }
+
+    auto remap = makeRemap(meshes);
+    chunks.reserve(cells.size());
+    for (auto &[cell, cellTris] : cells)
+      chunks.push_back(buildChunk(meshes, cellTris, remap));
+    return chunks;
+  }
+
+  using ChunkTriangleIt = std::vector<ChunkTriangle>::iterator;
+
+  static void splitKdTree(ChunkTriangleIt begin, ChunkTriangleIt end, size_t triangleBudget,
+                          std::vector<std::vector<ChunkTriangle>> &leaves) {
+    size_t count = end - begin;
+    if (count <= triangleBudget) {
+      leaves.emplace_back(begin, end);
+      return;
+    }
+
+    Vec3 mins = {FLT_MAX, FLT_MAX, FLT_MAX};
+    Vec3 maxs = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (auto it = begin; it != end; ++it) {
+      for (int a = 0; a < 3; a++) {
+        mins[a] = std::min(mins[a], it->centroid[a]);
+        maxs[a] = std::max(maxs[a], it->centroid[a]);
+      }
+    }
+    int axis = 0;
+    for (int a = 1; a < 3; a++) {
+      if (maxs[a] - mins[a] > maxs[axis] - mins[axis])
+        axis = a;
+    }
+
+    auto mid = begin + count / 2;
+    std::nth_element(begin, mid, end, [axis](const ChunkTriangle &a, const ChunkTriangle &b) {
+      return a.centroid[axis] < b.centroid[axis];
+    });
+    splitKdTree(begin, mid, triangleBudget, leaves);
+    splitKdTree(mid, end, triangleBudget, leaves);
+  }
+
+  std::vector<MeshChunk> ChunkMeshesKdTree(const std::vector<RenderMesh> &meshes, size_t triangleBudget) {
+    std::vector<MeshChunk> chunks;
+    auto tris = gatherTriangles(meshes);
+    if (tris.empty())
+      return chunks;
+
+    std::vector<std::vector<ChunkTriangle>> leaves;
+    splitKdTree(tris.begin(), tris.end(), std::max<size_t>(triangleBudget, 1), leaves);
+
+    auto remap = makeRemap(meshes);
+    chunks.reserve(leaves.size());
+    for (auto &leaf : leaves)
+      chunks.push_back(buildChunk(meshes, leaf, remap));
+    return chunks;
+  }
+} // namespace quakelib
@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <quakelib/mesh_optimize.h>
+
+namespace quakelib {
+  // Forsyth's scoring, see "Linear-Speed Vertex Cache Optimisation"
+  static constexpr int SCORE_CACHE_SIZE = 32;
+  static constexpr int SCORE_MAX_VALENCE = 32;
+  static constexpr float CACHE_DECAY_POWER = 1.5f;
+  static constexpr float LAST_TRI_SCORE = 0.75f;
+  static constexpr float VALENCE_BOOST_SCALE = 2.0f;
+  static constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+  struct VertexScoreTable {
+    float cache[SCORE_CACHE_SIZE + 1]; // indexed by cache position + 1, 0 is not cached
+    float valence[SCORE_MAX_VALENCE + 1];
+
+    VertexScoreTable() {
+      cache[0] = 0;
+      for (int i = 0; i < SCORE_CACHE_SIZE; i++) {
+        // the last triangle's vertices get a fixed score so its neighbours are not favoured over fans
+        if (i < 3)
+          cache[i + 1] = LAST_TRI_SCORE;
+        else
+          cache[i + 1] = std::pow(1.0f - (i - 3) / (float)(SCORE_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+      }
+      valence[0] = 0;
+      for (int i = 1; i <= SCORE_MAX_VALENCE; i++)
+        valence[i] = VALENCE_BOOST_SCALE * std::pow((float)i, -VALENCE_BOOST_POWER);
+    }
+
+    float Score(int cachePos, uint32_t remaining) const {
+      if (remaining == 0)
+        return -1.0f;
+      return cache[cachePos + 1] + valence[std::min<uint32_t>(remaining, SCORE_MAX_VALENCE)];
+    }
+  };
+
+  float ComputeACMR(const std::vector<uint32_t> &indices, size_t vertexCount, int cacheSize) {
+    if (indices.size() < 3)
+      return 0;
+
+    // a vertex is cached while fewer than cacheSize misses happened since it was loaded
+    std::vector<uint32_t> loaded(vertexCount, 0);
+    uint32_t time = cacheSize + 1;
+    size_t misses = 0;
+    for (auto idx : indices) {
+      if (time - loaded[idx] > (uint32_t)cacheSize) {
+        loaded[idx] = time++;
+        misses++;
+      }
+    }
+    return (float)misses / (indices.size() / 3);
+  }
+
+  void OptimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount) {
+    static const VertexScoreTable table;
+    size_t triCount = indices.size() / 3;
+    if (triCount < 2)
+      return;
+
+    // triangles using each vertex, the lists shrink as triangles are emitted
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    for (size_t i = 0; i < triCount * 3; i++)
+      remaining[indices[i]]++;
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+      offsets[v + 1] = offsets[v] + remaining[v];
+    std::vector<uint32_t> adjacency(offsets[vertexCount]);
+    {
+      std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+      for (size_t i = 0; i < triCount * 3; i++)
+        adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+    }
+
+    std::vector<int> cachePos(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+      vertexScore[v] = table.Score(-1, remaining[v]);
+
+    std::vector<float> triScore(triCount);
+    for (size_t t = 0; t < triCount; t++) {
+      const uint32_t *tri = &indices[t * 3];
+      triScore[t] = vertexScore[tri[0]] + vertexScore[tri[1]] + vertexScore[tri[2]];
+    }
+
+    std::vector<char> emitted(triCount, 0);
+    std::vector<uint32_t> out;
+    out.reserve(triCount * 3);
+
+    uint32_t cache[SCORE_CACHE_SIZE + 3];
+    uint32_t nextCache[SCORE_CACHE_SIZE + 3];
+    int cacheCount = 0;
+    size_t cursor = 0;
+    int64_t best = -1;
+
+    while (out.size() < triCount * 3) {
+      // dead end, continue with the next triangle in input order
+      if (best < 0) {
+        while (emitted[cursor])
+          cursor++;
+        best = cursor;
+      }
+
+      const uint32_t *tri = &indices[best * 3];
+      emitted[best] = 1;
+      out.insert(out.end(), tri, tri + 3);
+
+      for (int k = 0; k < 3; k++) {
+        uint32_t v = tri[k];
+        uint32_t *list = &adjacency[offsets[v]];
+        uint32_t *last = list + remaining[v];
+        auto it = std::find(list, last, (uint32_t)best);
+        if (it != last) {
+          *it = *(last - 1);
+          remaining[v]--;
+        }
+      }
+
+      // the triangle's vertices move to the front, the others shift back
+      int nextCount = 0;
+      for (int k = 0; k < 3; k++) {
+        if (std::find(nextCache, nextCache + nextCount, tri[k]) == nextCache + nextCount)
+          nextCache[nextCount++] = tri[k];
+      }
+      for (int i = 0; i < cacheCount; i++) {
+        if (std::find(tri, tri + 3, cache[i]) == tri + 3)
+          nextCache[nextCount++] = cache[i];
+      }
+
+      for (int i = 0; i < nextCount; i++) {
+        uint32_t v = nextCache[i];
+        cachePos[v] = i < SCORE_CACHE_SIZE ? i : -1;
+        float score = table.Score(cachePos[v], remaining[v]);
+        float delta = score - vertexScore[v];
+        vertexScore[v] = score;
+        for (uint32_t a = offsets[v]; a < offsets[v] + remaining[v]; a++)
+          triScore[adjacency[a]] += delta;
+      }
+
+      cacheCount = std::min(nextCount, SCORE_CACHE_SIZE);
+      std::copy(nextCache, nextCache + cacheCount, cache);
+
+      best = -1;
+      float bestScore = -1.0f;
+      for (int i = 0; i < cacheCount; i++) {
+        uint32_t v = cache[i];
+        for (uint32_t a = offsets[v]; a < offsets[v] + remaining[v]; a++) {
+          uint32_t t = adjacency[a];
+          if (triScore[t] > bestScore) {
+            bestScore = triScore[t];
+            best = t;
+          }
+        }
+      }
+    }
+
+    std::copy(out.begin(), out.end(), indices.begin());
+  }
+
+  void OptimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices,
+                        float threshold) {
+    constexpr int CACHE_SIZE = 16;
+    size_t triCount = indices.size() / 3;
+    if (triCount < 2)
+      return;
+
+    // a cluster starts wherever all three vertices of a triangle miss the cache
+    std::vector<size_t> clusters;
+    std::vector<uint32_t> loaded(vertices.size(), 0);
+    uint32_t time = CACHE_SIZE + 1;
+    for (size_t t = 0; t < triCount; t++) {
+      int misses = 0;
+      for (int k = 0; k < 3; k++) {
+        uint32_t v = indices[t * 3 + k];
+        if (time - loaded[v] > (uint32_t)CACHE_SIZE) {
+          loaded[v] = time++;
+          misses++;
+        }
+      }
+      if (t == 0 || misses == 3)
+        clusters.push_back(t);
+    }
+    if (clusters.size() < 2)
+      return;
+    clusters.push_back(triCount);
+
+    // area weighted centroid and normal of every cluster and of the whole mesh
+    size_t clusterCount = clusters.size() - 1;
+    std::vector<Vec3> centroid(clusterCount, Vec3{0, 0, 0});
+    std::vector<Vec3> normal(clusterCount, Vec3{0, 0, 0});
+    std::vector<float> area(clusterCount, 0);
+    Vec3 meshCentroid = {0, 0, 0};
+    float meshArea = 0;
+    for (size_t c = 0; c < clusterCount; c++) {
+      for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+        const Vec3 &a = vertices[indices[t * 3]].point;
+        const Vec3 &b = vertices[indices[t * 3 + 1]].point;
+        const Vec3 &d = vertices[indices[t * 3 + 2]].point;
+        Vec3 n = math::Cross(b - a, d - a);
+        float w = math::Len(n) * 0.5f;
+        centroid[c] = centroid[c] + (a + b + d) * (w / 3.0f);
+        normal[c] = normal[c] + n;
+        area[c] += w;
+      }
+      meshCentroid = meshCentroid + centroid[c];
+      meshArea += area[c];
+      if (area[c] > 0)
+        centroid[c] = centroid[c] / area[c];
+    }
+    if (meshArea > 0)
+      meshCentroid = meshCentroid / meshArea;
+
+    // clusters facing away from the centre are the likely occluders and go first
+    std::vector<float> key(clusterCount, 0);
+    for (size_t c = 0; c < clusterCount; c++) {
+      float len = math::Len(normal[c]);
+      if (len > 0)
+        key[c] = math::Dot(centroid[c] - meshCentroid, normal[c] / len);
+    }
+    std::vector<size_t> order(clusterCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return key[a] > key[b]; });
+
+    std::vector<uint32_t> sorted;
+    sorted.reserve(indices.size());
+    for (size_t c : order)
+      sorted.insert(sorted.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+
+    if (ComputeACMR(sorted, vertices.size()) <= ComputeACMR(indices, vertices.size()) * threshold)
+      indices = std::move(sorted);
+  }
+
+  void OptimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices) {
+    std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+    std::vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for (auto &idx : indices) {
+      if (remap[idx] == UINT32_MAX) {
+        remap[idx] = (uint32_t)ordered.size();
+        ordered.push_back(vertices[idx]);
+      }
+      idx = remap[idx];
+    }
+    vertices = std::move(ordered);
+  }
+
+  MeshOptimizeStats OptimizeMesh(RenderMesh &mesh, bool overdraw) {
+    MeshOptimizeStats stats;
+    stats.acmrBefore = ComputeACMR(mesh.indices, mesh.vertices.size());
+
+    OptimizeVertexCache(mesh.indices, mesh.vertices.size());
+    if (overdraw)
+      OptimizeOverdraw(mesh.indices, mesh.vertices);
+    OptimizeVertexFetch(mesh.vertices, mesh.indices);
+
+    stats.acmrAfter = ComputeACMR(mesh.indices, mesh.vertices.size());
+    return stats;
+  }
+} // namespace quakelib
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <cmath>
+#include <quakelib/meshlet.h>
+
+namespace quakelib {
+  static constexpr float CONE_MIN_SPREAD = 0.1f; // below this the normals span more than ~84 degrees
+
+  // Ritter's approximate bounding sphere
+  static void computeSphere(const std::vector<Vec3> &points, Vec3 &center, float &radius) {
+    auto farthest = [&](const Vec3 &from) {
+      size_t best = 0;
+      float bestDist = -1;
+      for (size_t i = 0; i < points.size(); i++) {
+        float d = math::Dot(points[i] - from, points[i] - from);
+        if (d > bestDist) {
+          bestDist = d;
+          best = i;
+        }
+      }
+      return points[best];
+    };
+
+    Vec3 a = farthest(points[0]);
+    Vec3 b = farthest(a);
+    center = (a + b) * 0.5f;
+    radius = math::Len(b - a) * 0.5f;
+
+    for (const auto &p : points) {
+      float d = math::Len(p - center);
+      if (d > radius) {
+        float grown = (radius + d) * 0.5f;
+        center = center + (p - center) * ((grown - radius) / d);
+        radius = grown;
+      }
+    }
+  }
+
+  static void computeBounds(const RenderMesh &mesh, const MeshletData &data, Meshlet &m) {
+    std::vector<Vec3> points;
+    points.reserve(m.vertexCount);
+    for (uint32_t i = 0; i < m.vertexCount; i++)
+      points.push_back(mesh.vertices[data.vertices[m.vertexOffset + i]].point);
+    computeSphere(points, m.center, m.radius);
+
+    std::vector<Vec3> normals;
+    std::vector<Vec3> corners;
+    Vec3 axis = {0, 0, 0};
+    for (uint32_t t = 0; t < m.triangleCount; t++) {
+      const uint8_t *tri = &data.triangles[(m.triangleOffset + t) * 3];
+      const Vec3 &p0 = points[tri[0]];
+      Vec3 n = math::Cross(points[tri[1]] - p0, points[tri[2]] - p0);
+      float len = math::Len(n);
+      if (len <= 0)
+        continue;
+      n = n / len;
+      normals.push_back(n);
+      corners.push_back(p0);
+      axis = axis + n;
+    }
+
+    m.coneApex = m.center;
+    m.coneAxis = {0, 0, 0};
+    m.coneCutoff = 1;
+    float axisLen = math::Len(axis);
+    if (normals.empty() || axisLen <= 0)
+      return;
+    axis = axis / axisLen;
+
+    float minDot = 1;
+    for (const auto &n : normals)
+      minDot = std::min(minDot, math::Dot(axis, n));
+    if (minDot <= CONE_MIN_SPREAD)
+      return;
+
+    // move the apex back until every triangle plane is in front of it
+    float maxT = 0;
+    for (size_t i = 0; i < normals.size(); i++) {
+      float dc = math::Dot(m.center - corners[i], normals[i]);
+      float dn = math::Dot(axis, normals[i]);
+      maxT = std::max(maxT, dc / dn);
+    }
+
+    m.coneApex = m.center - axis * maxT;
+    m.coneAxis = axis;
+    m.coneCutoff = std::sqrt(1 - minDot * minDot);
+  }
+
+  MeshletData BuildMeshlets(const RenderMesh &mesh, size_t maxVertices, size_t maxTriangles) {
+    MeshletData data;
+    maxVertices = std::clamp<size_t>(maxVertices, 3, 256);
+    maxTriangles = std::max<size_t>(maxTriangles, 1);
+
+    size_t vertexCount = mesh.vertices.size();
+    size_t triCount = mesh.indices.size() / 3;
+    if (triCount == 0)
+      return data;
+
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < triCount * 3; i++)
+      offsets[mesh.indices[i] + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+      offsets[v + 1] += offsets[v];
+    std::vector<uint32_t> adjacency(offsets[vertexCount]);
+    {
+      std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+      for (size_t i = 0; i < triCount * 3; i++)
+        adjacency[fill[mesh.indices[i]]++] = (uint32_t)(i / 3);
+    }
+
+    std::vector<char> emitted(triCount, 0);
+    std::vector<int> local(vertexCount, -1);
+    Meshlet current;
+    Vec3 sum = {0, 0, 0};
+    size_t cursor = 0;
+
+    auto newVertices = [&](uint32_t t) {
+      int count = 0;
+      for (int k = 0; k < 3; k++)
+        count += local[mesh.indices[t * 3 + k]] < 0;
+      return count;
+    };
+
+    auto addTriangle = [&](uint32_t t) {
+      for (int k = 0; k < 3; k++) {
+        uint32_t v = mesh.indices[t * 3 + k];
+        if (local[v] < 0) {
+          local[v] = (int)current.vertexCount++;
+          data.vertices.push_back(v);
+          sum = sum + mesh.vertices[v].point;
+        }
+        data.triangles.push_back((uint8_t)local[v]);
+      }
+      current.triangleCount++;
+      emitted[t] = 1;
+    };
+
+    while (true) {
+      while (cursor < triCount && emitted[cursor])
+        cursor++;
+      if (cursor == triCount)
+        break;
+
+      current = Meshlet();
+      current.vertexOffset = (uint32_t)data.vertices.size();
+      current.triangleOffset = (uint32_t)(data.triangles.size() / 3);
+      sum = {0, 0, 0};
+      addTriangle((uint32_t)cursor);
+
+      // grow through shared vertices, fewest new vertices first, then closest to the centre
+      while (current.triangleCount < maxTriangles) {
+        int64_t best = -1;
+        int bestNew = 4;
+        float bestDist = 0;
+        Vec3 centroid = sum / (float)current.vertexCount;
+        for (uint32_t i = 0; i < current.vertexCount; i++) {
+          uint32_t v = data.vertices[current.vertexOffset + i];
+          for (uint32_t a = offsets[v]; a < offsets[v + 1]; a++) {
+            uint32_t t = adjacency[a];
+            if (emitted[t])
+              continue;
+            int added = newVertices(t);
+            if (current.vertexCount + added > maxVertices || added > bestNew)
+              continue;
+            const Vec3 &p = mesh.vertices[mesh.indices[t * 3]].point;
+            float dist = math::Dot(p - centroid, p - centroid);
+            if (added < bestNew || dist < bestDist) {
+              best = t;
+              bestNew = added;
+              bestDist = dist;
+            }
+          }
+        }
+        // nothing connected is left, continue with the next triangle in input order
+        if (best < 0) {
+          while (cursor < triCount && emitted[cursor])
+            cursor++;
+          if (cursor == triCount || current.vertexCount + newVertices((uint32_t)cursor) > maxVertices)
+            break;
+          best = (int64_t)cursor;
+        }
+        addTriangle((uint32_t)best);
+      }
+
+      for (uint32_t i = 0; i < current.vertexCount; i++)
+        local[data.vertices[current.vertexOffset + i]] = -1;
+      computeBounds(mesh, data, current);
+      data.meshlets.push_back(current);
+    }
+
+    return data;
+  }
+
+  bool IsMeshletBackfacing(const Meshlet &meshlet, const Vec3 &cameraPos) {
+    Vec3 view = meshlet.coneApex - cameraPos;
+    float len = math::Len(view);
+    if (len <= 0)
+      return false;
+    return math::Dot(view / len, meshlet.coneAxis) >= meshlet.coneCutoff;
+  }
+} // namespace quakelib
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace quakelib {
+  /**
+   * @brief Runs fn(i) for every i in [0, count) on all hardware threads.
+   *
+   * Work is handed out in small chunks from a shared counter so uneven items
+   * balance out. fn must be safe to call concurrently for distinct indices.
+   */
+  template <typename Fn> void ParallelFor(size_t count, const Fn &fn, size_t chunk = 16) {
+    size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, (count + chunk - 1) / chunk);
+
+    if (threadCount <= 1) {
+      for (size_t i = 0; i < count; i++)
+        fn(i);
+      return;
+    }
+
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+      for (size_t begin = next.fetch_add(chunk); begin < count; begin = next.fetch_add(chunk)) {
+        size_t end = std::min(begin + chunk, count);
+        for (size_t i = begin; i < end; i++)
+          fn(i);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for (size_t t = 1; t < threadCount; t++)
+      threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads)
+      t.join();
+  }
+} // namespace quakelib
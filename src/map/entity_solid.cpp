@@ -44,6 +44,7 @@ namespace quakelib::map {
     swapYz(m_center);
     swapYz(m_min);
     swapYz(m_max);
+    swapYz(m_instanceOffset);
 
     if (m_min[2] > m_max[2]) {
       std::swap(m_min[2], m_max[2]);
@@ -0,0 +1,52 @@
+#include <algorithm>
+#include <cmath>
+#include <quakelib/map/light_grid.h>
+
+namespace quakelib::map {
+
+  Vec3 AmbientCube::Evaluate(const Vec3 &normal) const {
+    Vec3 nSq = normal * normal;
+    return faces[normal[0] >= 0.0f ? 0 : 1] * nSq[0] + faces[normal[1] >= 0.0f ? 2 : 3] * nSq[1] +
+           faces[normal[2] >= 0.0f ? 4 : 5] * nSq[2];
+  }
+
+  LightGrid::LightGrid(const Vec3 &origin, float cellSize, int sizeX, int sizeY, int sizeZ)
+      : m_origin(origin), m_cellSize(cellSize), m_size{sizeX, sizeY, sizeZ} {
+    m_cells.resize(static_cast<size_t>(sizeX) * sizeY * sizeZ, AmbientCube{});
+  }
+
+  Vec3 LightGrid::CellPosition(int x, int y, int z) const {
+    return m_origin + Vec3{static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)} * m_cellSize;
+  }
+
+  AmbientCube LightGrid::Sample(const Vec3 &pos) const {
+    AmbientCube result{};
+    if (m_cells.empty())
+      return result;
+
+    int i0[3], i1[3];
+    float t[3];
+    for (int k = 0; k < 3; k++) {
+      float f = std::clamp((pos[k] - m_origin[k]) / m_cellSize, 0.0f, static_cast<float>(m_size[k] - 1));
+      i0[k] = static_cast<int>(f);
+      i1[k] = std::min(i0[k] + 1, m_size[k] - 1);
+      t[k] = f - i0[k];
+    }
+
+    for (int corner = 0; corner < 8; corner++) {
+      int x = corner & 1 ? i1[0] : i0[0];
+      int y = corner & 2 ? i1[1] : i0[1];
+      int z = corner & 4 ? i1[2] : i0[2];
+      float w = (corner & 1 ? t[0] : 1.0f - t[0]) * (corner & 2 ? t[1] : 1.0f - t[1]) *
+                (corner & 4 ? t[2] : 1.0f - t[2]);
+      if (w <= 0.0f)
+        continue;
+
+      const AmbientCube &cell = Cell(x, y, z);
+      for (int f = 0; f < 6; f++)
+        result.faces[f] += cell.faces[f] * w;
+    }
+    return result;
+  }
+
+} // namespace quakelib::map
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <cmath>
+#include <quakelib/map/lightmap_encoding.h>
+
+namespace quakelib::map {
+
+  static unsigned char toByte(float v) {
+    return static_cast<unsigned char>(std::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+  }
+
+  void EncodeRGBM(const Vec3 &color, float range, unsigned char *out) {
+    Vec3 c = color * (1.0f / range);
+    float m = std::clamp(std::max({c[0], c[1], c[2], 1e-6f}), 0.0f, 1.0f);
+    m = std::ceil(m * 255.0f) / 255.0f;
+
+    out[0] = toByte(c[0] / m);
+    out[1] = toByte(c[1] / m);
+    out[2] = toByte(c[2] / m);
+    out[3] = static_cast<unsigned char>(m * 255.0f + 0.5f);
+  }
+
+  Vec3 DecodeRGBM(const unsigned char *in, float range) {
+    float m = in[3] / 255.0f * range;
+    return Vec3{in[0] / 255.0f, in[1] / 255.0f, in[2] / 255.0f} * m;
+  }
+
+  void EncodeLogLuv(const Vec3 &color, unsigned char *out) {
+    // linear RGB to a scaled XYZ space, after Ward's LogLuv
+    float xp = std::max(color[0] * 0.2209f + color[1] * 0.1138f + color[2] * 0.0102f, 1e-6f);
+    float y = std::max(color[0] * 0.3390f + color[1] * 0.6780f + color[2] * 0.1130f, 1e-6f);
+    float zp = std::max(color[0] * 0.4184f + color[1] * 0.7319f + color[2] * 0.2969f, 1e-6f);
+
+    float le = std::clamp(2.0f * std::log2(y) + 127.0f, 0.0f, 255.0f + 255.0f / 256.0f);
+    int hi = static_cast<int>(le);
+    int lo = std::min(255, static_cast<int>((le - hi) * 256.0f + 0.5f));
+
+    out[0] = toByte(xp / zp);
+    out[1] = toByte(y / zp);
+    out[2] = static_cast<unsigned char>(hi);
+    out[3] = static_cast<unsigned char>(lo);
+  }
+
+  Vec3 DecodeLogLuv(const unsigned char *in) {
+    float le = in[2] + in[3] / 256.0f;
+    float y = std::exp2((le - 127.0f) * 0.5f);
+    float zp = in[1] > 0 ? y / (in[1] / 255.0f) : 0.0f;
+    float xp = in[0] / 255.0f * zp;
+
+    Vec3 rgb = {xp * 6.0014f + y * -1.3320f + zp * 0.3008f, xp * -2.7008f + y * 3.1029f + zp * -1.0882f,
+                xp * -1.7996f + y * -5.7721f + zp * 5.6268f};
+    return {std::max(rgb[0], 0.0f), std::max(rgb[1], 0.0f), std::max(rgb[2], 0.0f)};
+  }
+
+} // namespace quakelib::map
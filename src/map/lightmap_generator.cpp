@@ -1,62 +1,83 @@
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <quakelib/map/lightmap_generator.h>
 #include <quakelib/qmath.h>
+#include <unordered_map>
+
+#include "../common/parallel.h"
 
 namespace quakelib::map {
 
   LightmapGenerator::LightmapGenerator(int width, int height, float luxelSize)
       : m_width(width), m_height(height), m_luxelSize(luxelSize) {}
 
+  // solid faces of an entity that get a lightmap, after CSG if it ran
+  static std::vector<FacePtr> packedFaces(SolidMapEntity &ent) {
+    auto brushes = ent.GetClippedBrushes();
+    if (brushes.empty())
+      brushes = ent.Brushes();
+
+    std::vector<FacePtr> faces;
+    for (const auto &brush : brushes) {
+      for (const auto &face : brush.Faces()) {
+        if (face->Type() == MapSurface::SOLID)
+          faces.push_back(face);
+      }
+    }
+    return faces;
+  }
+
   bool LightmapGenerator::Pack(const std::vector<SolidEntityPtr> &entities) {
-    m_entries.clear();
+    // entries are placed in a local list and only replace m_entries once the whole atlas fits
+    std::vector<LightmapEntry> entries;
+    std::vector<SolidEntityPtr> instances;
 
     for (const auto &ent : entities) {
-      auto brushes = ent->GetClippedBrushes();
-      if (brushes.empty())
-        brushes = ent->Brushes();
-
-      for (const auto &brush : brushes) {
-        for (const auto &face : brush.Faces()) {
-          if (face->Type() != MapSurface::SOLID)
-            continue;
-
-          Vec2 minUV = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
-          Vec2 maxUV = {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+      // instances share the prototype's faces and lightmap, they are only traced as occluders
+      if (ent->Prototype()) {
+        instances.push_back(ent);
+        continue;
+      }
 
-          for (const auto &v : face->Vertices()) {
-            Vec2 uv = face->CalcLightmapUV(v.point);
-            minUV[0] = std::min(minUV[0], uv[0]);
-            minUV[1] = std::min(minUV[1], uv[1]);
-            maxUV[0] = std::max(maxUV[0], uv[0]);
-            maxUV[1] = std::max(maxUV[1], uv[1]);
-          }
+      for (const auto &face : packedFaces(*ent)) {
+        Vec2 minUV = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+        Vec2 maxUV = {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+
+        // the vertices are only written once the whole atlas fits
+        for (const auto &v : face->Vertices()) {
+          Vec2 uv = face->CalcLightmapUV(v.point);
+          minUV[0] = std::min(minUV[0], uv[0]);
+          minUV[1] = std::min(minUV[1], uv[1]);
+          maxUV[0] = std::max(maxUV[0], uv[0]);
+          maxUV[1] = std::max(maxUV[1], uv[1]);
+        }
 
-          int w = static_cast<int>(std::ceil((maxUV[0] - minUV[0]) / m_luxelSize)) + 1;
-          int h = static_cast<int>(std::ceil((maxUV[1] - minUV[1]) / m_luxelSize)) + 1;
+        int w = static_cast<int>(std::ceil((maxUV[0] - minUV[0]) / m_luxelSize)) + 1;
+        int h = static_cast<int>(std::ceil((maxUV[1] - minUV[1]) / m_luxelSize)) + 1;
 
-          w = std::max(1, w);
-          h = std::max(1, h);
+        w = std::max(1, w);
+        h = std::max(1, h);
 
-          LightmapEntry entry;
-          entry.face = face;
-          entry.w = w;
-          entry.h = h;
+        LightmapEntry entry;
+        entry.face = face;
+        entry.w = w;
+        entry.h = h;
+        entry.minUV = minUV;
 
-          m_entries.push_back(entry);
-        }
+        entries.push_back(entry);
       }
     }
 
-    std::sort(m_entries.begin(), m_entries.end(),
+    std::sort(entries.begin(), entries.end(),
               [](const LightmapEntry &a, const LightmapEntry &b) { return a.h > b.h; });
 
     int currentX = 0;
     int currentY = 0;
     int rowHeight = 0;
 
-    for (auto &entry : m_entries) {
+    for (auto &entry : entries) {
       if (currentX + entry.w > m_width) {
 
         currentY += rowHeight;
@@ -66,6 +87,7 @@ namespace quakelib::map {
 
       if (currentY + entry.h > m_height) {
         std::cerr << "Lightmap Atlas full!" << std::endl;
+        reset();
         return false;
       }
 
@@ -77,21 +99,15 @@ namespace quakelib::map {
       currentX += entry.w;
     }
 
-    for (const auto &entry : m_entries) {
-      Vec2 minUV = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
-
-      for (const auto &v : entry.face->Vertices()) {
-        Vec2 uv = entry.face->CalcLightmapUV(v.point);
-        minUV[0] = std::min(minUV[0], uv[0]);
-        minUV[1] = std::min(minUV[1], uv[1]);
-      }
+    m_entries = std::move(entries);
+    m_instances = std::move(instances);
 
+    for (const auto &entry : m_entries) {
       auto &verts = entry.face->VerticesRW();
       for (auto &v : verts) {
-        Vec2 localUV = entry.face->CalcLightmapUV(v.point);
-
-        float u = (localUV[0] - minUV[0]) / m_luxelSize;
-        float v_coord = (localUV[1] - minUV[1]) / m_luxelSize;
+        Vec2 uv = entry.face->CalcLightmapUV(v.point);
+        float u = (uv[0] - entry.minUV[0]) / m_luxelSize;
+        float v_coord = (uv[1] - entry.minUV[1]) / m_luxelSize;
 
         u += entry.x;
         v_coord += entry.y;
@@ -101,11 +117,91 @@ namespace quakelib::map {
       }
     }
 
+    buildLuxels();
+
+    m_lit = false;
     GenerateAtlasImage();
     return true;
   }
 
+  void LightmapGenerator::reset() {
+    // nothing is packed anymore, so no luxel, trace entry or light result may outlive the old entries
+    m_entries.clear();
+    m_instances.clear();
+    buildLuxels();
+    m_tracer = LightmapTracer();
+    m_traceEntry.clear();
+    m_traceOffset.clear();
+    m_lit = false;
+    GenerateAtlasImage();
+  }
+
+  void LightmapGenerator::buildLuxels() {
+    size_t count = 0;
+    for (const auto &entry : m_entries) {
+      count += static_cast<size_t>(entry.w) * entry.h;
+    }
+
+    m_luxels.position.resize(count);
+    m_luxels.normal.resize(count);
+    m_luxels.atlasIndex.resize(count);
+    m_direct.assign(count, Vec3{0, 0, 0});
+    m_indirect.assign(count, Vec3{0, 0, 0});
+    m_bounced = false;
+    m_occlusion.assign(count, 1.0f);
+    m_applyOcclusion = false;
+    m_tracerBuilt = false;
+
+    size_t base = 0;
+    for (auto &entry : m_entries) {
+      entry.luxelBase = base;
+
+      // the lightmap projection is affine, so three solved corners give the whole grid
+      Vec3 N = entry.face->GetPlaneNormal();
+      Vec2 first = {entry.minUV[0] + m_luxelSize * 0.5f, entry.minUV[1] + m_luxelSize * 0.5f};
+      Vec3 corner = entry.face->CalcWorldPosFromLightmapUV(first);
+      Vec3 stepU = entry.face->CalcWorldPosFromLightmapUV({first[0] + m_luxelSize, first[1]}) - corner;
+      Vec3 stepV = entry.face->CalcWorldPosFromLightmapUV({first[0], first[1] + m_luxelSize}) - corner;
+      Vec3 origin = corner + N * 0.5f;
+
+      entry.min = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                   std::numeric_limits<float>::max()};
+      entry.max = {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(),
+                   std::numeric_limits<float>::lowest()};
+
+      for (int y = 0; y < entry.h; ++y) {
+        for (int x = 0; x < entry.w; ++x, ++base) {
+          Vec3 p = origin + stepU * (float)x + stepV * (float)y;
+          m_luxels.position[base] = p;
+          m_luxels.normal[base] = N;
+
+          int atlasX = entry.x + x;
+          int atlasY = entry.y + y;
+          bool inside = atlasX < m_width && atlasY < m_height;
+          m_luxels.atlasIndex[base] = inside ? atlasY * m_width + atlasX : -1;
+
+          for (int i = 0; i < 3; i++) {
+            entry.min[i] = std::min(entry.min[i], p[i]);
+            entry.max[i] = std::max(entry.max[i], p[i]);
+          }
+        }
+      }
+    }
+  }
+
+  static bool sphereTouchesBox(const Vec3 &center, float radius, const Vec3 &min, const Vec3 &max) {
+    float distSq = 0;
+    for (int i = 0; i < 3; i++) {
+      float d = std::max({min[i] - center[i], 0.0f, center[i] - max[i]});
+      distSq += d * d;
+    }
+    return distSq <= radius * radius;
+  }
+
   void LightmapGenerator::CalculateLighting(const std::vector<Light> &lights, Vec3 ambientColor) {
+    m_lights = lights;
+    m_ambient = ambientColor;
+    m_lit = true;
 
     unsigned char ambR = static_cast<unsigned char>(std::min(1.0f, ambientColor[0]) * 255);
     unsigned char ambG = static_cast<unsigned char>(std::min(1.0f, ambientColor[1]) * 255);
@@ -119,65 +215,484 @@ namespace quakelib::map {
       m_data[i * 4 + 3] = 255;
     }
 
+    std::fill(m_indirect.begin(), m_indirect.end(), Vec3{0, 0, 0});
+    m_bounced = false;
     for (const auto &entry : m_entries) {
-      Vec2 minUV = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
-      for (const auto &v : entry.face->Vertices()) {
-        Vec2 uv = entry.face->CalcLightmapUV(v.point);
-        minUV[0] = std::min(minUV[0], uv[0]);
-        minUV[1] = std::min(minUV[1], uv[1]);
+      lightEntry(entry);
+    }
+  }
+
+  int LightmapGenerator::UpdateLight(size_t index, const Light &light) {
+    if (index >= m_lights.size())
+      return 0;
+
+    Light old = m_lights[index];
+    m_lights[index] = light;
+    return relightSpheres(old, light);
+  }
+
+  int LightmapGenerator::AddLight(const Light &light) {
+    m_lights.push_back(light);
+    if (!m_lit) {
+      CalculateLighting(m_lights, m_ambient);
+      return static_cast<int>(m_entries.size());
+    }
+    return relightSpheres(light, light);
+  }
+
+  int LightmapGenerator::RemoveLight(size_t index) {
+    if (index >= m_lights.size())
+      return 0;
+
+    Light old = m_lights[index];
+    m_lights.erase(m_lights.begin() + index);
+    return relightSpheres(old, old);
+  }
+
+  int LightmapGenerator::relightSpheres(const Light &a, const Light &b) {
+    if (!m_lit) {
+      CalculateLighting(m_lights, m_ambient);
+      return static_cast<int>(m_entries.size());
+    }
+
+    // the bounces were gathered from the old direct light and would keep lighting the scene with a
+    // moved or removed light, drop them everywhere until CalculateBounces runs again
+    bool dropBounces = m_bounced;
+    if (dropBounces) {
+      std::fill(m_indirect.begin(), m_indirect.end(), Vec3{0, 0, 0});
+      m_bounced = false;
+    }
+
+    int relit = 0;
+    for (const auto &entry : m_entries) {
+      if (sphereTouchesBox(a.pos, a.radius, entry.min, entry.max) ||
+          sphereTouchesBox(b.pos, b.radius, entry.min, entry.max)) {
+        lightEntry(entry);
+        relit++;
+      } else if (dropBounces) {
+        size_t end = entry.luxelBase + static_cast<size_t>(entry.w) * entry.h;
+        for (size_t i = entry.luxelBase; i < end; ++i) {
+          if (m_luxels.atlasIndex[i] >= 0)
+            encodeLuxel(i);
+        }
       }
+    }
+    return relit;
+  }
 
-      Vec3 N = entry.face->GetPlaneNormal();
+  void LightmapGenerator::lightEntry(const LightmapEntry &entry) {
+    // only lights reaching this entry contribute, skip the rest up front
+    std::vector<const Light *> lights;
+    for (const auto &light : m_lights) {
+      if (sphereTouchesBox(light.pos, light.radius, entry.min, entry.max))
+        lights.push_back(&light);
+    }
 
-      for (int y = 0; y < entry.h; ++y) {
-        for (int x = 0; x < entry.w; ++x) {
+    size_t end = entry.luxelBase + static_cast<size_t>(entry.w) * entry.h;
+    for (size_t i = entry.luxelBase; i < end; ++i) {
+      int atlasIndex = m_luxels.atlasIndex[i];
+      if (atlasIndex < 0)
+        continue;
 
-          float u_local = (minUV[0]) + (x * m_luxelSize) + (m_luxelSize * 0.5f);
-          float v_local = (minUV[1]) + (y * m_luxelSize) + (m_luxelSize * 0.5f);
+      const Vec3 &worldPos = m_luxels.position[i];
+      const Vec3 &N = m_luxels.normal[i];
+      Vec3 totalLight = {0, 0, 0};
 
-          Vec3 worldPos = entry.face->CalcWorldPosFromLightmapUV({u_local, v_local});
+      for (const auto *light : lights) {
+        Vec3 toLight = light->pos - worldPos;
+        float dist = math::Len(toLight);
 
-          worldPos += N * 0.5f;
+        if (dist > light->radius)
+          continue;
 
-          Vec3 totalLight = {0, 0, 0};
+        float attenuation = std::max(0.0f, 1.0f - (dist / light->radius));
+        attenuation *= attenuation;
 
-          for (const auto &light : lights) {
-            Vec3 toLight = light.pos - worldPos;
-            float dist = math::Len(toLight);
+        Vec3 L = math::Norm(toLight);
+        float nDotL = std::max(0.0f, math::Dot(N, L));
 
-            if (dist > light.radius)
-              continue;
+        totalLight += light->color * (nDotL * attenuation);
+      }
 
-            float attenuation = std::max(0.0f, 1.0f - (dist / light.radius));
-            attenuation *= attenuation;
+      m_direct[i] = totalLight;
+      encodeLuxel(i);
+    }
+  }
 
-            Vec3 L = math::Norm(toLight);
-            float nDotL = std::max(0.0f, math::Dot(N, L));
+  void LightmapGenerator::encodeLuxel(size_t luxel) {
+    int index = m_luxels.atlasIndex[luxel] * 4;
+    Vec3 light = m_direct[luxel] + m_indirect[luxel];
 
-            totalLight += light.color * (nDotL * attenuation);
-          }
+    int r = static_cast<int>(std::min(1.0f, m_ambient[0]) * 255) + static_cast<int>(light[0] * 255.0f);
+    int g = static_cast<int>(std::min(1.0f, m_ambient[1]) * 255) + static_cast<int>(light[1] * 255.0f);
+    int b = static_cast<int>(std::min(1.0f, m_ambient[2]) * 255) + static_cast<int>(light[2] * 255.0f);
 
-          int atlasX = entry.x + x;
-          int atlasY = entry.y + y;
+    if (m_applyOcclusion) {
+      float ao = m_occlusion[luxel];
+      r = static_cast<int>(r * ao);
+      g = static_cast<int>(g * ao);
+      b = static_cast<int>(b * ao);
+    }
+
+    m_data[index + 0] = std::min(255, r);
+    m_data[index + 1] = std::min(255, g);
+    m_data[index + 2] = std::min(255, b);
+    m_data[index + 3] = 255;
+  }
+
+  const LightmapTracer &LightmapGenerator::tracer() {
+    if (!m_tracerBuilt) {
+      // entries come first, so a hit's face index below m_entries.size() is also its entry index
+      std::vector<FacePtr> faces;
+      std::unordered_map<const MapSurface *, size_t> entryOf;
+      m_traceEntry.clear();
+      m_traceOffset.clear();
+      for (size_t e = 0; e < m_entries.size(); e++) {
+        faces.push_back(m_entries[e].face);
+        entryOf[m_entries[e].face.get()] = e;
+        m_traceEntry.push_back(e);
+        m_traceOffset.push_back({0, 0, 0});
+      }
+
+      // instances block light with the prototype's faces moved into place
+      for (const auto &inst : m_instances) {
+        for (const auto &face : packedFaces(*inst->Prototype())) {
+          auto it = entryOf.find(face.get());
+          if (it == entryOf.end())
+            continue;
+          faces.push_back(face);
+          m_traceEntry.push_back(it->second);
+          m_traceOffset.push_back(inst->InstanceOffset());
+        }
+      }
+
+      m_tracer.Build(faces, m_traceOffset);
+      m_tracerBuilt = true;
+    }
+    return m_tracer;
+  }
 
-          if (atlasX < m_width && atlasY < m_height) {
-            int index = (atlasY * m_width + atlasX) * 4;
+  static uint32_t hashU32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+  }
+
+  static float nextFloat(uint32_t &state) {
+    state = hashU32(state + 0x9e3779b9);
+    return static_cast<float>(state >> 8) * (1.0f / 16777216.0f);
+  }
+
+  // cosine weighted direction around N, basis after Duff et al. "Building an Orthonormal Basis, Revisited"
+  static Vec3 cosineSample(const Vec3 &N, float u1, float u2) {
+    float sign = std::copysign(1.0f, N[2]);
+    float a = -1.0f / (sign + N[2]);
+    float b = N[0] * N[1] * a;
+    Vec3 T = {1.0f + sign * N[0] * N[0] * a, sign * b, -sign * N[0]};
+    Vec3 B = {b, sign + N[1] * N[1] * a, -N[1]};
+
+    float r = std::sqrt(u1);
+    float phi = 2.0f * static_cast<float>(M_PI) * u2;
+    return T * (r * std::cos(phi)) + B * (r * std::sin(phi)) + N * std::sqrt(std::max(0.0f, 1.0f - u1));
+  }
 
-            int r = m_data[index + 0];
-            int g = m_data[index + 1];
-            int b = m_data[index + 2];
+  bool LightmapGenerator::traceLuxel(const LightmapTracer &bvh, const Vec3 &origin, const Vec3 &dir,
+                                     float maxDist, size_t &luxel) const {
+    LightmapTracer::Hit hit;
+    if (!bvh.Intersect(origin, dir, maxDist, hit))
+      return false;
+
+    // the back of a face does not emit
+    const LightmapEntry &entry = m_entries[m_traceEntry[hit.face]];
+    if (math::Dot(entry.face->GetPlaneNormal(), dir) >= 0.0f)
+      return false;
+
+    // instance hits read the prototype's luxels
+    Vec2 uv = entry.face->CalcLightmapUV(origin + dir * hit.t - m_traceOffset[hit.face]);
+    int x = static_cast<int>((uv[0] - entry.minUV[0]) / m_luxelSize);
+    int y = static_cast<int>((uv[1] - entry.minUV[1]) / m_luxelSize);
+    x = std::clamp(x, 0, entry.w - 1);
+    y = std::clamp(y, 0, entry.h - 1);
+
+    luxel = entry.luxelBase + y * entry.w + x;
+    return true;
+  }
+
+  int LightmapGenerator::CalculateBounces(const BounceSettings &settings, const BounceProgressCb &progress) {
+    if (!m_lit || m_entries.empty() || settings.bounces <= 0 || settings.samples <= 0)
+      return 0;
+
+    const auto &bvh = tracer();
+    int patchSize = std::max(1, settings.patchSize);
+
+    // patches are patchSize x patchSize luxel blocks, gathering happens once per patch
+    struct Patch {
+      size_t entry;
+      int x, y, w, h;
+    };
+
+    std::vector<Patch> patches;
+    std::vector<size_t> patchBase(m_entries.size());
+    for (size_t e = 0; e < m_entries.size(); e++) {
+      const auto &entry = m_entries[e];
+      patchBase[e] = patches.size();
+      for (int y = 0; y < entry.h; y += patchSize) {
+        for (int x = 0; x < entry.w; x += patchSize) {
+          patches.push_back({e, x, y, std::min(patchSize, entry.w - x), std::min(patchSize, entry.h - y)});
+        }
+      }
+    }
 
-            r += static_cast<int>(totalLight[0] * 255.0f);
-            g += static_cast<int>(totalLight[1] * 255.0f);
-            b += static_cast<int>(totalLight[2] * 255.0f);
+    std::fill(m_indirect.begin(), m_indirect.end(), Vec3{0, 0, 0});
+    std::vector<Vec3> source = m_direct;
+    std::vector<Vec3> bounce(source.size());
+    std::vector<Vec3> patchLight(patches.size());
+
+    int completed = 0;
+    for (int pass = 0; pass < settings.bounces; pass++) {
+      ParallelFor(patches.size(), [&](size_t p) {
+        const Patch &patch = patches[p];
+        const LightmapEntry &entry = m_entries[patch.entry];
+
+        Vec3 center = {0, 0, 0};
+        for (int y = patch.y; y < patch.y + patch.h; y++) {
+          for (int x = patch.x; x < patch.x + patch.w; x++)
+            center += m_luxels.position[entry.luxelBase + y * entry.w + x];
+        }
+        center = center * (1.0f / static_cast<float>(patch.w * patch.h));
+        const Vec3 &N = m_luxels.normal[entry.luxelBase];
+
+        uint32_t rng = hashU32(static_cast<uint32_t>(p) * 0x632be5ab + static_cast<uint32_t>(pass));
+        Vec3 gathered = {0, 0, 0};
+        for (int s = 0; s < settings.samples; s++) {
+          float u1 = nextFloat(rng);
+          float u2 = nextFloat(rng);
+          Vec3 dir = cosineSample(N, u1, u2);
+
+          size_t luxel;
+          if (traceLuxel(bvh, center, dir, settings.maxDistance, luxel))
+            gathered += source[luxel];
+        }
 
-            m_data[index + 0] = std::min(255, r);
-            m_data[index + 1] = std::min(255, g);
-            m_data[index + 2] = std::min(255, b);
+        patchLight[p] = gathered * (settings.reflectivity / static_cast<float>(settings.samples));
+      });
+
+      // spread patch results back onto the luxels, bilinear between patch centers
+      ParallelFor(m_entries.size(), [&](size_t e) {
+        const LightmapEntry &entry = m_entries[e];
+        int pw = (entry.w + patchSize - 1) / patchSize;
+        int ph = (entry.h + patchSize - 1) / patchSize;
+        const Vec3 *grid = patchLight.data() + patchBase[e];
+
+        for (int y = 0; y < entry.h; y++) {
+          float fy = std::clamp((y + 0.5f) / patchSize - 0.5f, 0.0f, static_cast<float>(ph - 1));
+          int y0 = static_cast<int>(fy);
+          int y1 = std::min(y0 + 1, ph - 1);
+          float ty = fy - y0;
+
+          for (int x = 0; x < entry.w; x++) {
+            float fx = std::clamp((x + 0.5f) / patchSize - 0.5f, 0.0f, static_cast<float>(pw - 1));
+            int x0 = static_cast<int>(fx);
+            int x1 = std::min(x0 + 1, pw - 1);
+            float tx = fx - x0;
+
+            Vec3 top = grid[y0 * pw + x0] * (1.0f - tx) + grid[y0 * pw + x1] * tx;
+            Vec3 bottom = grid[y1 * pw + x0] * (1.0f - tx) + grid[y1 * pw + x1] * tx;
+            bounce[entry.luxelBase + y * entry.w + x] = top * (1.0f - ty) + bottom * ty;
           }
         }
+      });
+
+      for (size_t i = 0; i < bounce.size(); i++) {
+        m_indirect[i] += bounce[i];
+        if (m_luxels.atlasIndex[i] >= 0)
+          encodeLuxel(i);
+      }
+      m_bounced = true;
+      std::swap(source, bounce);
+      completed++;
+
+      if (progress && !progress(completed, settings.bounces))
+        break;
+    }
+
+    return completed;
+  }
+
+  void LightmapGenerator::CalculateOcclusion(const OcclusionSettings &settings) {
+    if (m_entries.empty() || settings.samples <= 0)
+      return;
+
+    const auto &bvh = tracer();
+    constexpr int N = LightmapTracer::PACKET_SIZE;
+
+    ParallelFor(m_luxels.Size(), [&](size_t i) {
+      if (m_luxels.atlasIndex[i] < 0)
+        return;
+
+      const Vec3 &origin = m_luxels.position[i];
+      const Vec3 &normal = m_luxels.normal[i];
+      uint32_t rng = hashU32(static_cast<uint32_t>(i) * 0x9e3779b1);
+
+      // all rays of a luxel share the origin, which keeps packets coherent
+      int blocked = 0;
+      for (int first = 0; first < settings.samples; first += N) {
+        LightmapTracer::RayPacket packet;
+        for (int s = first; s < std::min(first + N, settings.samples); s++) {
+          float u1 = nextFloat(rng);
+          float u2 = nextFloat(rng);
+          packet.Add(origin, cosineSample(normal, u1, u2));
+        }
+
+        bool occluded[N];
+        blocked += bvh.OccludedPacket(packet, settings.maxDistance, occluded);
+      }
+
+      float open = 1.0f - static_cast<float>(blocked) / static_cast<float>(settings.samples);
+      m_occlusion[i] = 1.0f - std::clamp(settings.strength, 0.0f, 1.0f) * (1.0f - open);
+    });
+
+    m_applyOcclusion = settings.applyToAtlas;
+    if (!m_lit)
+      return;
+
+    for (size_t i = 0; i < m_luxels.Size(); i++) {
+      if (m_luxels.atlasIndex[i] >= 0)
+        encodeLuxel(i);
+    }
+  }
+
+  LightGrid LightmapGenerator::BakeLightGrid(const LightGridSettings &settings) {
+    if (m_entries.empty() || settings.cellSize <= 0.0f)
+      return {};
+
+    Vec3 min = m_entries[0].min;
+    Vec3 max = m_entries[0].max;
+    for (const auto &entry : m_entries) {
+      for (int k = 0; k < 3; k++) {
+        min[k] = std::min(min[k], entry.min[k]);
+        max[k] = std::max(max[k], entry.max[k]);
+      }
+    }
+
+    int size[3];
+    for (int k = 0; k < 3; k++)
+      size[k] = static_cast<int>(std::ceil((max[k] - min[k]) / settings.cellSize)) + 1;
+
+    LightGrid grid(min, settings.cellSize, size[0], size[1], size[2]);
+    const auto &bvh = tracer();
+
+    static const Vec3 axes[6] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+
+    ParallelFor(static_cast<size_t>(size[0]) * size[1] * size[2], [&](size_t i) {
+      int x = static_cast<int>(i % size[0]);
+      int y = static_cast<int>(i / size[0] % size[1]);
+      int z = static_cast<int>(i / (static_cast<size_t>(size[0]) * size[1]));
+      Vec3 pos = grid.CellPosition(x, y, z);
+      AmbientCube &cell = grid.Cell(x, y, z);
+
+      for (auto &face : cell.faces)
+        face = m_ambient;
+
+      // direct light, same falloff as the lightmap with the cube face standing in for the surface normal
+      for (const auto &light : m_lights) {
+        Vec3 toLight = light.pos - pos;
+        float dist = math::Len(toLight);
+        if (dist > light.radius || dist <= 0.0f)
+          continue;
+
+        Vec3 L = toLight * (1.0f / dist);
+        if (settings.shadows && bvh.Occluded(pos, L, dist))
+          continue;
+
+        float attenuation = 1.0f - (dist / light.radius);
+        attenuation *= attenuation;
+        for (int f = 0; f < 6; f++)
+          cell.faces[f] += light.color * (attenuation * std::max(0.0f, math::Dot(axes[f], L)));
       }
+
+      // light reflected by the baked surfaces, uniform sphere directions projected onto the cube faces
+      if (settings.samples <= 0)
+        return;
+
+      uint32_t rng = hashU32(static_cast<uint32_t>(i) * 0x85ebca6b);
+      float weight = 4.0f * settings.reflectivity / static_cast<float>(settings.samples);
+      for (int s = 0; s < settings.samples; s++) {
+        float cosTheta = 1.0f - 2.0f * nextFloat(rng);
+        float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+        float phi = 2.0f * static_cast<float>(M_PI) * nextFloat(rng);
+        Vec3 dir = {sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta};
+
+        size_t luxel;
+        if (!traceLuxel(bvh, pos, dir, settings.maxDistance, luxel))
+          continue;
+
+        Vec3 radiance = (m_direct[luxel] + m_indirect[luxel]) * weight;
+        for (int f = 0; f < 6; f++)
+          cell.faces[f] += radiance * std::max(0.0f, math::Dot(axes[f], dir));
+      }
+    });
+
+    return grid;
+  }
+
+  Vec3 LightmapGenerator::luxelLight(size_t luxel) const {
+    Vec3 light = m_ambient + m_direct[luxel] + m_indirect[luxel];
+    return m_applyOcclusion ? light * m_occlusion[luxel] : light;
+  }
+
+  std::vector<float> LightmapGenerator::GetHDRAtlasData() const {
+    std::vector<float> hdr(static_cast<size_t>(m_width) * m_height * 3, 0.0f);
+    if (!m_lit)
+      return hdr;
+
+    // pixels not covered by a luxel keep the ambient level, like the encoded atlases
+    for (size_t i = 0; i < hdr.size(); i += 3)
+      std::copy(m_ambient.Elements, m_ambient.Elements + 3, hdr.begin() + i);
+
+    for (size_t i = 0; i < m_luxels.Size(); i++) {
+      int atlasIndex = m_luxels.atlasIndex[i];
+      if (atlasIndex < 0)
+        continue;
+
+      Vec3 light = luxelLight(i);
+      hdr[atlasIndex * 3 + 0] = light[0];
+      hdr[atlasIndex * 3 + 1] = light[1];
+      hdr[atlasIndex * 3 + 2] = light[2];
+    }
+    return hdr;
+  }
+
+  std::vector<unsigned char> LightmapGenerator::GetEncodedAtlasData(LightmapEncoding encoding,
+                                                                    float rgbmRange) const {
+    if (!m_lit || encoding == LightmapEncoding::RGBA8)
+      return m_data;
+
+    // pixels not covered by a luxel keep the ambient level, like the RGBA8 atlas
+    unsigned char ambient[4];
+    if (encoding == LightmapEncoding::RGBM)
+      EncodeRGBM(m_ambient, rgbmRange, ambient);
+    else
+      EncodeLogLuv(m_ambient, ambient);
+
+    std::vector<unsigned char> out(m_data.size());
+    for (size_t i = 0; i < out.size(); i += 4)
+      std::copy(ambient, ambient + 4, out.begin() + i);
+
+    for (size_t i = 0; i < m_luxels.Size(); i++) {
+      int atlasIndex = m_luxels.atlasIndex[i];
+      if (atlasIndex < 0)
+        continue;
+
+      if (encoding == LightmapEncoding::RGBM)
+        EncodeRGBM(luxelLight(i), rgbmRange, &out[atlasIndex * 4]);
+      else
+        EncodeLogLuv(luxelLight(i), &out[atlasIndex * 4]);
     }
+    return out;
   }
 
   void LightmapGenerator::GenerateAtlasImage() {
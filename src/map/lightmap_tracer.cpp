@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <quakelib/map/lightmap_tracer.h>
+
+namespace quakelib::map {
+  static constexpr int MAX_LEAF_TRIANGLES = 4;
+  static constexpr int MAX_STACK_DEPTH = 64;
+
+  void LightmapTracer::Build(const std::vector<FacePtr> &faces, const std::vector<Vec3> &offsets) {
+    m_nodes.clear();
+    m_triangles.clear();
+
+    for (int fid = 0; fid < (int)faces.size(); fid++) {
+      const auto &verts = faces[fid]->Vertices();
+      const auto &inds = faces[fid]->Indices();
+      Vec3 offset = offsets.empty() ? Vec3{0, 0, 0} : offsets[fid];
+      for (size_t i = 0; i + 2 < inds.size(); i += 3) {
+        Vec3 a = verts[inds[i + 0]].point + offset;
+        Vec3 b = verts[inds[i + 1]].point + offset;
+        Vec3 c = verts[inds[i + 2]].point + offset;
+        m_triangles.push_back({a, b - a, c - a, fid});
+      }
+    }
+
+    if (m_triangles.empty())
+      return;
+
+    std::vector<Vec3> centroids(m_triangles.size());
+    std::vector<int> order(m_triangles.size());
+    for (size_t i = 0; i < m_triangles.size(); i++) {
+      const auto &tri = m_triangles[i];
+      centroids[i] = tri.v0 + (tri.e1 + tri.e2) * (1.0f / 3.0f);
+      order[i] = (int)i;
+    }
+
+    m_nodes.reserve(m_triangles.size() * 2);
+    m_nodes.push_back({});
+    buildNode(0, centroids, order, 0, (int)m_triangles.size());
+
+    // store triangles in leaf order so every leaf references a contiguous range
+    std::vector<Triangle> sorted(m_triangles.size());
+    for (size_t i = 0; i < order.size(); i++)
+      sorted[i] = m_triangles[order[i]];
+    m_triangles = std::move(sorted);
+  }
+
+  void LightmapTracer::buildNode(int nodeIndex, const std::vector<Vec3> &centroids, std::vector<int> &order,
+                                 int first, int count) {
+    Vec3 min = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                std::numeric_limits<float>::max()};
+    Vec3 max = {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(),
+                std::numeric_limits<float>::lowest()};
+    Vec3 cmin = min;
+    Vec3 cmax = max;
+
+    for (int i = first; i < first + count; i++) {
+      const auto &tri = m_triangles[order[i]];
+      const auto &c = centroids[order[i]];
+      Vec3 b = tri.v0 + tri.e1;
+      Vec3 d = tri.v0 + tri.e2;
+      for (int k = 0; k < 3; k++) {
+        min[k] = std::min({min[k], tri.v0[k], b[k], d[k]});
+        max[k] = std::max({max[k], tri.v0[k], b[k], d[k]});
+        cmin[k] = std::min(cmin[k], c[k]);
+        cmax[k] = std::max(cmax[k], c[k]);
+      }
+    }
+
+    m_nodes[nodeIndex].min = min;
+    m_nodes[nodeIndex].max = max;
+
+    Vec3 extent = cmax - cmin;
+    int axis = 0;
+    if (extent[1] > extent[axis])
+      axis = 1;
+    if (extent[2] > extent[axis])
+      axis = 2;
+
+    if (count <= MAX_LEAF_TRIANGLES || extent[axis] <= 0.0f) {
+      m_nodes[nodeIndex].first = first;
+      m_nodes[nodeIndex].count = count;
+      return;
+    }
+
+    // median split along the widest centroid axis
+    int mid = first + count / 2;
+    std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count,
+                     [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+    int left = (int)m_nodes.size();
+    m_nodes[nodeIndex].first = left;
+    m_nodes[nodeIndex].count = 0;
+    m_nodes.push_back({});
+    m_nodes.push_back({});
+
+    buildNode(left, centroids, order, first, mid - first);
+    buildNode(left + 1, centroids, order, mid, first + count - mid);
+  }
+
+  static bool rayBox(const Vec3 &origin, const Vec3 &invDir, const Vec3 &min, const Vec3 &max, float maxDist) {
+    float t0 = 0.0f;
+    float t1 = maxDist;
+    for (int k = 0; k < 3; k++) {
+      float ta = (min[k] - origin[k]) * invDir[k];
+      float tb = (max[k] - origin[k]) * invDir[k];
+      if (ta > tb)
+        std::swap(ta, tb);
+      t0 = std::max(t0, ta);
+      t1 = std::min(t1, tb);
+      if (t0 > t1)
+        return false;
+    }
+    return true;
+  }
+
+  template <bool anyHit>
+  bool LightmapTracer::traverse(const Vec3 &origin, const Vec3 &dir, float maxDist, Hit &hit) const {
+    if (m_nodes.empty())
+      return false;
+
+    Vec3 invDir;
+    for (int k = 0; k < 3; k++)
+      invDir[k] = dir[k] != 0.0f ? 1.0f / dir[k] : 1e30f;
+
+    bool found = false;
+    float closest = maxDist;
+
+    int stack[MAX_STACK_DEPTH];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    while (sp > 0) {
+      const Node &node = m_nodes[stack[--sp]];
+      if (!rayBox(origin, invDir, node.min, node.max, closest))
+        continue;
+
+      if (node.count == 0) {
+        // visit the child on the near side of the ray first
+        const Node &left = m_nodes[node.first];
+        const Node &right = m_nodes[node.first + 1];
+        bool leftFirst = math::Dot(dir, left.min + left.max) <= math::Dot(dir, right.min + right.max);
+        stack[sp++] = leftFirst ? node.first + 1 : node.first;
+        stack[sp++] = leftFirst ? node.first : node.first + 1;
+        continue;
+      }
+
+      for (int i = node.first; i < node.first + node.count; i++) {
+        const Triangle &tri = m_triangles[i];
+
+        // Moeller-Trumbore, both sides count as a hit
+        Vec3 p = math::Cross(dir, tri.e2);
+        float det = math::Dot(tri.e1, p);
+        if (std::fabs(det) < 1e-8f)
+          continue;
+
+        float invDet = 1.0f / det;
+        Vec3 s = origin - tri.v0;
+        float u = math::Dot(s, p) * invDet;
+        if (u < 0.0f || u > 1.0f)
+          continue;
+
+        Vec3 q = math::Cross(s, tri.e1);
+        float v = math::Dot(dir, q) * invDet;
+        if (v < 0.0f || u + v > 1.0f)
+          continue;
+
+        float t = math::Dot(tri.e2, q) * invDet;
+        if (t <= 0.0f || t >= closest)
+          continue;
+
+        closest = t;
+        hit.t = t;
+        hit.face = tri.face;
+        found = true;
+
+        if constexpr (anyHit)
+          return true;
+      }
+    }
+
+    return found;
+  }
+
+  bool LightmapTracer::Intersect(const Vec3 &origin, const Vec3 &dir, float maxDist, Hit &hit) const {
+    return traverse<false>(origin, dir, maxDist, hit);
+  }
+
+  bool LightmapTracer::Occluded(const Vec3 &origin, const Vec3 &dir, float maxDist) const {
+    Hit hit;
+    return traverse<true>(origin, dir, maxDist, hit);
+  }
+
+  int LightmapTracer::OccludedPacket(const RayPacket &packet, float maxDist,
+                                     bool (&occluded)[PACKET_SIZE]) const {
+    constexpr int N = PACKET_SIZE;
+    int remaining = packet.count;
+
+    // unused lanes start out occluded so they never keep a node alive
+    for (int r = 0; r < N; r++)
+      occluded[r] = r >= packet.count;
+
+    if (m_nodes.empty() || remaining == 0)
+      return 0;
+
+    float ix[N], iy[N], iz[N];
+    for (int r = 0; r < N; r++) {
+      ix[r] = packet.dx[r] != 0.0f ? 1.0f / packet.dx[r] : 1e30f;
+      iy[r] = packet.dy[r] != 0.0f ? 1.0f / packet.dy[r] : 1e30f;
+      iz[r] = packet.dz[r] != 0.0f ? 1.0f / packet.dz[r] : 1e30f;
+    }
+
+    Vec3 firstDir = {packet.dx[0], packet.dy[0], packet.dz[0]};
+
+    int stack[MAX_STACK_DEPTH];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    while (sp > 0 && remaining > 0) {
+      const Node &node = m_nodes[stack[--sp]];
+
+      // slab test for all lanes, the node is visited if any active ray enters it
+      bool any = false;
+      for (int r = 0; r < N; r++) {
+        float ax = (node.min[0] - packet.ox[r]) * ix[r], bx = (node.max[0] - packet.ox[r]) * ix[r];
+        float ay = (node.min[1] - packet.oy[r]) * iy[r], by = (node.max[1] - packet.oy[r]) * iy[r];
+        float az = (node.min[2] - packet.oz[r]) * iz[r], bz = (node.max[2] - packet.oz[r]) * iz[r];
+        float t0 = std::max({0.0f, std::min(ax, bx), std::min(ay, by), std::min(az, bz)});
+        float t1 = std::min({maxDist, std::max(ax, bx), std::max(ay, by), std::max(az, bz)});
+        any |= !occluded[r] && t0 <= t1;
+      }
+      if (!any)
+        continue;
+
+      if (node.count == 0) {
+        const Node &left = m_nodes[node.first];
+        const Node &right = m_nodes[node.first + 1];
+        bool leftFirst = math::Dot(firstDir, left.min + left.max) <= math::Dot(firstDir, right.min + right.max);
+        stack[sp++] = leftFirst ? node.first + 1 : node.first;
+        stack[sp++] = leftFirst ? node.first : node.first + 1;
+        continue;
+      }
+
+      for (int i = node.first; i < node.first + node.count; i++) {
+        const Triangle &tri = m_triangles[i];
+
+        // Moeller-Trumbore across all lanes without early outs
+        for (int r = 0; r < N; r++) {
+          float px = packet.dy[r] * tri.e2[2] - packet.dz[r] * tri.e2[1];
+          float py = packet.dz[r] * tri.e2[0] - packet.dx[r] * tri.e2[2];
+          float pz = packet.dx[r] * tri.e2[1] - packet.dy[r] * tri.e2[0];
+          float det = tri.e1[0] * px + tri.e1[1] * py + tri.e1[2] * pz;
+          float invDet = std::fabs(det) < 1e-8f ? 0.0f : 1.0f / det;
+
+          float sx = packet.ox[r] - tri.v0[0];
+          float sy = packet.oy[r] - tri.v0[1];
+          float sz = packet.oz[r] - tri.v0[2];
+          float u = (sx * px + sy * py + sz * pz) * invDet;
+
+          float qx = sy * tri.e1[2] - sz * tri.e1[1];
+          float qy = sz * tri.e1[0] - sx * tri.e1[2];
+          float qz = sx * tri.e1[1] - sy * tri.e1[0];
+          float v = (packet.dx[r] * qx + packet.dy[r] * qy + packet.dz[r] * qz) * invDet;
+          float t = (tri.e2[0] * qx + tri.e2[1] * qy + tri.e2[2] * qz) * invDet;
+
+          bool hit = invDet != 0.0f && u >= 0.0f && u <= 1.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f &&
+                     t < maxDist;
+          remaining -= hit && !occluded[r];
+          occluded[r] |= hit;
+        }
+      }
+    }
+
+    return packet.count - remaining;
+  }
+} // namespace quakelib::map
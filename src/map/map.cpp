@@ -1,6 +1,11 @@
 #include <quakelib/map/map.h>
 
+#include <algorithm>
+#include <bit>
+#include <cfloat>
+#include <cmath>
 #include <iostream>
+#include <unordered_map>
 
 namespace quakelib::map {
   void QMap::LoadBuffer(const char *buffer, getTextureBoundsCb getTextureBounds) {
@@ -27,19 +32,115 @@ namespace quakelib::map {
     }
   }
 
+  static constexpr float INSTANCE_QUANT = 64.0f; // plane points closer than 1/64 unit match
+
+  static int64_t quantizeInstance(float v) { return std::llround(v * INSTANCE_QUANT); }
+
+  // texture offsets only matter modulo the texture size
+  static int64_t wrapInstance(float offset, float size) {
+    int64_t q = quantizeInstance(offset);
+    int64_t period = quantizeInstance(size);
+    return period > 0 ? ((q % period) + period) % period : q;
+  }
+
+  static uint64_t hashInstanceKey(const std::vector<int64_t> &key) {
+    uint64_t h = 14695981039346656037ull;
+    for (auto v : key) {
+      h ^= (uint64_t)v;
+      h *= 1099511628211ull;
+    }
+    return h;
+  }
+
+  std::vector<int64_t> QMap::instanceKey(const SolidMapEntity &entity, Vec3 &origin) const {
+    origin = {FLT_MAX, FLT_MAX, FLT_MAX};
+    for (const auto &b : entity.m_brushes) {
+      for (const auto &f : b.Faces()) {
+        for (const auto &p : f->m_planePoints) {
+          for (int a = 0; a < 3; a++)
+            origin[a] = std::min(origin[a], p[a]);
+        }
+      }
+    }
+
+    std::vector<int64_t> key;
+    key.push_back((int64_t)entity.m_brushes.size());
+    for (const auto &b : entity.m_brushes) {
+      key.push_back((int64_t)b.Faces().size());
+      for (const auto &f : b.Faces()) {
+        for (const auto &p : f->m_planePoints) {
+          for (int a = 0; a < 3; a++)
+            key.push_back(quantizeInstance(p[a] - origin[a]));
+        }
+        key.push_back(f->m_textureID);
+        key.push_back(f->m_hasValveUV);
+        key.push_back(std::bit_cast<int32_t>(f->m_rotation));
+        key.push_back(std::bit_cast<int32_t>(f->m_scaleX));
+        key.push_back(std::bit_cast<int32_t>(f->m_scaleY));
+        if (f->m_hasValveUV) {
+          for (int a = 0; a < 3; a++) {
+            key.push_back(std::bit_cast<int32_t>(f->m_valveUV.u[a]));
+            key.push_back(std::bit_cast<int32_t>(f->m_valveUV.v[a]));
+          }
+        }
+
+        // the texture projection is linear, its value at the origin is the offset in the local frame
+        Vec2 offset = f->CalcUV(origin, 1, 1);
+        textureBounds bounds = {0, 0};
+        auto it = m_textureIDBounds.find(f->m_textureID);
+        if (it != m_textureIDBounds.end())
+          bounds = it->second;
+        key.push_back(wrapInstance(offset[0], bounds.width));
+        key.push_back(wrapInstance(offset[1], bounds.height));
+      }
+    }
+    return key;
+  }
+
   void QMap::GenerateGeometry() {
     bool clipBrushes = m_config.csg;
-    for (const auto &se : m_map_file->m_solidEntities) {
+    const auto &entities = m_map_file->m_solidEntities;
+
+    std::unordered_map<uint64_t, std::vector<size_t>> prototypes;
+    std::vector<std::vector<int64_t>> keys(entities.size());
+    std::vector<Vec3> origins(entities.size());
+    for (size_t i = 0; i < entities.size(); i++) {
+      const auto &se = entities[i];
+      se->m_prototype = nullptr;
+      se->m_instanceOffset = {0, 0, 0};
+
+      if (m_config.instanceBrushEntities && se.get() != m_map_file->m_worldSpawn && !se->m_brushes.empty()) {
+        keys[i] = instanceKey(*se, origins[i]);
+        auto &bucket = prototypes[hashInstanceKey(keys[i])];
+        auto match = std::find_if(bucket.begin(), bucket.end(), [&](size_t j) { return keys[j] == keys[i]; });
+        if (match != bucket.end()) {
+          const auto &proto = entities[*match];
+          se->m_prototype = proto;
+          se->m_instanceOffset = origins[i] - origins[*match];
+          se->m_min = proto->m_min + se->m_instanceOffset;
+          se->m_max = proto->m_max + se->m_instanceOffset;
+          se->m_center = proto->m_center + se->m_instanceOffset;
+          continue;
+        }
+        bucket.push_back(i);
+      }
+
       se->generateMesh(m_textureIDTypes, m_textureIDBounds);
       if (clipBrushes) {
         se->csgUnion();
       }
-      if (m_config.convertCoordToOGL) {
-        se->convertToOpenGLCoords();
-      }
+    }
+
+    m_outsideFill = OutsideFillResult();
+    if (m_config.outsideFill && m_map_file->m_worldSpawn) {
+      m_outsideFill = m_map_file->m_worldSpawn->outsideFill(m_map_file->m_pointEntities, m_map_file->m_textures,
+                                                            m_config.outsideFillVoxelSize);
     }
 
     if (m_config.convertCoordToOGL) {
+      for (const auto &se : entities) {
+        se->convertToOpenGLCoords();
+      }
       for (const auto &pe : m_map_file->m_pointEntities) {
         auto o = pe->Origin();
         auto temp = o[1];
@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <quakelib/map/entities.h>
+
+namespace quakelib::map {
+  static constexpr size_t MAX_FILL_VOXELS = 1 << 24;
+  static constexpr float FILL_EPSILON = 0.01f;
+
+  enum eVoxelState : uint8_t { VOXEL_EMPTY = 0, VOXEL_SOLID, VOXEL_OUTSIDE, VOXEL_INSIDE };
+
+  struct VoxelGrid {
+    Vec3 origin;
+    float size;
+    int dim[3];
+    std::vector<uint8_t> state;
+    std::vector<uint8_t> parent; // direction the flood came from, for leak paths
+
+    size_t Index(int x, int y, int z) const { return ((size_t)z * dim[1] + y) * dim[0] + x; }
+
+    bool Cell(const Vec3 &p, int out[3]) const {
+      for (int a = 0; a < 3; a++) {
+        out[a] = (int)std::floor((p[a] - origin[a]) / size);
+        if (out[a] < 0 || out[a] >= dim[a])
+          return false;
+      }
+      return true;
+    }
+
+    Vec3 Center(size_t index) const {
+      int x = (int)(index % dim[0]);
+      int y = (int)((index / dim[0]) % dim[1]);
+      int z = (int)(index / ((size_t)dim[0] * dim[1]));
+      return origin + Vec3{x + 0.5f, y + 0.5f, z + 0.5f} * size;
+    }
+  };
+
+  static const int FILL_DIRS[6][3] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+
+  // Breadth first flood through empty voxels, starting from the voxels already in queue
+  static void flood(VoxelGrid &grid, std::vector<size_t> &queue, uint8_t mark) {
+    for (size_t head = 0; head < queue.size(); head++) {
+      size_t index = queue[head];
+      int x = (int)(index % grid.dim[0]);
+      int y = (int)((index / grid.dim[0]) % grid.dim[1]);
+      int z = (int)(index / ((size_t)grid.dim[0] * grid.dim[1]));
+      for (int d = 0; d < 6; d++) {
+        int nx = x + FILL_DIRS[d][0], ny = y + FILL_DIRS[d][1], nz = z + FILL_DIRS[d][2];
+        if (nx < 0 || ny < 0 || nz < 0 || nx >= grid.dim[0] || ny >= grid.dim[1] || nz >= grid.dim[2])
+          continue;
+        size_t next = grid.Index(nx, ny, nz);
+        if (grid.state[next] != VOXEL_EMPTY)
+          continue;
+        grid.state[next] = mark;
+        grid.parent[next] = (uint8_t)(d ^ 1); // back towards where the flood came from
+        queue.push_back(next);
+      }
+    }
+  }
+
+  // Plane normal of a face pointing out of its brush
+  static Vec3 outwardNormal(const FacePtr &face, const Vec3 &inside) {
+    const Vec3 &n = face->GetPlaneNormal();
+    return math::Dot(n, inside) > face->GetPlaneDist() ? n * -1.0f : n;
+  }
+
+  // Points spread over a convex face: the centre, every corner pulled towards it, and a grid at the given
+  // spacing clipped to the polygon, so large faces are tested everywhere they might border the inside
+  static void faceSamples(const std::vector<Vertex> &verts, const Vec3 &n, float spacing,
+                          std::vector<Vec3> &out) {
+    Vec3 centre = {0, 0, 0};
+    for (const auto &v : verts)
+      centre = centre + v.point;
+    centre = centre / (float)verts.size();
+    out.push_back(centre);
+    for (const auto &v : verts)
+      out.push_back(v.point + (centre - v.point) * 0.1f);
+    if (verts.size() < 3)
+      return;
+
+    Vec3 axis = std::fabs(n[0]) < 0.6f ? Vec3{1, 0, 0} : Vec3{0, 1, 0};
+    Vec3 u = math::Norm(math::Cross(n, axis));
+    Vec3 v = math::Cross(n, u);
+
+    std::vector<Vec2> poly;
+    Vec2 lo = {FLT_MAX, FLT_MAX};
+    Vec2 hi = {-FLT_MAX, -FLT_MAX};
+    for (const auto &vert : verts) {
+      Vec3 d = vert.point - centre;
+      Vec2 p = {math::Dot(d, u), math::Dot(d, v)};
+      poly.push_back(p);
+      lo = {std::min(lo[0], p[0]), std::min(lo[1], p[1])};
+      hi = {std::max(hi[0], p[0]), std::max(hi[1], p[1])};
+    }
+
+    // the winding decides which side of an edge is inside
+    float area = 0;
+    for (size_t i = 0; i < poly.size(); i++) {
+      const Vec2 &a = poly[i];
+      const Vec2 &b = poly[(i + 1) % poly.size()];
+      area += a[0] * b[1] - b[0] * a[1];
+    }
+    float winding = area < 0 ? -1.0f : 1.0f;
+
+    for (float y = lo[1] + spacing * 0.5f; y < hi[1]; y += spacing) {
+      for (float x = lo[0] + spacing * 0.5f; x < hi[0]; x += spacing) {
+        bool inside = true;
+        for (size_t i = 0; i < poly.size() && inside; i++) {
+          const Vec2 &a = poly[i];
+          const Vec2 &b = poly[(i + 1) % poly.size()];
+          inside = winding * ((b[0] - a[0]) * (y - a[1]) - (b[1] - a[1]) * (x - a[0])) >= 0;
+        }
+        if (inside)
+          out.push_back(centre + u * x + v * y);
+      }
+    }
+  }
+
+  OutsideFillResult
+  SolidMapEntity::outsideFill(const std::vector<std::shared_ptr<PointEntity>> &pointEntities,
+                              const std::vector<std::string> &textureNames, float voxelSize) {
+    OutsideFillResult result;
+    if (pointEntities.empty())
+      return result;
+
+    // Liquids and non-solid brushes don't seal
+    auto seals = [&](const Brush &b) {
+      if (b.Faces().empty() || b.IsNonSolidBrush() || b.IsBlockVolume())
+        return false;
+      int tex = b.Faces()[0]->TextureID();
+      return !(tex >= 0 && tex < (int)textureNames.size() && textureNames[tex].starts_with("*"));
+    };
+
+    Vec3 mins = {FLT_MAX, FLT_MAX, FLT_MAX};
+    Vec3 maxs = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (const auto &b : m_brushes) {
+      if (!seals(b))
+        continue;
+      for (int a = 0; a < 3; a++) {
+        mins[a] = std::min(mins[a], b.min[a]);
+        maxs[a] = std::max(maxs[a], b.max[a]);
+      }
+    }
+    if (mins[0] > maxs[0])
+      return result;
+
+    // two empty voxels of padding so the outside is connected around the map
+    VoxelGrid grid;
+    grid.size = std::max(voxelSize, 1.0f);
+    for (;;) {
+      size_t total = 1;
+      for (int a = 0; a < 3; a++) {
+        grid.dim[a] = (int)std::ceil((maxs[a] - mins[a]) / grid.size) + 4;
+        total *= grid.dim[a];
+      }
+      if (total <= MAX_FILL_VOXELS)
+        break;
+      grid.size *= 2;
+    }
+    grid.origin = mins - Vec3{2, 2, 2} * grid.size;
+    grid.state.assign((size_t)grid.dim[0] * grid.dim[1] * grid.dim[2], VOXEL_EMPTY);
+    grid.parent.assign(grid.state.size(), 0);
+    result.voxelSize = grid.size;
+
+    // a voxel is solid when it overlaps a sealing brush, touching doesn't count
+    float half = grid.size * 0.5f;
+    for (const auto &b : m_brushes) {
+      if (!seals(b))
+        continue;
+      Vec3 inside = (b.min + b.max) * 0.5f;
+      std::vector<Vec3> normals;
+      std::vector<float> dists;
+      for (const auto &f : b.Faces()) {
+        Vec3 n = outwardNormal(f, inside);
+        normals.push_back(n);
+        dists.push_back(math::Dot(n, f->GetPlaneNormal()) > 0 ? f->GetPlaneDist() : -f->GetPlaneDist());
+      }
+
+      int lo[3], hi[3];
+      for (int a = 0; a < 3; a++) {
+        lo[a] = std::max(0, (int)std::floor((b.min[a] - grid.origin[a]) / grid.size));
+        hi[a] = std::min(grid.dim[a] - 1, (int)std::floor((b.max[a] - grid.origin[a]) / grid.size));
+      }
+      for (int z = lo[2]; z <= hi[2]; z++) {
+        for (int y = lo[1]; y <= hi[1]; y++) {
+          for (int x = lo[0]; x <= hi[0]; x++) {
+            size_t index = grid.Index(x, y, z);
+            Vec3 c = grid.Center(index);
+            bool overlaps = true;
+            for (size_t p = 0; p < normals.size() && overlaps; p++) {
+              const Vec3 &n = normals[p];
+              float reach = half * (std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]));
+              overlaps = math::Dot(n, c) - reach < dists[p] - FILL_EPSILON;
+            }
+            if (overlaps)
+              grid.state[index] = VOXEL_SOLID;
+          }
+        }
+      }
+    }
+
+    std::vector<size_t> queue;
+    for (int z = 0; z < grid.dim[2]; z++) {
+      for (int y = 0; y < grid.dim[1]; y++) {
+        for (int x = 0; x < grid.dim[0]; x++) {
+          bool border = x == 0 || y == 0 || z == 0 || x == grid.dim[0] - 1 || y == grid.dim[1] - 1 ||
+                        z == grid.dim[2] - 1;
+          size_t index = grid.Index(x, y, z);
+          if (border && grid.state[index] == VOXEL_EMPTY) {
+            grid.state[index] = VOXEL_OUTSIDE;
+            grid.parent[index] = 0xff;
+            queue.push_back(index);
+          }
+        }
+      }
+    }
+    flood(grid, queue, VOXEL_OUTSIDE);
+
+    // any entity the outside reaches is a leak, walk the flood back out for the path
+    queue.clear();
+    for (const auto &pe : pointEntities) {
+      int cell[3];
+      bool inGrid = grid.Cell(pe->Origin(), cell);
+      size_t index = inGrid ? grid.Index(cell[0], cell[1], cell[2]) : 0;
+      if (inGrid && grid.state[index] == VOXEL_SOLID)
+        continue;
+
+      if (!inGrid || grid.state[index] == VOXEL_OUTSIDE) {
+        result.ran = true;
+        result.leaked = true;
+        result.leakEntity = pe->ClassName();
+        result.leakOrigin = pe->Origin();
+        result.leakPath.push_back(pe->Origin());
+        while (inGrid && grid.parent[index] != 0xff) {
+          const int *d = FILL_DIRS[grid.parent[index]];
+          index = (size_t)((int64_t)index + d[0] + (int64_t)d[1] * grid.dim[0] +
+                           (int64_t)d[2] * grid.dim[0] * grid.dim[1]);
+          result.leakPath.push_back(grid.Center(index));
+        }
+        return result;
+      }
+
+      if (grid.state[index] == VOXEL_EMPTY) {
+        grid.state[index] = VOXEL_INSIDE;
+        queue.push_back(index);
+      }
+    }
+    if (queue.empty())
+      return result;
+    result.ran = true;
+    flood(grid, queue, VOXEL_INSIDE);
+
+    // keep faces with an inside voxel in front of them anywhere on the face
+    auto &brushes = m_wasClipped ? m_clippedBrushes : m_brushes;
+    std::vector<Vec3> samples;
+    for (auto &b : brushes) {
+      Vec3 inside = (b.min + b.max) * 0.5f;
+      size_t before = b.m_faces.size();
+      std::erase_if(b.m_faces, [&](const FacePtr &f) {
+        const auto &verts = f->Vertices();
+        if (verts.empty())
+          return false;
+
+        Vec3 n = outwardNormal(f, inside);
+        samples.clear();
+        faceSamples(verts, n, grid.size, samples);
+
+        for (const auto &s : samples) {
+          for (float step = 0.5f; step <= 2.0f; step += 0.5f) {
+            int cell[3];
+            if (grid.Cell(s + n * (grid.size * step), cell) &&
+                grid.state[grid.Index(cell[0], cell[1], cell[2])] == VOXEL_INSIDE)
+              return false;
+          }
+        }
+        return true;
+      });
+      result.removedFaces += before - b.m_faces.size();
+    }
+    return result;
+  }
+} // namespace quakelib::map
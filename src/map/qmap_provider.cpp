@@ -1,11 +1,16 @@
+#include <algorithm>
 #include <iostream>
+#include <quakelib/face_merge.h>
+#include <quakelib/mesh_optimize.h>
 #include <quakelib/map/map.h>
 #include <quakelib/map/qmap_provider.h>
+#include <unordered_map>
 #include <xatlas/xatlas.h>
 
 namespace quakelib {
 
   bool QMapProvider::Load(const std::string &path) {
+    m_meshCache.clear();
     try {
       m_map.LoadFile(path, nullptr);
 
@@ -26,7 +31,10 @@ namespace quakelib {
     return Load(path);
   }
 
-  void QMapProvider::GenerateGeometry(bool csg) { m_map.GenerateGeometry(); }
+  void QMapProvider::GenerateGeometry(bool csg) {
+    m_meshCache.clear();
+    m_map.GenerateGeometry();
+  }
 
   void QMapProvider::SetFaceType(const std::string &textureName, SurfaceType type) {
     map::MapSurface::eFaceType mapType = map::MapSurface::SOLID;
@@ -44,6 +52,7 @@ namespace quakelib {
       break;
     }
     m_map.SetFaceTypeByTextureID(textureName, mapType);
+    m_meshCache.clear();
   }
 
   std::vector<SolidEntityPtr> QMapProvider::GetSolidEntities() const {
@@ -87,6 +96,14 @@ namespace quakelib {
     if (!mapEnt)
       return {};
 
+    // Instances have no geometry of their own, see GetEntityInstances
+    if (mapEnt->Prototype())
+      return {};
+
+    auto cached = m_meshCache.find(mapEnt.get());
+    if (cached != m_meshCache.end())
+      return cached->second;
+
     // Phase 1: Batch faces by texture ID
     std::map<int, std::vector<map::FacePtr>> batchedFaces;
     const auto &brushes = mapEnt->Brushes();
@@ -101,6 +118,20 @@ namespace quakelib {
       }
     }
 
+    // all textures are merged in one pass grouped by texture, so corners that faces of another
+    // texture rely on are kept
+    std::map<int, std::vector<MergePolygon>> merged;
+    if (m_map.Config().mergeCoplanarFaces) {
+      std::vector<MergePolygon> polygons;
+      for (auto const &[texID, faces] : batchedFaces) {
+        for (const auto &face : faces)
+          polygons.push_back({face->Vertices(), texID});
+      }
+      MergeCoplanarPolygons(polygons);
+      for (auto &polygon : polygons)
+        merged[polygon.group].push_back(std::move(polygon));
+    }
+
     // Phase 2: Build meshes with vertex welding
     std::vector<RenderMesh> result;
     auto texNames = m_map.TextureNames();
@@ -129,16 +160,43 @@ namespace quakelib {
         break;
       }
 
-      weldVertices(mesh, faces);
+      if (m_map.Config().mergeCoplanarFaces) {
+        AppendPolygons(mesh, merged[texID]);
+      } else {
+        weldVertices(mesh, faces);
+      }
       result.push_back(mesh);
     }
 
     // Phase 3: Generate lightmap UVs for all meshes
     generateLightmapUVs(result);
 
+    // Phase 4: Reorder for the vertex cache once the atlas has split the vertices it needs
+    if (m_map.Config().optimizeVertexCache) {
+      for (auto &mesh : result)
+        mesh.stats = OptimizeMesh(mesh, m_map.Config().optimizeOverdraw);
+    }
+
+    m_meshCache[mapEnt.get()] = result;
     return result;
   }
 
+  std::vector<EntityInstance> QMapProvider::GetEntityInstances() const {
+    std::vector<EntityInstance> instances;
+    const auto &entities = m_map.SolidEntities();
+    std::unordered_map<const map::SolidMapEntity *, uint32_t> indexOf;
+    for (size_t i = 0; i < entities.size(); i++)
+      indexOf[entities[i].get()] = (uint32_t)i;
+
+    for (size_t i = 0; i < entities.size(); i++) {
+      if (!entities[i]->Prototype())
+        continue;
+      uint32_t proto = indexOf[entities[i]->Prototype().get()];
+      instances.push_back({(uint32_t)i, proto, entities[i]->InstanceOffset()});
+    }
+    return instances;
+  }
+
   std::vector<std::string> QMapProvider::GetTextureNames() const { return m_map.TextureNames(); }
 
   std::vector<std::string> QMapProvider::GetRequiredWads() const {
@@ -206,6 +264,19 @@ namespace quakelib {
     }
   }
 
+  std::vector<MeshChunk> QMapProvider::GetEntityChunks(const SolidEntityPtr &entity) {
+    auto meshes = GetEntityMeshes(entity);
+    const auto &cfg = m_map.Config();
+    switch (cfg.chunkMode) {
+    case ChunkMode::GRID:
+      return ChunkMeshesGrid(meshes, cfg.chunkCellSize);
+    case ChunkMode::KDTREE:
+      return ChunkMeshesKdTree(meshes, cfg.chunkTriangleBudget);
+    default:
+      return ChunkMeshesGrid(meshes, 0);
+    }
+  }
+
   void QMapProvider::generateLightmapUVs(std::vector<RenderMesh> &meshes) {
     if (meshes.empty())
       return;
@@ -273,6 +344,7 @@ namespace quakelib {
 
   void
   QMapProvider::SetTextureBoundsProvider(std::function<std::pair<int, int>(const std::string &)> provider) {
+    m_meshCache.clear();
     m_map.RegisterTextureBounds([provider](const char *name) -> map::textureBounds {
       auto p = provider(name);
       return {(float)p.first, (float)p.second};
@@ -6,6 +6,7 @@
 #include <quakelib/bsp/qbsp_provider.h>
 #include <quakelib/map/lightmap_generator.h>
 #include <quakelib/map/qmap_provider.h>
+#include <quakelib/meshlet.h>
 #include <quakelib/wad/wad.h>
 
 // ============================================================================
@@ -58,6 +59,86 @@ static void FreeStringArray(char **arr, uint32_t count) {
   QLib_Free(arr);
 }
 
+// Instance record of every solid entity, nullptr for entities with their own geometry
+static std::vector<const quakelib::EntityInstance *>
+IndexInstances(const std::vector<quakelib::EntityInstance> &instances, size_t entityCount) {
+  std::vector<const quakelib::EntityInstance *> byEntity(entityCount, nullptr);
+  for (const auto &inst : instances) {
+    if (inst.entity < entityCount)
+      byEntity[inst.entity] = &inst;
+  }
+  return byEntity;
+}
+
+// Prototype and offset of an instanced map entity, -1 for entities with their own geometry
+static void ExportInstance(const quakelib::EntityInstance *inst, QLibMapEntityMesh &out) {
+  out.prototypeIndex = -1;
+  if (inst) {
+    out.prototypeIndex = static_cast<int32_t>(inst->prototype);
+    out.instanceOffset = ToQLibVec3(inst->offset);
+  }
+}
+
+// Meshlets of all submeshes, vertex indices match the entity mesh export
+static QLibMeshletData *ExportMeshlets(const std::vector<quakelib::RenderMesh> &meshes) {
+  std::vector<quakelib::MeshletData> built;
+  built.reserve(meshes.size());
+  uint32_t meshletCount = 0;
+  uint32_t vertexCount = 0;
+  uint32_t triangleCount = 0;
+  for (const auto &mesh : meshes) {
+    built.push_back(quakelib::BuildMeshlets(mesh));
+    meshletCount += static_cast<uint32_t>(built.back().meshlets.size());
+    vertexCount += static_cast<uint32_t>(built.back().vertices.size());
+    triangleCount += static_cast<uint32_t>(built.back().triangles.size() / 3);
+  }
+
+  auto *out = (QLibMeshletData *)QLib_Malloc(sizeof(QLibMeshletData));
+  std::memset(out, 0, sizeof(QLibMeshletData));
+  out->meshletCount = meshletCount;
+  out->vertexCount = vertexCount;
+  out->triangleCount = triangleCount;
+  if (meshletCount > 0)
+    out->meshlets = (QLibMeshlet *)QLib_Malloc(meshletCount * sizeof(QLibMeshlet));
+  if (vertexCount > 0)
+    out->vertices = (uint32_t *)QLib_Malloc(vertexCount * sizeof(uint32_t));
+  if (triangleCount > 0)
+    out->triangles = (uint8_t *)QLib_Malloc(triangleCount * 3);
+
+  uint32_t meshletOffset = 0;
+  uint32_t vertOffset = 0;
+  uint32_t localVertOffset = 0;
+  uint32_t triOffset = 0;
+  for (size_t i = 0; i < meshes.size(); i++) {
+    const auto &data = built[i];
+    for (const auto &m : data.meshlets) {
+      auto &dst = out->meshlets[meshletOffset++];
+      dst.submeshIndex = static_cast<uint32_t>(i);
+      dst.vertexOffset = localVertOffset + m.vertexOffset;
+      dst.vertexCount = m.vertexCount;
+      dst.triangleOffset = triOffset + m.triangleOffset;
+      dst.triangleCount = m.triangleCount;
+      dst.center = ToQLibVec3(m.center);
+      dst.radius = m.radius;
+      dst.coneApex = ToQLibVec3(m.coneApex);
+      dst.coneAxis = ToQLibVec3(m.coneAxis);
+      dst.coneCutoff = m.coneCutoff;
+    }
+
+    for (size_t j = 0; j < data.vertices.size(); j++) {
+      out->vertices[localVertOffset + j] = data.vertices[j] + vertOffset;
+    }
+    if (!data.triangles.empty())
+      std::memcpy(out->triangles + triOffset * 3, data.triangles.data(), data.triangles.size());
+
+    localVertOffset += static_cast<uint32_t>(data.vertices.size());
+    triOffset += static_cast<uint32_t>(data.triangles.size() / 3);
+    vertOffset += static_cast<uint32_t>(meshes[i].vertices.size());
+  }
+
+  return out;
+}
+
 static void ExportAttributes(const quakelib::Entity *entity, uint32_t *outCount, char ***outKeys,
                              char ***outValues) {
   const auto &attrs = entity->Attributes();
@@ -86,6 +167,23 @@ static void ExportAttributes(const quakelib::Entity *entity, uint32_t *outCount,
   }
 }
 
+// ============================================================================
+// Meshlet Implementation
+// ============================================================================
+
+API_EXPORT void QLib_FreeMeshlets(QLibMeshletData *data) {
+  if (!data)
+    return;
+
+  if (data->meshlets)
+    QLib_Free(data->meshlets);
+  if (data->vertices)
+    QLib_Free(data->vertices);
+  if (data->triangles)
+    QLib_Free(data->triangles);
+  QLib_Free(data);
+}
+
 // ============================================================================
 // WAD Implementation
 // ============================================================================
@@ -420,6 +518,19 @@ API_EXPORT QLibBspEntityMesh *QLibBsp_GetEntityMesh(void *bspPtr, uint32_t entit
   return outMesh;
 }
 
+API_EXPORT QLibMeshletData *QLibBsp_GetEntityMeshlets(void *bspPtr, uint32_t entityIndex) {
+  if (!bspPtr)
+    return nullptr;
+
+  auto *provider = static_cast<quakelib::QBspProvider *>(bspPtr);
+  auto solidEntities = provider->GetSolidEntities();
+
+  if (entityIndex >= solidEntities.size())
+    return nullptr;
+
+  return ExportMeshlets(provider->GetEntityMeshes(solidEntities[entityIndex]));
+}
+
 API_EXPORT void QLibBsp_FreeMesh(QLibBspEntityMesh *mesh) {
   if (!mesh)
     return;
@@ -584,6 +695,9 @@ API_EXPORT QLibMapData *QLibMap_ExportAll(void *mapPtr) {
   // Export solid entities
   data->solidEntityCount = static_cast<uint32_t>(solidEntities.size());
   if (data->solidEntityCount > 0) {
+    // looked up once, exporting instances per entity would rebuild the list for every entity
+    auto instances = provider->GetEntityInstances();
+    auto instanceOf = IndexInstances(instances, solidEntities.size());
     data->solidEntities =
         (QLibMapEntityMesh *)QLib_Malloc(data->solidEntityCount * sizeof(QLibMapEntityMesh));
 
@@ -667,6 +781,7 @@ API_EXPORT QLibMapData *QLibMap_ExportAll(void *mapPtr) {
       // Export attributes
       ExportAttributes(entity.get(), &outMesh.attributeCount, &outMesh.attributeKeys,
                        &outMesh.attributeValues);
+      ExportInstance(instanceOf[i], outMesh);
     }
   }
 
@@ -779,10 +894,25 @@ API_EXPORT QLibMapEntityMesh *QLibMap_GetEntityMesh(void *mapPtr, uint32_t entit
   // Export attributes
   ExportAttributes(entity.get(), &outMesh->attributeCount, &outMesh->attributeKeys,
                    &outMesh->attributeValues);
+  auto instances = provider->GetEntityInstances();
+  ExportInstance(IndexInstances(instances, solidEntities.size())[entityIndex], *outMesh);
 
   return outMesh;
 }
 
+API_EXPORT QLibMeshletData *QLibMap_GetEntityMeshlets(void *mapPtr, uint32_t entityIndex) {
+  if (!mapPtr)
+    return nullptr;
+
+  auto *provider = static_cast<quakelib::QMapProvider *>(mapPtr);
+  auto solidEntities = provider->GetSolidEntities();
+
+  if (entityIndex >= solidEntities.size())
+    return nullptr;
+
+  return ExportMeshlets(provider->GetEntityMeshes(solidEntities[entityIndex]));
+}
+
 API_EXPORT void QLibMap_SetFaceType(void *mapPtr, const char *textureName, uint8_t surfaceType) {
   if (!mapPtr || !textureName)
     return;
@@ -44,6 +44,35 @@ struct QLibVertex {
   QLibVec2 lightmapUV;
 };
 
+// ============================================================================
+// Meshlet API
+// ============================================================================
+
+struct QLibMeshlet {
+  uint32_t submeshIndex;   // Submesh of the entity mesh the meshlet belongs to
+  uint32_t vertexOffset;   // First entry in QLibMeshletData::vertices
+  uint32_t vertexCount;    // At most 64
+  uint32_t triangleOffset; // First triangle in QLibMeshletData::triangles
+  uint32_t triangleCount;  // At most 124
+  QLibVec3 center;         // Bounding sphere
+  float radius;
+  QLibVec3 coneApex; // Backfacing if dot(normalize(coneApex - camera), coneAxis) >= coneCutoff
+  QLibVec3 coneAxis;
+  float coneCutoff; // 1 when the meshlet can't be cone culled
+};
+
+struct QLibMeshletData {
+  uint32_t meshletCount;
+  uint32_t vertexCount;
+  uint32_t triangleCount;
+
+  QLibMeshlet *meshlets;
+  uint32_t *vertices; // Indices into the entity mesh vertex array
+  uint8_t *triangles; // 3 per triangle, indices into the meshlet's vertices
+};
+
+API_EXPORT void QLib_FreeMeshlets(QLibMeshletData *data);
+
 // ============================================================================
 // WAD API
 // ============================================================================
@@ -134,6 +163,7 @@ API_EXPORT void *QLibBsp_Load(const char *filePath, uint8_t loadTextures, uint8_
                               uint8_t convertToOpenGL);
 API_EXPORT QLibBspData *QLibBsp_ExportAll(void *bspPtr);
 API_EXPORT QLibBspEntityMesh *QLibBsp_GetEntityMesh(void *bspPtr, uint32_t entityIndex);
+API_EXPORT QLibMeshletData *QLibBsp_GetEntityMeshlets(void *bspPtr, uint32_t entityIndex);
 API_EXPORT void QLibBsp_FreeMesh(QLibBspEntityMesh *mesh);
 API_EXPORT void QLibBsp_FreeData(QLibBspData *data);
 API_EXPORT void QLibBsp_Destroy(void *bspPtr);
@@ -169,6 +199,10 @@ struct QLibMapEntityMesh {
   uint32_t attributeCount;
   char **attributeKeys;
   char **attributeValues;
+
+  // Instances have no vertices, draw the prototype entity's mesh moved by instanceOffset
+  int32_t prototypeIndex; // Solid entity index of the prototype, -1 if not an instance
+  QLibVec3 instanceOffset;
 };
 
 struct QLibMapPointEntity {
@@ -213,6 +247,7 @@ API_EXPORT void QLibMap_RegisterTextureSize(void *mapPtr, const char *textureNam
                                             uint32_t height);
 API_EXPORT QLibMapData *QLibMap_ExportAll(void *mapPtr);
 API_EXPORT QLibMapEntityMesh *QLibMap_GetEntityMesh(void *mapPtr, uint32_t entityIndex);
+API_EXPORT QLibMeshletData *QLibMap_GetEntityMeshlets(void *mapPtr, uint32_t entityIndex);
 API_EXPORT void QLibMap_SetFaceType(void *mapPtr, const char *textureName, uint8_t surfaceType);
 API_EXPORT void QLibMap_FreeMesh(QLibMapEntityMesh *mesh);
 API_EXPORT void QLibMap_FreeData(QLibMapData *data);
@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+"""Writes the box*.bsp test fixtures next to this script.
+
+A 256 unit room split into three leaves by two planes, with a 32 unit func_wall
+brush model in the middle, two textures, per-face lighting and a PVS.
+
+    python3 make_box_bsp.py            all fixtures
+    python3 make_box_bsp.py v29 split  box.bsp and box_split.bsp (also: bsp2, 2psb)
+
+box_split.bsp is box.bsp with the floor cut into two unlit faces sharing an
+edge. The output is deterministic, rerunning the script leaves the fixtures
+unchanged.
+"""
+import math
+import os
+import struct
+import sys
+
+ENTITIES = b'''{
+"classname" "worldspawn"
+"message" "box"
+"wad" "test.wad"
+}
+{
+"classname" "info_player_start"
+"origin" "-96 0 24"
+"angle" "0"
+}
+{
+"classname" "func_wall"
+"model" "*1"
+}
+{
+"classname" "light"
+"origin" "0 0 96"
+"light" "200"
+}
+\x00'''
+
+
+def build(FMT):
+    SPLIT=FMT=='split'
+    if SPLIT: FMT='v29'
+    planes=[]
+    def plane(n,d):
+        t = 0 if n==(1,0,0) else 1 if n==(0,1,0) else 2
+        planes.append((n,d,t)); return len(planes)-1
+    X,Y,Z=(1,0,0),(0,1,0),(0,0,1)
+    # world hull0
+    pw=[plane(X,-128),plane(X,128),plane(Y,-128),plane(Y,128),plane(Z,0),plane(Z,128)]
+    ps=[plane(X,-64),plane(X,64)]
+    pm=[plane(X,-16),plane(X,16),plane(Y,-16),plane(Y,16),plane(Z,0),plane(Z,32)]
+    def boxplanes(lo,hi):
+        return [plane(X,lo[0]),plane(X,hi[0]),plane(Y,lo[1]),plane(Y,hi[1]),plane(Z,lo[2]),plane(Z,hi[2])]
+    # hulls: hull1 mins(-16,-16,-24) maxs(16,16,32); hull2 mins(-32,-32,-24) maxs(32,32,64)
+    h1w=boxplanes((-112,-112,24),(112,112,96))
+    h2w=boxplanes((-96,-96,24),(96,96,64))
+    h1m=boxplanes((-32,-32,-32),(32,32,56))
+    h2m=boxplanes((-48,-48,-64),(48,48,56))
+
+    verts=[];vidx={}
+    def V(p):
+        if p not in vidx: vidx[p]=len(verts); verts.append(p)
+        return vidx[p]
+    edges=[(0,0)];surfedges=[];faces=[];lighting=bytearray()
+    texinfos=[]
+    def texinfo(u,v,tex):
+        texinfos.append((u,0.0,v,0.0,tex,0)); return len(texinfos)-1
+    ti={}
+    for tex in (0,1):
+        ti[(tex,0)]=texinfo((0,1,0),(0,0,-1),tex)
+        ti[(tex,1)]=texinfo((1,0,0),(0,0,-1),tex)
+        ti[(tex,2)]=texinfo((1,0,0),(0,-1,0),tex)
+    def sub(a,b): return tuple(x-y for x,y in zip(a,b))
+    def cross(a,b): return (a[1]*b[2]-a[2]*b[1],a[2]*b[0]-a[0]*b[2],a[0]*b[1]-a[1]*b[0])
+    def dot(a,b): return sum(x*y for x,y in zip(a,b))
+    def face(pts,normal,planeid,tex,light):
+        # quake winding: clockwise seen from the front, normal = (p0-p1)x(p2-p1)
+        n=cross(sub(pts[0],pts[1]),sub(pts[2],pts[1]))
+        if dot(n,normal)<0: pts=pts[::-1]
+        pn=planes[planeid][0]
+        side=0 if dot(pn,normal)>0 else 1
+        axis=[abs(c) for c in normal].index(1)
+        t=ti[(tex,axis)]
+        first=len(surfedges)
+        for i in range(len(pts)):
+            a=V(pts[i]);b=V(pts[(i+1)%len(pts)])
+            edges.append((a,b)); surfedges.append(len(edges)-1)
+        u,_,v,_,_,_=texinfos[t]
+        mins=[min(dot(p,ax) for p in pts) for ax in (u,v)]
+        maxs=[max(dot(p,ax) for p in pts) for ax in (u,v)]
+        ext=[(math.ceil(maxs[i]/16)-math.floor(mins[i]/16))*16 for i in range(2)]
+        smax=ext[0]//16+1; tmax=ext[1]//16+1
+        ofs=len(lighting)
+        if light is None:
+            ofs=-1
+        else:
+            for j in range(tmax):
+                for i in range(smax):
+                    lighting.append((light+i*3+j*5)%256)
+        faces.append((planeid,side,first,len(pts),t,bytes([0,255,255,255]) if light is not None else bytes([255]*4),ofs))
+        return len(faces)-1
+    def boxfaces(lo,hi,inward,pl,tex,light,split=False):
+        x0,y0,z0=lo;x1,y1,z1=hi
+        s=1 if inward else -1
+        quads=[
+         ([(x0,y0,z0),(x0,y1,z0),(x0,y1,z1),(x0,y0,z1)],(s,0,0),pl[0]),
+         ([(x1,y0,z0),(x1,y1,z0),(x1,y1,z1),(x1,y0,z1)],(-s,0,0),pl[1]),
+         ([(x0,y0,z0),(x1,y0,z0),(x1,y0,z1),(x0,y0,z1)],(0,s,0),pl[2]),
+         ([(x0,y1,z0),(x1,y1,z0),(x1,y1,z1),(x0,y1,z1)],(0,-s,0),pl[3]),
+         ([(x0,y0,z0),(x1,y0,z0),(x1,y1,z0),(x0,y1,z0)],(0,0,s),pl[4]),
+         ([(x0,y0,z1),(x1,y0,z1),(x1,y1,z1),(x0,y1,z1)],(0,0,-s),pl[5])]
+        if split:
+            # the floor as two unlit halves sharing the x=0 edge, like a liquid surface cut by the bsp
+            p,n,pid=quads[4]
+            halves=[[(x0,y0,z0),(0,y0,z0),(0,y1,z0),(x0,y1,z0)],[(0,y0,z0),(x1,y0,z0),(x1,y1,z0),(0,y1,z0)]]
+            res=[face(q,n,pid,tex,light+k*20) for k,(q,n,pid) in enumerate(quads[:4])]
+            res+=[face(h,n,pid,tex,None) for h in halves]
+            res.append(face(quads[5][0],quads[5][1],quads[5][2],tex,light+100))
+            return res
+        return [face(p,n,pid,tex,light+k*20) for k,(p,n,pid) in enumerate(quads)]
+    wf=boxfaces((-128,-128,0),(128,128,128),True,pw,0,60,SPLIT)
+    NF=2 if SPLIT else 1
+    FL=wf[4]; CE=wf[-1]
+    mf=boxfaces((-16,-16,0),(16,16,32),False,pm,1,150)
+    # nodes: planenum, front, back, mins, maxs, firstface, numfaces ; leaf child = ~leaf
+    L=lambda i:~i
+    WB=((-128,-128,0),(128,128,128)); MB=((-16,-16,0),(16,16,32))
+    nodes=[
+     (pw[0],1,L(0),WB,wf[0],1),
+     (pw[1],L(0),2,WB,wf[1],1),
+     (pw[2],3,L(0),WB,wf[2],1),
+     (pw[3],L(0),4,WB,wf[3],1),
+     (pw[4],5,L(0),WB,FL,NF),
+     (pw[5],L(0),6,WB,CE,1),
+     (ps[0],7,L(1),WB,0,0),
+     (ps[1],L(3),L(2),((-64,-128,0),(128,128,128)),0,0),
+     (pm[0],9,L(0),MB,mf[0],1),
+     (pm[1],L(0),10,MB,mf[1],1),
+     (pm[2],11,L(0),MB,mf[2],1),
+     (pm[3],L(0),12,MB,mf[3],1),
+     (pm[4],13,L(0),MB,mf[4],1),
+     (pm[5],L(0),L(0),MB,mf[5],1),
+    ]
+    EMPTY,SOLID=-1,-2
+    def clipchain(pl,inside_front_first,inner,outer):
+        # box: inside is front of lo planes, back of hi planes
+        res=[]
+        base=len(clipnodes)
+        for k in range(6):
+            nxt=base+k+1 if k<5 else inner
+            if k%2==0: res.append((pl[k],nxt,outer))
+            else: res.append((pl[k],outer,nxt))
+        clipnodes.extend(res); return base
+    clipnodes=[]
+    c1w=clipchain(h1w,True,EMPTY,SOLID)
+    c2w=clipchain(h2w,True,EMPTY,SOLID)
+    c1m=clipchain(h1m,True,SOLID,EMPTY)
+    c2m=clipchain(h2m,True,SOLID,EMPTY)
+    # leaves
+    marks=[]
+    def leafmarks(l):
+        s=len(marks); marks.extend(l); return s,len(l)
+    FLS=wf[4:4+NF]
+    lm1=leafmarks([wf[0],wf[2],wf[3],*FLS,CE])
+    lm2=leafmarks([wf[2],wf[3],*FLS,CE])
+    lm3=leafmarks([wf[1],wf[2],wf[3],*FLS,CE])
+    vis=bytes([0x03,0x07,0x06])
+    leaves=[
+     (SOLID,-1,((0,0,0),(0,0,0)),0,0),
+     (EMPTY,0,((-128,-128,0),(-64,128,128)),*lm1),
+     (EMPTY,1,((-64,-128,0),(64,128,128)),*lm2),
+     (EMPTY,2,((64,-128,0),(128,128,128)),*lm3),
+    ]
+    models=[
+     (WB,(0,0,0),(0,c1w,c2w,0),3,0,len(wf)),
+     (MB,(0,0,0),(8,c1m,c2m,0),0,len(wf),6),
+    ]
+    # textures
+    def miptex(name,w,h,seed):
+        data=bytearray()
+        for lvl in range(4):
+            lw,lh=w>>lvl,h>>lvl
+            for j in range(lh):
+                for i in range(lw): data.append((seed+i+j*7)%256)
+        hdr=struct.pack('<16sII4I',name.encode(),w,h,40,40+w*h,40+w*h+(w*h)//4,40+w*h+(w*h)//4+(w*h)//16)
+        return hdr+bytes(data)
+    texs=[miptex('wall',64,64,10),miptex('crate',32,32,90)]
+    texlump=struct.pack('<i',len(texs))
+    off=4+4*len(texs)
+    offs=[]
+    for t in texs: offs.append(off); off+=len(t)
+    texlump+=struct.pack('<%di'%len(texs),*offs)+b''.join(texs)
+    ents=ENTITIES
+    lumps=[None]*15
+    lumps[0]=ents
+    lumps[1]=b''.join(struct.pack('<4fi',*n,d,t) for n,d,t in planes)
+    lumps[2]=texlump
+    lumps[3]=b''.join(struct.pack('<3f',*v) for v in verts)
+    lumps[4]=vis
+    if FMT=='v29': lumps[5]=b''.join(struct.pack('<ihh6hHH',p,f,b,*mn,*mx,ff,fn) for p,f,b,(mn,mx),ff,fn in nodes)
+    elif FMT=='2psb': lumps[5]=b''.join(struct.pack('<iii6hII',p,f,b,*mn,*mx,ff,fn) for p,f,b,(mn,mx),ff,fn in nodes)
+    else: lumps[5]=b''.join(struct.pack('<iii6fII',p,f,b,*mn,*mx,ff,fn) for p,f,b,(mn,mx),ff,fn in nodes)
+    lumps[6]=b''.join(struct.pack('<8fii',*u,uo,*v,vo,t,fl) for u,uo,v,vo,t,fl in texinfos)
+    lumps[7]=b''.join(struct.pack('<HHiHH4si' if FMT=='v29' else '<iiiii4si',p,s,fe,ne,t,st,lo) for p,s,fe,ne,t,st,lo in faces)
+    lumps[8]=bytes(lighting)
+    lumps[9]=b''.join(struct.pack('<ihh' if FMT=='v29' else '<iii',p,f,b) for p,f,b in clipnodes)
+    LF={'v29':'<ii6hHH4B','2psb':'<ii6hII4B','bsp2':'<ii6fII4B'}[FMT]
+    lumps[10]=b''.join(struct.pack(LF,c,v,*mn,*mx,fm,nm,0,0,0,0) for c,v,(mn,mx),fm,nm in leaves)
+    lumps[11]=b''.join(struct.pack('<H' if FMT=='v29' else '<I',m) for m in marks)
+    lumps[12]=b''.join(struct.pack('<HH' if FMT=='v29' else '<II',a,b) for a,b in edges)
+    lumps[13]=b''.join(struct.pack('<i',e) for e in surfedges)
+    lumps[14]=b''.join(struct.pack('<9f7i',*mn,*mx,*o,*h,vl,ff,fn) for (mn,mx),o,h,vl,ff,fn in models)
+    out=bytearray(4+15*8)
+    dir_=[]
+    for l in lumps:
+        while len(out)%4: out.append(0)
+        dir_.append((len(out),len(l))); out+=l
+    if FMT=='v29': struct.pack_into('<i',out,0,29)
+    else: out[0:4]=b'BSP2' if FMT=='bsp2' else b'2PSB'
+    for i,(o,l) in enumerate(dir_): struct.pack_into('<ii',out,4+i*8,o,l)
+    name='box_split.bsp' if SPLIT else {'v29':'box.bsp','bsp2':'box_bsp2.bsp','2psb':'box_2psb.bsp'}[FMT]
+    open(os.path.join(os.path.dirname(os.path.abspath(__file__)),name),'wb').write(out)
+    print(name,len(out),'bytes',len(verts),'verts',len(faces),'faces',len(planes),'planes')
+
+
+if __name__ == '__main__':
+    for fmt in sys.argv[1:] or ['v29', 'bsp2', '2psb', 'split']:
+        build(fmt)
@@ -1,4 +1,12 @@
 #include "../inc/bsp_dummy.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <quakelib/bsp/draw_list.h>
+#include <quakelib/bsp/qbsp.h>
+#include <quakelib/bsp/qbsp_provider.h>
 #include <quakelib/entity_parser.h>
 #include <snitch/snitch.hpp>
 
@@ -43,4 +51,858 @@ TEST_CASE("parse bsp entities", "[bsp/entities]") {
   REQUIRE(point_hits == POINT_COUNT);
   REQUIRE(solid_hits == SOLID_COUNT);
   REQUIRE(worldspawn_hits == WORLDSPAWN_COUNT);
-}
\ No newline at end of file
+}
+
+// box.bsp: a 256x256x128 room split into three leaves, with a 32 unit func_wall cube (*1) in the middle
+static constexpr const char *bspPath = "tests/data/box.bsp";
+
+TEST_CASE("load bsp lumps", "[bsp/file]") {
+  for (bool memoryMap : {false, true}) {
+    bsp::QBspConfig cfg;
+    cfg.memoryMap = memoryMap;
+    bsp::QBsp bsp(cfg);
+    REQUIRE(bsp.LoadFile(bspPath) == bsp::QBSP_OK);
+
+    const auto &content = bsp.Content();
+    REQUIRE(content.models.size() == 2);
+    REQUIRE(content.faces.size() == 12);
+    REQUIRE(content.leafs.size() == 4);
+    REQUIRE(content.nodes.size() == 14);
+    REQUIRE(content.visibility.size() == 3);
+    REQUIRE(content.lighting.size() > 0);
+
+    REQUIRE(bsp.SolidEntities().size() == 2);
+    REQUIRE(bsp.PointEntities().size() == 2);
+    REQUIRE(bsp.WorldSpawn()->Faces().size() == 6);
+
+    REQUIRE(bsp.Textures().size() == 2);
+    CHECK(bsp.Textures()[0].name == "wall");
+    REQUIRE(bsp.Textures()[0].hasData);
+    CHECK(bsp.Textures()[0].data[0] == 10);
+  }
+}
+
+TEST_CASE("load extended limit bsp formats", "[bsp/file]") {
+  bsp::QBsp reference;
+  REQUIRE(reference.LoadFile(bspPath) == bsp::QBSP_OK);
+  CHECK(reference.Version() == bsp::MAGIC_V29);
+
+  // box.bsp written with 32-bit indices, float bounds (BSP2) and short bounds (2PSB)
+  const std::pair<const char *, uint32_t> formats[] = {{"tests/data/box_bsp2.bsp", bsp::MAGIC_BSP2},
+                                                       {"tests/data/box_2psb.bsp", bsp::MAGIC_2PSB}};
+  for (const auto &[path, version] : formats) {
+    bsp::QBsp bsp;
+    REQUIRE(bsp.LoadFile(path) == bsp::QBSP_OK);
+    CHECK(bsp.Version() == version);
+
+    const auto &content = bsp.Content();
+    REQUIRE(content.faces.size() == reference.Content().faces.size());
+    REQUIRE(content.nodes.size() == reference.Content().nodes.size());
+    REQUIRE(content.clipNodes.size() == reference.Content().clipNodes.size());
+    CHECK(content.nodes[6].back == -2);
+    CHECK(content.leafs[3].bound.min.x == 64.0f);
+
+    // the lumps iterate like the vectors they replaced, with widened elements
+    static_assert(std::random_access_iterator<bsp::LumpView<bsp::fFace_t>::const_iterator>);
+    size_t index = 0;
+    for (const auto &face : content.faces)
+      CHECK(face.plane_id == reference.Content().faces[index++].plane_id);
+    CHECK(index == content.faces.size());
+    CHECK(std::ranges::equal(content.markSurfaces, reference.Content().markSurfaces));
+    auto back = std::find_if(content.nodes.begin(), content.nodes.end(), [](const bsp::fNode_t &n) {
+      return n.back == -2;
+    });
+    REQUIRE(back != content.nodes.end());
+    CHECK(back - content.nodes.begin() <= 6);
+    CHECK((*back).back == -2);
+
+    const auto &faces = bsp.WorldSpawn()->Faces();
+    const auto &refFaces = reference.WorldSpawn()->Faces();
+    REQUIRE(faces.size() == refFaces.size());
+    for (size_t i = 0; i < faces.size(); i++) {
+      REQUIRE(faces[i]->verts.size() == refFaces[i]->verts.size());
+      for (size_t v = 0; v < faces[i]->verts.size(); v++) {
+        CHECK(faces[i]->verts[v].point.x == refFaces[i]->verts[v].point.x);
+        CHECK(faces[i]->verts[v].lm_uv.y == refFaces[i]->verts[v].lm_uv.y);
+      }
+    }
+
+    REQUIRE(bsp.LightMap() != nullptr);
+    CHECK(bsp.LightMap()->Width() == reference.LightMap()->Width());
+    CHECK(bsp.Vis().VisibleSurfaces(3) == reference.Vis().VisibleSurfaces(3));
+    CHECK(bsp.Tree().PointInLeaf({96, 0, 24}) == 3);
+    CHECK(bsp.Collision().Trace({0, 0, 48}, {0, 0, -100}, 1).planeDist == 24.0f);
+  }
+}
+
+TEST_CASE("bsp surface store", "[bsp/file]") {
+  bsp::QBsp bsp;
+  REQUIRE(bsp.LoadFile(bspPath) == bsp::QBSP_OK);
+
+  for (const auto &ent : bsp.SolidEntities()) {
+    const auto &faces = ent->Faces();
+    const auto *store = ent->Surfaces();
+    REQUIRE(store != nullptr);
+    REQUIRE(store->surfaces.size() == faces.size());
+    REQUIRE(store->vertices.size() == faces.size() * 4);
+    REQUIRE(store->indices.size() == faces.size() * 6);
+
+    // every face is a slice of the model arrays, back to back in face order
+    size_t vertOfs = 0, indexOfs = 0;
+    for (const auto &face : faces) {
+      CHECK(face->verts.data() == store->vertices.data() + vertOfs);
+      CHECK(face->indices.data() == store->indices.data() + indexOfs);
+      CHECK(face->firstVertex == vertOfs);
+      CHECK(face->firstIndex == indexOfs);
+      vertOfs += face->verts.size();
+      indexOfs += face->indices.size();
+    }
+  }
+
+  // faces keep the store alive on their own
+  bsp::SurfacePtr face;
+  {
+    bsp::QBsp scoped;
+    REQUIRE(scoped.LoadFile(bspPath) == bsp::QBSP_OK);
+    face = scoped.WorldSpawn()->Faces()[4];
+  }
+  CHECK(face->verts.size() == 4);
+  CHECK(face->verts[0].point.z == 0.0f);
+}
+
+TEST_CASE("bsp degenerate face", "[bsp/file]") {
+  bsp::fPlane_t plane = {{0, 0, 1}, 0, 0};
+  bsp::fSurfaceInfo_t info = {{1, 0, 0}, 0, {0, 1, 0}, 0, 0, 0};
+  bsp::fFace_t face = {0, 0, 0, 0, 0, {255, 255, 255, 255}, -1};
+
+  bsp::bspFileContent ctx = {};
+  ctx.planes = std::span(&plane, 1);
+  ctx.surfaces = std::span(&info, 1);
+  ctx.miptextures.push_back({"degenerate", 16, 16, {}});
+
+  // a face without edges builds no triangles and an empty lightmap
+  bsp::Surface surf;
+  surf.Build(ctx, face, {}, {});
+  CHECK(surf.verts.empty());
+  CHECK(surf.indices.empty());
+  CHECK(surf.extents[0] == 0);
+  CHECK(surf.extents[1] == 0);
+
+  // a two edge face in a file gets no vertices, the meshes only hold referenced ones
+  std::ifstream in(bspPath, std::ios::binary);
+  std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  REQUIRE(data.size() > sizeof(bsp::header_t));
+  bsp::header_t header;
+  memcpy(&header, data.data(), sizeof(header));
+  uint16_t edges = 2;
+  memcpy(data.data() + header.lump[bsp::LUMP_FACES].offset + offsetof(bsp::fFace29_t, ledge_num), &edges,
+         sizeof(edges));
+
+  auto path = std::filesystem::temp_directory_path() / "quakelib_degenerate.bsp";
+  std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+  bsp::QBsp bsp;
+  REQUIRE(bsp.LoadFile(path.string().c_str()) == bsp::QBSP_OK);
+  QBspProvider provider;
+  REQUIRE(provider.Load(path.string()));
+  std::filesystem::remove(path);
+
+  CHECK(bsp.WorldSpawn()->Faces()[0]->verts.empty());
+  for (const auto &m : provider.GetEntityMeshes(provider.GetSolidEntities()[0])) {
+    std::vector<bool> used(m.vertices.size());
+    for (uint32_t idx : m.indices)
+      used[idx] = true;
+    CHECK(std::count(used.begin(), used.end(), false) == 0);
+  }
+}
+
+TEST_CASE("parallel bsp loading", "[bsp/file]") {
+  bsp::QBspConfig cfg;
+  cfg.parallelLoad = true;
+  cfg.convertCoordToOGL = true;
+  // the fixture has 12 faces, one item per chunk spreads them over the workers
+  cfg.parallelChunkSize = 1;
+  bsp::QBsp parallel(cfg);
+  REQUIRE(parallel.LoadFile(bspPath) == bsp::QBSP_OK);
+
+  cfg.parallelLoad = false;
+  bsp::QBsp serial(cfg);
+  REQUIRE(serial.LoadFile(bspPath) == bsp::QBSP_OK);
+
+  REQUIRE(parallel.Textures().size() == serial.Textures().size());
+  for (size_t i = 0; i < serial.Textures().size(); i++) {
+    CHECK(parallel.Textures()[i].name == serial.Textures()[i].name);
+    const auto &a = parallel.Textures()[i];
+    REQUIRE(a.hasData);
+    CHECK(memcmp(a.data, serial.Textures()[i].data, a.width * a.height) == 0);
+  }
+
+  REQUIRE(parallel.SolidEntities().size() == serial.SolidEntities().size());
+  for (size_t e = 0; e < serial.SolidEntities().size(); e++) {
+    const auto *a = parallel.SolidEntities()[e]->Surfaces();
+    const auto *b = serial.SolidEntities()[e]->Surfaces();
+    REQUIRE(a->vertices.size() == b->vertices.size());
+    CHECK(a->indices == b->indices);
+    for (size_t v = 0; v < a->vertices.size(); v++) {
+      CHECK(a->vertices[v].point.y == b->vertices[v].point.y);
+      CHECK(a->vertices[v].uv.x == b->vertices[v].uv.x);
+      CHECK(a->vertices[v].lm_uv.x == b->vertices[v].lm_uv.x);
+    }
+  }
+}
+
+TEST_CASE("reject broken bsp files", "[bsp/file]") {
+  bsp::QBsp missing;
+  CHECK(missing.LoadFile("tests/data/does_not_exist.bsp") == bsp::QBSP_ERR_OPEN_FAILED);
+
+  std::ifstream in(bspPath, std::ios::binary);
+  std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  REQUIRE(data.size() > sizeof(bsp::header_t));
+
+  // point the face lump past the end of the file
+  bsp::header_t header;
+  memcpy(&header, data.data(), sizeof(header));
+  header.lump[bsp::LUMP_FACES].offset = data.size();
+  memcpy(data.data(), &header, sizeof(header));
+
+  auto path = std::filesystem::temp_directory_path() / "quakelib_corrupt.bsp";
+  std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+
+  bsp::QBsp corrupt;
+  CHECK(corrupt.LoadFile(path.string().c_str()) == bsp::QBSP_ERR_CORRUPT_LUMP);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("lazy bsp loading", "[bsp/file]") {
+  bsp::QBspConfig cfg;
+  cfg.lazyLoad = true;
+  bsp::QBsp lazy(cfg);
+  REQUIRE(lazy.LoadFile(bspPath) == bsp::QBSP_OK);
+
+  // entities are available right away
+  REQUIRE(lazy.SolidEntities().size() == 2);
+  REQUIRE(lazy.PointEntities().size() == 2);
+  CHECK(lazy.WorldSpawn()->AttributeStr("message") == "box");
+
+  bsp::QBsp eager;
+  REQUIRE(eager.LoadFile(bspPath) == bsp::QBSP_OK);
+
+  // the first geometry request builds every model and packs the lightmap
+  const auto &lazyFaces = lazy.WorldSpawn()->Faces();
+  const auto &eagerFaces = eager.WorldSpawn()->Faces();
+  REQUIRE(lazyFaces.size() == eagerFaces.size());
+  for (size_t i = 0; i < lazyFaces.size(); i++) {
+    REQUIRE(lazyFaces[i]->verts.size() == eagerFaces[i]->verts.size());
+    for (size_t v = 0; v < lazyFaces[i]->verts.size(); v++) {
+      CHECK(lazyFaces[i]->verts[v].point.x == eagerFaces[i]->verts[v].point.x);
+      CHECK(lazyFaces[i]->verts[v].lm_uv.x == eagerFaces[i]->verts[v].lm_uv.x);
+      CHECK(lazyFaces[i]->verts[v].lm_uv.y == eagerFaces[i]->verts[v].lm_uv.y);
+    }
+  }
+
+  REQUIRE(lazy.LightMap() != nullptr);
+  CHECK(lazy.LightMap()->Width() == eager.LightMap()->Width());
+  REQUIRE(lazy.Textures().size() == eager.Textures().size());
+  CHECK(lazy.Textures()[1].name == "crate");
+
+  // the tree is built on first use and answers like the eager one
+  CHECK(lazy.Tree().PointInLeaf({0, 0, 24}) == eager.Tree().PointInLeaf({0, 0, 24}));
+  CHECK(lazy.Vis().PointInLeaf({0, 0, 24}) == eager.Vis().PointInLeaf({0, 0, 24}));
+
+  // an entity outliving its QBsp no longer requests geometry
+  bsp::SolidEntityPtr orphan;
+  {
+    bsp::QBsp scoped(cfg);
+    REQUIRE(scoped.LoadFile(bspPath) == bsp::QBSP_OK);
+    orphan = scoped.WorldSpawn();
+  }
+  CHECK(orphan->Faces().empty());
+}
+
+TEST_CASE("bsp lightmap packing", "[bsp/lightmap]") {
+  struct Placed {
+    int page, x, y, w, h;
+  };
+
+  auto collect = [](const bsp::QBsp &bsp) {
+    std::vector<Placed> placed = {{0, 0, 0, 2, 1}}; // reserved texels
+    for (const auto &ent : bsp.SolidEntities()) {
+      for (const auto &face : ent->Faces()) {
+        if (!face->lm_samples)
+          continue;
+        placed.push_back({face->lm_tex_num, face->lm_s, face->lm_t, (face->extents[0] >> 4) + 1,
+                          (face->extents[1] >> 4) + 1});
+      }
+    }
+    return placed;
+  };
+
+  auto checkLayout = [](const bsp::Lightmap *lm, const std::vector<Placed> &placed) {
+    for (size_t i = 0; i < placed.size(); i++) {
+      const auto &a = placed[i];
+      CHECK(a.page < lm->Pages());
+      CHECK(a.x + a.w <= lm->Width());
+      CHECK(a.y + a.h <= lm->PageHeight());
+      for (size_t j = i + 1; j < placed.size(); j++) {
+        const auto &b = placed[j];
+        bool overlap = a.page == b.page && a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h &&
+                       b.y < a.y + a.h;
+        CHECK(!overlap);
+      }
+    }
+  };
+
+  bsp::QBsp tight;
+  REQUIRE(tight.LoadFile(bspPath) == bsp::QBSP_OK);
+  const auto *lm = tight.LightMap();
+  REQUIRE(lm != nullptr);
+  CHECK(lm->Pages() == 1);
+  CHECK(lm->Height() == lm->PageHeight());
+  // the old allocator always produced 256x256 blocks
+  CHECK(lm->Width() * lm->Height() < 256 * 256);
+  CHECK(lm->RGBA().size() == (size_t)(lm->Width() * lm->Height()));
+
+  auto placed = collect(tight);
+  REQUIRE(placed.size() == 13);
+  checkLayout(lm, placed);
+
+  // samples land at the packed position and the uvs stay inside the page
+  for (const auto &face : tight.WorldSpawn()->Faces()) {
+    const auto &texel = lm->RGBA()[face->lm_t * lm->Width() + face->lm_s];
+    CHECK(texel.r == face->lm_samples[0]);
+    for (const auto &v : face->verts) {
+      CHECK(v.lm_uv.x > 0.0f);
+      CHECK(v.lm_uv.x < 1.0f);
+      CHECK(v.lm_uv.y > 0.0f);
+      CHECK(v.lm_uv.y < 1.0f);
+    }
+  }
+
+  bsp::QBspConfig cfg;
+  cfg.lightmapPageSize = 24;
+  bsp::QBsp paged(cfg);
+  REQUIRE(paged.LoadFile(bspPath) == bsp::QBSP_OK);
+  lm = paged.LightMap();
+  REQUIRE(lm != nullptr);
+  CHECK(lm->Pages() > 1);
+  CHECK(lm->Width() <= 24);
+  CHECK(lm->PageHeight() <= 24);
+  CHECK(lm->Height() == lm->Pages() * lm->PageHeight());
+  checkLayout(lm, collect(paged));
+
+  for (const auto &face : paged.WorldSpawn()->Faces()) {
+    int row = face->lm_tex_num * lm->PageHeight() + face->lm_t;
+    CHECK(lm->RGBA()[row * lm->Width() + face->lm_s].r == face->lm_samples[0]);
+  }
+}
+
+TEST_CASE("bsp lightmap styles", "[bsp/lightmap]") {
+  std::ifstream in(bspPath, std::ios::binary);
+  std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  REQUIRE(data.size() > sizeof(bsp::header_t));
+
+  // give the first face a second layer on style 5, its samples are the ones of the next face
+  bsp::header_t header;
+  memcpy(&header, data.data(), sizeof(header));
+  data[header.lump[bsp::LUMP_FACES].offset + offsetof(bsp::fFace29_t, light) + 1] = 5;
+
+  auto path = std::filesystem::temp_directory_path() / "quakelib_styles.bsp";
+  std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+  bsp::QBsp bsp;
+  REQUIRE(bsp.LoadFile(path.string().c_str()) == bsp::QBSP_OK);
+  std::filesystem::remove(path);
+
+  auto *lm = bsp.LightMap();
+  REQUIRE(lm != nullptr);
+  const auto &faces = bsp.WorldSpawn()->Faces();
+  auto texel = [&](const bsp::SurfacePtr &face) {
+    return lm->RGBA()[(face->lm_tex_num * lm->PageHeight() + face->lm_t) * lm->Width() + face->lm_s];
+  };
+
+  int area = ((faces[0]->extents[0] >> 4) + 1) * ((faces[0]->extents[1] >> 4) + 1);
+  int base = faces[0]->lm_samples[0];
+  int layer = faces[0]->lm_samples[area * 3];
+  CHECK(texel(faces[0]).r == std::min(base + layer, 255));
+  CHECK(texel(faces[1]).r == faces[1]->lm_samples[0]);
+
+  // nothing changed, nothing is rewritten
+  std::vector<int> values(6, 256);
+  CHECK(lm->UpdateStyles(values).empty());
+
+  // only the face using style 5 is recomposited
+  values[5] = 0;
+  const auto &dirty = lm->UpdateStyles(values);
+  REQUIRE(dirty.size() == 1);
+  CHECK(dirty[0].x == faces[0]->lm_s);
+  CHECK(dirty[0].y == faces[0]->lm_t);
+  CHECK(dirty[0].width == (faces[0]->extents[0] >> 4) + 1);
+  CHECK(texel(faces[0]).r == base);
+  CHECK(lm->StyleValue(5) == 0);
+
+  // style 0 is used by every lit face
+  values[0] = 128;
+  CHECK(lm->UpdateStyles(values).size() == 12);
+  CHECK(texel(faces[1]).r == faces[1]->lm_samples[0] / 2);
+
+  // a lightmap without lit surfaces has nothing to update
+  bsp::Lightmap empty(nullptr, 0);
+  empty.PackLitSurfaces({});
+  CHECK(empty.UpdateStyles(values).empty());
+
+  CHECK(bsp::Lightmap::EvaluateStyle("", 3.0f) == 256);
+  CHECK(bsp::Lightmap::EvaluateStyle("am", 0.0f) == 0);
+  CHECK(bsp::Lightmap::EvaluateStyle("am", 0.15f) == 264);
+}
+
+TEST_CASE("bsp luminance lightmap", "[bsp/lightmap]") {
+  bsp::QBsp rgba;
+  REQUIRE(rgba.LoadFile(bspPath) == bsp::QBSP_OK);
+
+  bsp::QBspConfig cfg;
+  cfg.luminanceLightmap = true;
+  bsp::QBsp grey(cfg);
+  REQUIRE(grey.LoadFile(bspPath) == bsp::QBSP_OK);
+
+  const auto *a = rgba.LightMap();
+  const auto *b = grey.LightMap();
+  REQUIRE(a != nullptr);
+  REQUIRE(b != nullptr);
+  CHECK(a->Channels() == 4);
+  CHECK(b->Channels() == 1);
+  CHECK(b->RGBA().empty());
+  REQUIRE(b->Width() == a->Width());
+  REQUIRE(b->Height() == a->Height());
+  REQUIRE(b->Data().size() == (size_t)(b->Width() * b->Height()));
+  CHECK(a->Data().size() == b->Data().size() * 4);
+
+  // same layout, every texel holds the red channel of the RGBA atlas
+  for (size_t i = 0; i < b->Data().size(); i++) {
+    CHECK(b->Data()[i] == a->RGBA()[i].r);
+  }
+
+  QBspProvider provider;
+  REQUIRE(provider.Load(bspPath, cfg));
+  auto view = provider.GetLightmapView();
+  REQUIRE(view.has_value());
+  CHECK(view->channels == 1);
+  CHECK(view->data.data() == provider.GetLightmapView()->data.data());
+  auto copy = provider.GetLightmapData();
+  REQUIRE(copy.has_value());
+  CHECK(copy->channels == 1);
+  CHECK(copy->data.size() == view->data.size());
+}
+
+TEST_CASE("bsp lit file lightmap", "[bsp/lightmap]") {
+  bsp::QBsp grey;
+  REQUIRE(grey.LoadFile(bspPath) == bsp::QBSP_OK);
+
+  // a .lit next to a copy of the map, red only, with the grey samples of the lighting lump
+  auto path = std::filesystem::temp_directory_path() / "quakelib_lit.bsp";
+  std::filesystem::copy_file(bspPath, path, std::filesystem::copy_options::overwrite_existing);
+  auto litPath = std::filesystem::path(path).replace_extension(".lit");
+  {
+    std::ofstream lit(litPath, std::ios::binary);
+    int32_t version = 1;
+    lit.write("QLIT", 4);
+    lit.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    for (uint8_t d : grey.Content().lighting) {
+      const char rgb[3] = {static_cast<char>(d), 0, 0};
+      lit.write(rgb, 3);
+    }
+  }
+  bsp::QBsp colored;
+  REQUIRE(colored.LoadFile(path.string().c_str()) == bsp::QBSP_OK);
+  std::filesystem::remove(path);
+  std::filesystem::remove(litPath);
+
+  const auto *a = grey.LightMap();
+  const auto *b = colored.LightMap();
+  REQUIRE(a != nullptr);
+  REQUIRE(b != nullptr);
+  REQUIRE(b->RGBA().size() == a->RGBA().size());
+  // texel 0 is the reserved grey texel of both atlases
+  for (size_t i = 1; i < a->RGBA().size(); i++) {
+    CHECK(b->RGBA()[i].r == a->RGBA()[i].r);
+    CHECK(b->RGBA()[i].g == 0);
+  }
+}
+
+TEST_CASE("bsp provider shares vertices", "[bsp/provider]") {
+  // the floor of this box is split into two unlit faces sharing an edge
+  QBspProvider provider;
+  REQUIRE(provider.Load("tests/data/box_split.bsp"));
+
+  SolidEntityPtr world;
+  for (const auto &ent : provider.GetSolidEntities()) {
+    if (ent->ClassName() == "worldspawn")
+      world = ent;
+  }
+  REQUIRE(world != nullptr);
+
+  auto meshes = provider.GetEntityMeshes(world);
+  REQUIRE(meshes.size() == 1);
+  const auto &mesh = meshes[0];
+  CHECK(mesh.textureName == "wall");
+  CHECK(mesh.indices.size() == 7 * 6);
+  CHECK(mesh.vertices.size() == 6 * 4 + 2);
+  for (auto idx : mesh.indices) {
+    CHECK(idx < mesh.vertices.size());
+  }
+
+  int floorVerts = 0;
+  for (const auto &v : mesh.vertices) {
+    if (v.normal.Z == 1.0f)
+      floorVerts++;
+  }
+  CHECK(floorVerts == 6);
+
+  // faces of different planes never share, even at the same corner
+  QBspProvider box;
+  REQUIRE(box.Load(bspPath));
+  for (const auto &ent : box.GetSolidEntities()) {
+    for (const auto &m : box.GetEntityMeshes(ent)) {
+      CHECK(m.vertices.size() == m.indices.size() / 6 * 4);
+    }
+  }
+}
+
+TEST_CASE("bsp provider mesh cache", "[bsp/provider]") {
+  QBspProvider provider;
+  REQUIRE(provider.Load(bspPath));
+  auto world = provider.GetSolidEntities()[0];
+
+  auto first = provider.GetEntityMeshes(world);
+  auto second = provider.GetEntityMeshes(world);
+  REQUIRE(first.size() == 1);
+  REQUIRE(second.size() == 1);
+  CHECK(first[0].indices == second[0].indices);
+  CHECK(first[0].vertices.size() == second[0].vertices.size());
+
+  // face types change the build, the cache is dropped
+  provider.SetFaceType("wall", SurfaceType::SKIP);
+  auto skipped = provider.GetEntityMeshes(world);
+  REQUIRE(skipped.size() == 1);
+  CHECK(skipped[0].type == SurfaceType::SKIP);
+}
+
+TEST_CASE("bsp provider merges coplanar faces", "[bsp/provider]") {
+  bsp::QBspConfig cfg;
+  cfg.mergeCoplanarFaces = true;
+  QBspProvider provider;
+  REQUIRE(provider.Load("tests/data/box_split.bsp", cfg));
+
+  for (const auto &ent : provider.GetSolidEntities()) {
+    auto meshes = provider.GetEntityMeshes(ent);
+    REQUIRE(meshes.size() == 1);
+    // the unlit floor halves become one quad, the lit faces can't merge
+    CHECK(meshes[0].vertices.size() == 24);
+    CHECK(meshes[0].indices.size() == 36);
+    for (auto idx : meshes[0].indices) {
+      CHECK(idx < meshes[0].vertices.size());
+    }
+  }
+}
+
+TEST_CASE("bsp provider vertex cache order", "[bsp/provider]") {
+  bsp::QBspConfig cfg;
+  cfg.optimizeVertexCache = true;
+  cfg.optimizeOverdraw = true;
+  QBspProvider provider;
+  REQUIRE(provider.Load("tests/data/box_split.bsp", cfg));
+
+  SolidEntityPtr world;
+  for (const auto &ent : provider.GetSolidEntities()) {
+    if (ent->ClassName() == "worldspawn")
+      world = ent;
+  }
+  REQUIRE(world != nullptr);
+
+  auto meshes = provider.GetEntityMeshes(world);
+  REQUIRE(meshes.size() == 1);
+  const auto &mesh = meshes[0];
+  CHECK(mesh.vertices.size() == 6 * 4 + 2);
+  CHECK(mesh.indices.size() == 7 * 6);
+  CHECK(mesh.stats.acmrBefore > 0);
+  CHECK(mesh.stats.acmrAfter <= mesh.stats.acmrBefore);
+
+  // vertices are numbered in the order they are first used
+  uint32_t next = 0;
+  for (auto idx : mesh.indices) {
+    CHECK(idx <= next);
+    if (idx == next)
+      next++;
+  }
+}
+
+TEST_CASE("bsp visibility", "[bsp/vis]") {
+  bsp::QBsp bsp;
+  REQUIRE(bsp.LoadFile(bspPath) == bsp::QBSP_OK);
+  const auto &vis = bsp.Vis();
+
+  // leaves 1 to 3 split the room along x at -64 and 64
+  REQUIRE(vis.NumVisLeaves() == 3);
+  CHECK(vis.PointInLeaf({-96, 0, 24}) == 1);
+  CHECK(vis.PointInLeaf({0, 0, 24}) == 2);
+  CHECK(vis.PointInLeaf({96, 0, 24}) == 3);
+  CHECK(vis.PointInLeaf({0, 0, 500}) == 0);
+
+  // the outer leaves only see the middle one
+  CHECK(vis.LeafSees(1, 2));
+  CHECK_FALSE(vis.LeafSees(1, 3));
+  std::vector<int> allLeaves = {1, 2, 3};
+  std::vector<int> rightLeaves = {2, 3};
+  CHECK(vis.VisibleLeaves(2) == allLeaves);
+  CHECK(vis.VisibleLeaves({96, 0, 24}) == rightLeaves);
+
+  // the +x wall (face 1) is only marked in leaf 3
+  std::vector<int> leftSurfaces = {0, 2, 3, 4, 5};
+  std::vector<int> allSurfaces = {0, 1, 2, 3, 4, 5};
+  CHECK(vis.VisibleSurfaces(1) == leftSurfaces);
+  CHECK(vis.VisibleSurfaces(2) == allSurfaces);
+
+  // repeated queries return the cached lists
+  CHECK(&vis.VisibleSurfaces(1) == &vis.VisibleSurfaces({-96, 0, 24}));
+
+  // outside the level everything is visible
+  CHECK(vis.VisibleLeaves(0).size() == 3);
+}
+
+TEST_CASE("bsp pvs decompression", "[bsp/vis]") {
+  // 24 leaves, a zero run of one byte between the first and the last leaf
+  std::vector<bsp::fModel_t> models(1);
+  models[0].numleafs = 24;
+  std::vector<bsp::fLeaf_t> leafs(25);
+  for (auto &leaf : leafs)
+    leaf.vislist = -1;
+  leafs[1].vislist = 0;
+  std::vector<unsigned char> visData = {0x01, 0x00, 0x01, 0x80};
+
+  bsp::bspFileContent content{};
+  content.models = models;
+  content.leafs = leafs;
+  content.visibility = visData;
+
+  bsp::BspTree tree(content, false);
+  bsp::BspVisibility vis(content, tree);
+  std::vector<uint8_t> row = {0x01, 0x00, 0x80};
+  std::vector<int> leaves = {1, 24};
+  CHECK(vis.LeafPVS(1) == row);
+  CHECK(vis.VisibleLeaves(1) == leaves);
+  CHECK(vis.VisibleLeaves(2).size() == 24);
+}
+
+TEST_CASE("bsp pvs cache eviction", "[bsp/vis]") {
+  // more leaves than the cache holds, leaf 1 only sees itself
+  int numLeaves = (int)bsp::BspVisibility::MAX_CACHED_LEAVES + 44;
+  std::vector<bsp::fModel_t> models(1);
+  models[0].numleafs = numLeaves;
+  std::vector<bsp::fLeaf_t> leafs(numLeaves + 1);
+  for (auto &leaf : leafs)
+    leaf.vislist = -1;
+  leafs[1].vislist = 0;
+  std::vector<unsigned char> visData = {0x01, 0x00, (unsigned char)(numLeaves / 8)};
+
+  bsp::bspFileContent content{};
+  content.models = models;
+  content.leafs = leafs;
+  content.visibility = visData;
+
+  bsp::BspTree tree(content, false);
+  bsp::BspVisibility vis(content, tree);
+  std::vector<int> self = {1};
+  CHECK(vis.VisibleLeaves(1) == self);
+  for (int l = 2; l <= numLeaves; l++)
+    CHECK(vis.VisibleLeaves(l).size() == (size_t)numLeaves);
+
+  // leaf 1 was dropped from the cache and is decompressed again
+  CHECK(vis.VisibleLeaves(1) == self);
+  CHECK(vis.LeafSees(1, 1));
+  CHECK_FALSE(vis.LeafSees(1, 2));
+}
+
+TEST_CASE("bsp tree queries", "[bsp/tree]") {
+  bsp::QBsp bsp;
+  REQUIRE(bsp.LoadFile(bspPath) == bsp::QBSP_OK);
+  const auto &tree = bsp.Tree();
+  REQUIRE_FALSE(tree.Empty());
+
+  CHECK(tree.PointInLeaf({-96, 0, 24}) == 1);
+  CHECK(tree.PointInLeaf({96, 0, 24}) == 3);
+  CHECK(tree.PointContents({0, 0, 24}) == bsp::CONTENTS_EMPTY);
+  CHECK(tree.PointContents({0, 0, 500}) == bsp::CONTENTS_SOLID);
+
+  // straight down onto the floor (face 4)
+  bsp::BspRayHit hit;
+  REQUIRE(tree.TraceRay({0, 0, 64}, {0, 0, -64}, hit));
+  CHECK(hit.face == 4);
+  CHECK(hit.fraction == 0.5f);
+  CHECK(hit.point.z == 0.0f);
+  CHECK(hit.normal.z == 1.0f);
+
+  // across all three leaves into the +x wall
+  REQUIRE(tree.TraceRay({-100, 10, 40}, {200, 10, 40}, hit));
+  CHECK(hit.face == 1);
+  CHECK(hit.point.x == 128.0f);
+
+  // stopping short of the walls hits nothing
+  CHECK_FALSE(tree.TraceRay({-100, 10, 40}, {100, 10, 40}, hit));
+
+  int leaves[4];
+  REQUIRE(tree.BoxLeaves({-80, -8, 8}, {0, 8, 16}, leaves, 4) == 2);
+  CHECK(leaves[0] + leaves[1] == 3);
+  CHECK(tree.BoxLeaves({-120, -120, 8}, {120, 120, 16}, leaves, 1) == 3);
+}
+
+TEST_CASE("bsp tree opengl coordinates", "[bsp/tree]") {
+  bsp::QBspConfig cfg;
+  cfg.convertCoordToOGL = true;
+  bsp::QBsp bsp(cfg);
+  REQUIRE(bsp.LoadFile(bspPath) == bsp::QBSP_OK);
+  const auto &tree = bsp.Tree();
+
+  // quake (x, y, z) is (x, z, -y) here
+  CHECK(tree.PointInLeaf({96, 24, 0}) == 3);
+
+  bsp::BspRayHit hit;
+  REQUIRE(tree.TraceRay({0, 64, 0}, {0, -64, 0}, hit));
+  CHECK(hit.face == 4);
+  CHECK(hit.normal.y == 1.0f);
+}
+
+TEST_CASE("bsp hull traces", "[bsp/collision]") {
+  bsp::QBsp bsp;
+  REQUIRE(bsp.LoadFile(bspPath) == bsp::QBSP_OK);
+  const auto &col = bsp.Collision();
+  REQUIRE(col.NumModels() == 2);
+
+  // point trace onto the floor stops just above it
+  auto tr = col.Trace({0, 0, 64}, {0, 0, -64}, 0);
+  CHECK(tr.fraction < 0.5f);
+  CHECK(tr.fraction > 0.49f);
+  CHECK(tr.contents == bsp::CONTENTS_SOLID);
+  CHECK(tr.planeNormal.z == 1.0f);
+  CHECK(tr.planeDist == 0.0f);
+  CHECK_FALSE(tr.startSolid);
+
+  // the player hull keeps the origin 24 units above the floor
+  tr = col.Trace({0, 0, 48}, {0, 0, -100}, 1);
+  CHECK(tr.endPos.z > 24.0f);
+  CHECK(tr.endPos.z < 24.1f);
+  CHECK(tr.planeDist == 24.0f);
+
+  // the large hull is narrower than the player hull
+  CHECK(col.PointContents({100, 0, 48}, 1) == bsp::CONTENTS_EMPTY);
+  CHECK(col.PointContents({100, 0, 48}, 2) == bsp::CONTENTS_SOLID);
+
+  tr = col.Trace({0, 0, 500}, {0, 0, 48}, 1);
+  CHECK(tr.startSolid);
+  CHECK_FALSE(tr.allSolid);
+
+  tr = col.Trace({0, 0, 40}, {50, 0, 40}, 1);
+  CHECK(tr.fraction == 1.0f);
+  CHECK(tr.endPos.x == 50.0f);
+
+  // the crate in its own model space, expanded by the player hull
+  tr = col.Trace({-100, 0, 0}, {100, 0, 0}, 1, 1);
+  CHECK(tr.fraction < 1.0f);
+  CHECK(tr.endPos.x < -32.0f);
+  CHECK(tr.endPos.x > -32.1f);
+  CHECK(tr.planeNormal.x == -1.0f);
+
+  // invalid hulls and models never block
+  CHECK(col.Trace({0, 0, 64}, {0, 0, -64}, 3).fraction == 1.0f);
+  CHECK(col.Trace({0, 0, 64}, {0, 0, -64}, 0, 5).fraction == 1.0f);
+}
+
+TEST_CASE("bsp batched traces", "[bsp/collision]") {
+  bsp::QBsp bsp;
+  REQUIRE(bsp.LoadFile(bspPath) == bsp::QBSP_OK);
+  const auto &col = bsp.Collision();
+
+  std::vector<bsp::BspRay> rays;
+  for (int i = 0; i < 200; i++) {
+    float a = i * 0.1f;
+    float z = (float)(i % 7) * 40.0f - 100.0f;
+    rays.push_back({{0, 0, 64}, {std::cos(a) * 300.0f, std::sin(a) * 300.0f, z}});
+  }
+
+  std::vector<bsp::BspTrace> results(rays.size());
+  col.TraceBatch(rays, results, 0);
+  for (size_t i = 0; i < rays.size(); i++) {
+    auto single = col.Trace(rays[i].start, rays[i].end, 0);
+    REQUIRE(results[i].fraction == single.fraction);
+    REQUIRE(results[i].fraction < 1.0f);
+  }
+
+  CHECK(col.LineOfSight({-96, 0, 24}, {96, 0, 24}));
+  CHECK_FALSE(col.LineOfSight({-96, 0, 24}, {-96, 0, -24}));
+}
+
+TEST_CASE("bsp frustum draw lists", "[bsp/draw]") {
+  bsp::QBsp bsp;
+  REQUIRE(bsp.LoadFile(bspPath) == bsp::QBSP_OK);
+  bsp::BspDrawListBuilder builder(bsp);
+  REQUIRE(builder.Indices().size() == 36);
+
+  // 90 degree view from the left leaf towards +x
+  const float s = 0.70710678f;
+  bsp::BspFrustum frustum;
+  frustum.planes[frustum.count++] = {1, 0, 0, 96};
+  frustum.planes[frustum.count++] = {s, s, 0, 96 * s};
+  frustum.planes[frustum.count++] = {s, -s, 0, 96 * s};
+
+  // the -x wall is behind the viewer
+  auto list = builder.Build(frustum);
+  std::vector<int> all = {1, 2, 3, 4, 5};
+  CHECK(list.surfaces == all);
+
+  // leaf 1 can't see leaf 3, which holds the +x wall
+  list = builder.Build(frustum, 1);
+  std::vector<int> pvs = {2, 3, 4, 5};
+  CHECK(list.surfaces == pvs);
+
+  // every world face uses "wall", consecutive faces merge into one range
+  REQUIRE(list.ranges.size() == 1);
+  CHECK(list.ranges[0].texture == 0);
+  CHECK(list.ranges[0].indexCount == 24);
+  for (uint32_t i = 0; i < list.ranges[0].indexCount; i++)
+    REQUIRE(builder.Indices()[list.ranges[0].firstIndex + i] < builder.Vertices().size());
+
+  // without planes everything in the PVS is drawn
+  bsp::BspFrustum open;
+  CHECK(builder.Build(open, 2).surfaces.size() == 6);
+  CHECK(builder.Build(open, 1).ranges.size() == 2);
+
+  // with several lightmap pages every vertex samples the stacked atlas at its face's page
+  bsp::QBspConfig cfg;
+  cfg.lightmapPageSize = 24;
+  bsp::QBsp paged(cfg);
+  REQUIRE(paged.LoadFile(bspPath) == bsp::QBSP_OK);
+  bsp::BspDrawListBuilder pagedBuilder(paged);
+  const auto *lm = paged.LightMap();
+  REQUIRE(lm != nullptr);
+  REQUIRE(lm->Pages() > 1);
+
+  std::vector<bool> pageUsed(lm->Pages());
+  for (const auto &face : paged.WorldSpawn()->Faces()) {
+    pageUsed[face->lm_tex_num] = true;
+    for (const auto &fv : face->verts) {
+      float stacked = (fv.lm_uv.y + face->lm_tex_num) / lm->Pages();
+      CHECK(std::any_of(pagedBuilder.Vertices().begin(), pagedBuilder.Vertices().end(), [&](const auto &v) {
+        return v.point.x == fv.point.x && v.point.y == fv.point.y && v.point.z == fv.point.z &&
+               v.lm_uv.x == fv.lm_uv.x && v.lm_uv.y == stacked;
+      }));
+    }
+  }
+  CHECK(std::count(pageUsed.begin(), pageUsed.end(), true) > 1);
+}
+
+TEST_CASE("bsp frustum from matrix", "[bsp/draw]") {
+  // identity view-projection, the clip volume is the unit cube
+  const float identity[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+  auto frustum = bsp::BspFrustum::FromMatrix(identity);
+  REQUIRE(frustum.count == 6);
+  CHECK(frustum.IntersectsBox({-0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, 0.5f}));
+  CHECK(frustum.IntersectsBox({0.9f, 0.9f, 0.9f}, {2, 2, 2}));
+  CHECK_FALSE(frustum.IntersectsBox({1.5f, 0, 0}, {2, 1, 1}));
+  CHECK_FALSE(frustum.IntersectsBox({0, 0, -3}, {1, 1, -2}));
+}
@@ -1,6 +1,11 @@
+#include <algorithm>
+#include <quakelib/face_merge.h>
 #include <quakelib/map/brush.h>
 #include <quakelib/map/face.h>
 #include <quakelib/map/types.h>
+#include <quakelib/mesh_chunk.h>
+#include <quakelib/mesh_optimize.h>
+#include <quakelib/meshlet.h>
 #include <snitch/snitch.hpp>
 
 using namespace quakelib;
@@ -99,3 +104,239 @@ TEST_CASE("Brush Intersection", "[map/csg]") {
 
   REQUIRE(b1.DoesIntersect(b5));
 }
+
+TEST_CASE("Coplanar Face Merge", "[map/merge]") {
+  std::map<int, textureBounds> texBounds;
+  texBounds[0] = {64, 64};
+  std::map<int, MapSurface::eFaceType> faceTypes;
+  faceTypes[0] = MapSurface::SOLID;
+
+  // two blocks side by side, their tops share the edge at x = 64
+  Brush b1 = CreateBlock({0, 0, 0}, {64, 64, 64});
+  Brush b2 = CreateBlock({64, 0, 0}, {128, 64, 64});
+  b1.buildGeometry(faceTypes, texBounds);
+  b2.buildGeometry(faceTypes, texBounds);
+
+  std::vector<MergePolygon> tops;
+  for (const auto *b : {&b1, &b2}) {
+    for (const auto &f : b->Faces()) {
+      if (f->Vertices()[0].normal[2] > 0.5f)
+        tops.push_back({f->Vertices()});
+    }
+  }
+  REQUIRE(tops.size() == 2);
+
+  // a different texture offset on one of them keeps them apart
+  auto shifted = tops;
+  for (auto &v : shifted[1].vertices)
+    v.uv[0] += 0.5f;
+  CHECK(MergeCoplanarPolygons(shifted) == 0);
+  CHECK(shifted.size() == 2);
+
+  // so does a different group
+  auto grouped = tops;
+  grouped[1].group = 1;
+  CHECK(MergeCoplanarPolygons(grouped) == 0);
+
+  // a wall of another texture standing on the back corner at x = 64 keeps that corner, dropping
+  // it would leave a T-junction on the bottom edge of the wall
+  Brush b3 = CreateBlock({64, 64, 0}, {128, 128, 64});
+  b3.buildGeometry(faceTypes, texBounds);
+  auto walled = tops;
+  for (const auto &f : b3.Faces()) {
+    const auto &verts = f->Vertices();
+    if (std::all_of(verts.begin(), verts.end(), [](const Vertex &v) { return v.point[1] == 64; }))
+      walled.push_back({verts, 1});
+  }
+  REQUIRE(walled.size() == 3);
+  CHECK(MergeCoplanarPolygons(walled) == 1);
+  REQUIRE(walled.size() == 2);
+  const auto &top = walled[0].group == 0 ? walled[0] : walled[1];
+  CHECK(top.vertices.size() == 5);
+  bool keepsCorner = false;
+  for (const auto &v : top.vertices)
+    keepsCorner |= v.point[0] == 64 && v.point[1] == 64 && v.point[2] == 0;
+  CHECK(keepsCorner);
+
+  // the merged top is a single quad, the corners at x = 64 lie on straight edges
+  CHECK(MergeCoplanarPolygons(tops) == 1);
+  REQUIRE(tops.size() == 1);
+  CHECK(tops[0].vertices.size() == 4);
+
+  RenderMesh mesh;
+  AppendPolygons(mesh, tops);
+  CHECK(mesh.vertices.size() == 4);
+  CHECK(mesh.indices.size() == 6);
+}
+
+TEST_CASE("Vertex Cache Optimization", "[map/optimize]") {
+  // a 16x16 quad grid with its triangles in scrambled order
+  const int N = 16;
+  RenderMesh mesh;
+  for (int y = 0; y <= N; y++) {
+    for (int x = 0; x <= N; x++) {
+      Vertex v;
+      v.point = {(float)x, (float)y, 0};
+      v.normal = {0, 0, 1};
+      mesh.vertices.push_back(v);
+    }
+  }
+
+  std::vector<std::array<uint32_t, 3>> tris;
+  for (int y = 0; y < N; y++) {
+    for (int x = 0; x < N; x++) {
+      uint32_t i = y * (N + 1) + x;
+      tris.push_back({i, i + 1, i + N + 2});
+      tris.push_back({i, i + N + 2, i + N + 1});
+    }
+  }
+  for (size_t i = 0; i < tris.size(); i++)
+    std::swap(tris[i], tris[(i * 7919) % tris.size()]);
+  for (const auto &t : tris)
+    mesh.indices.insert(mesh.indices.end(), t.begin(), t.end());
+
+  // an unused vertex is dropped by the fetch pass
+  mesh.vertices.push_back(Vertex{});
+
+  auto positions = [](const RenderMesh &m) {
+    std::vector<std::array<float, 9>> out;
+    for (size_t i = 0; i < m.indices.size(); i += 3) {
+      std::array<float, 9> t;
+      for (int k = 0; k < 3; k++) {
+        for (int c = 0; c < 3; c++)
+          t[k * 3 + c] = m.vertices[m.indices[i + k]].point[c];
+      }
+      out.push_back(t);
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+  };
+  auto before = positions(mesh);
+
+  MeshOptimizeStats stats = OptimizeMesh(mesh, true);
+  CHECK(stats.acmrBefore > 1.5f);
+  CHECK(stats.acmrAfter < 1.0f);
+  CHECK(stats.acmrAfter == ComputeACMR(mesh.indices, mesh.vertices.size()));
+  CHECK(mesh.vertices.size() == (N + 1) * (N + 1));
+
+  // the same triangles with the same winding
+  CHECK(positions(mesh) == before);
+}
+
+TEST_CASE("Meshlet Generation", "[map/meshlet]") {
+  // a flat 24x24 quad grid facing +z
+  const int N = 24;
+  RenderMesh mesh;
+  for (int y = 0; y <= N; y++) {
+    for (int x = 0; x <= N; x++) {
+      Vertex v;
+      v.point = {(float)x * 8, (float)y * 8, 0};
+      mesh.vertices.push_back(v);
+    }
+  }
+  for (int y = 0; y < N; y++) {
+    for (int x = 0; x < N; x++) {
+      uint32_t i = y * (N + 1) + x;
+      mesh.indices.insert(mesh.indices.end(), {i, i + 1, i + N + 2, i, i + N + 2, i + N + 1});
+    }
+  }
+
+  MeshletData data = BuildMeshlets(mesh);
+  REQUIRE(!data.meshlets.empty());
+  CHECK(data.meshlets.size() <= (N * N * 2) / 40);
+
+  std::vector<std::array<uint32_t, 3>> tris;
+  for (const auto &m : data.meshlets) {
+    CHECK(m.vertexCount <= MESHLET_MAX_VERTICES);
+    CHECK(m.triangleCount <= MESHLET_MAX_TRIANGLES);
+
+    for (uint32_t t = 0; t < m.triangleCount; t++) {
+      std::array<uint32_t, 3> tri;
+      for (int k = 0; k < 3; k++) {
+        uint8_t local = data.triangles[(m.triangleOffset + t) * 3 + k];
+        REQUIRE(local < m.vertexCount);
+        tri[k] = data.vertices[m.vertexOffset + local];
+        CHECK(math::Len(mesh.vertices[tri[k]].point - m.center) <= m.radius + 0.01f);
+      }
+      tris.push_back(tri);
+    }
+
+    // seen from below every triangle faces away, from above none does
+    CHECK(m.coneCutoff < 0.01f);
+    CHECK(IsMeshletBackfacing(m, m.center + Vec3{0, 0, -100}));
+    CHECK_FALSE(IsMeshletBackfacing(m, m.center + Vec3{0, 0, 100}));
+  }
+
+  // every triangle exactly once with its winding
+  std::vector<std::array<uint32_t, 3>> expected;
+  for (size_t i = 0; i < mesh.indices.size(); i += 3)
+    expected.push_back({mesh.indices[i], mesh.indices[i + 1], mesh.indices[i + 2]});
+  std::sort(tris.begin(), tris.end());
+  std::sort(expected.begin(), expected.end());
+  CHECK(tris == expected);
+}
+
+TEST_CASE("Spatial Chunking", "[map/chunk]") {
+  // two textures on a 32x32 floor of 64 unit quads, alternating per row
+  const int N = 32;
+  std::vector<RenderMesh> meshes(2);
+  meshes[0].textureName = "a";
+  meshes[1].textureName = "b";
+  for (int y = 0; y < N; y++) {
+    RenderMesh &mesh = meshes[y % 2];
+    for (int x = 0; x < N; x++) {
+      uint32_t base = (uint32_t)mesh.vertices.size();
+      for (auto [dx, dy] : {std::pair{0, 0}, {1, 0}, {1, 1}, {0, 1}}) {
+        Vertex v;
+        v.point = {(float)(x + dx) * 64, (float)(y + dy) * 64, 0};
+        mesh.vertices.push_back(v);
+      }
+      mesh.indices.insert(mesh.indices.end(), {base, base + 1, base + 2, base, base + 2, base + 3});
+    }
+  }
+  const size_t totalTris = N * N * 2;
+
+  auto countTris = [](const std::vector<MeshChunk> &chunks) {
+    size_t tris = 0;
+    for (const auto &c : chunks) {
+      for (const auto &m : c.meshes) {
+        tris += m.indices.size() / 3;
+        for (const auto &v : m.vertices) {
+          for (int a = 0; a < 3; a++) {
+            CHECK(v.point[a] >= c.mins[a]);
+            CHECK(v.point[a] <= c.maxs[a]);
+          }
+        }
+        for (auto idx : m.indices)
+          CHECK(idx < m.vertices.size());
+      }
+    }
+    return tris;
+  };
+
+  // 2048 / 512 cells per axis, every cell holds both textures
+  auto grid = ChunkMeshesGrid(meshes, 512);
+  CHECK(grid.size() == 16);
+  CHECK(countTris(grid) == totalTris);
+  for (const auto &c : grid) {
+    REQUIRE(c.meshes.size() == 2);
+    CHECK(c.meshes[0].textureName == "a");
+    CHECK(c.meshes[1].textureName == "b");
+    CHECK(c.maxs[0] - c.mins[0] == 512);
+    CHECK(c.meshes[0].vertices.size() == 4 * 8 * 4);
+  }
+
+  auto single = ChunkMeshesGrid(meshes, 0);
+  CHECK(single.size() == 1);
+  CHECK(countTris(single) == totalTris);
+
+  auto kd = ChunkMeshesKdTree(meshes, 300);
+  CHECK(kd.size() == 8);
+  CHECK(countTris(kd) == totalTris);
+  for (const auto &c : kd) {
+    size_t tris = 0;
+    for (const auto &m : c.meshes)
+      tris += m.indices.size() / 3;
+    CHECK(tris <= 300);
+  }
+}
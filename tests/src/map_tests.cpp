@@ -1,7 +1,12 @@
 #include "../inc/map_dummy.h"
 #include <quakelib/entity_parser.h>
+#include <quakelib/map/lightmap_generator.h>
 #include <quakelib/map/map.h>
+#include <quakelib/map/qmap_provider.h>
+#include <filesystem>
+#include <fstream>
 #include <snitch/snitch.hpp>
+#include <string>
 
 using namespace quakelib;
 
@@ -63,4 +68,537 @@ TEST_CASE("parse map wads", "[map/wads]") {
   REQUIRE(m->Wads()[0] == "makkon_tech.wad");
   REQUIRE(m->Wads()[1] == "prototype_all_1_3.wad");
   delete m;
-}
\ No newline at end of file
+}
+TEST_CASE("lightmap incremental relight", "[map/lightmap]") {
+  map::QMap m;
+  m.LoadBuffer(mapbuff, [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  m.GenerateGeometry();
+
+  std::vector<map::LightmapGenerator::Light> lights = {
+      {{24, -56, 120}, 150, {0.4f, 0.6f, 0.8f}},
+      {{-150, 100, 40}, 96, {1.0f, 0.5f, 0.2f}},
+  };
+
+  map::LightmapGenerator incremental(1024, 1024, 16.0f);
+  REQUIRE(incremental.Pack(m.SolidEntities()));
+  incremental.CalculateLighting(lights);
+
+  lights[1].pos = {-150, 80, 40};
+  int relit = incremental.UpdateLight(1, lights[1]);
+  CHECK(relit > 0);
+
+  map::LightmapGenerator full(1024, 1024, 16.0f);
+  REQUIRE(full.Pack(m.SolidEntities()));
+  full.CalculateLighting(lights);
+
+  REQUIRE(incremental.GetAtlasData() == full.GetAtlasData());
+
+  lights.erase(lights.begin());
+  incremental.RemoveLight(0);
+  full.CalculateLighting(lights);
+  REQUIRE(incremental.GetAtlasData() == full.GetAtlasData());
+}
+
+TEST_CASE("lightmap luxel buffer", "[map/lightmap]") {
+  map::QMap m;
+  m.LoadBuffer(mapbuff, [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  m.GenerateGeometry();
+
+  const int size = 1024;
+  map::LightmapGenerator gen(size, size, 16.0f);
+  REQUIRE(gen.Pack(m.SolidEntities()));
+  std::vector<Vec2> packedUVs;
+  for (const auto &entry : gen.Entries()) {
+    for (const auto &v : entry.face->Vertices())
+      packedUVs.push_back(v.lightmap_uv);
+  }
+
+  // a failed pack leaves the packed coordinates alone
+  map::LightmapGenerator tiny(4, 4, 16.0f);
+  CHECK_FALSE(tiny.Pack(m.SolidEntities()));
+  size_t index = 0;
+  for (const auto &entry : gen.Entries()) {
+    for (const auto &v : entry.face->Vertices()) {
+      CHECK(v.lightmap_uv[0] == packedUVs[index][0]);
+      CHECK(v.lightmap_uv[1] == packedUVs[index][1]);
+      index++;
+    }
+  }
+
+  // every entry owns w * h luxels in row order, half a unit in front of its face
+  const auto &luxels = gen.Luxels();
+  size_t base = 0;
+  for (const auto &entry : gen.Entries()) {
+    REQUIRE(entry.luxelBase == base);
+    const Vec3 &N = entry.face->GetPlaneNormal();
+    for (int y = 0; y < entry.h; y++) {
+      for (int x = 0; x < entry.w; x++, base++) {
+        CHECK(luxels.atlasIndex[base] == (entry.y + y) * size + entry.x + x);
+        CHECK(luxels.normal[base] == N);
+        float height = HMM_DotV3(N, luxels.position[base]) - entry.face->GetPlaneDist();
+        CHECK(std::abs(height - 0.5f) < 1e-3f);
+      }
+    }
+  }
+  CHECK(luxels.Size() == base);
+  CHECK(luxels.normal.size() == base);
+  CHECK(luxels.atlasIndex.size() == base);
+}
+
+TEST_CASE("lightmap bounces", "[map/lightmap]") {
+  map::QMap m;
+  m.LoadBuffer(mapbuff, [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  m.GenerateGeometry();
+
+  std::vector<map::LightmapGenerator::Light> lights = {{{24, -56, 120}, 300, {1.0f, 1.0f, 1.0f}}};
+
+  map::LightmapGenerator lmGen(1024, 1024, 16.0f);
+  REQUIRE(lmGen.Pack(m.SolidEntities()));
+  lmGen.CalculateLighting(lights);
+  auto direct = lmGen.GetAtlasData();
+
+  map::LightmapGenerator::BounceSettings settings;
+  settings.samples = 16;
+
+  std::vector<int> reported;
+  int done = lmGen.CalculateBounces(settings, [&](int bounce, int bounces) {
+    reported.push_back(bounce);
+    return bounce < 1;
+  });
+
+  CHECK(done == 1);
+  REQUIRE(reported.size() == 1);
+
+  // indirect light only ever adds to the direct result
+  const auto &lit = lmGen.GetAtlasData();
+  REQUIRE(lit.size() == direct.size());
+  bool brighter = false;
+  for (size_t i = 0; i < lit.size(); i++) {
+    REQUIRE(lit[i] >= direct[i]);
+    brighter |= lit[i] > direct[i];
+  }
+  CHECK(brighter);
+
+  // removing the only light leaves no bounce light behind, not even on entries it never reached
+  lmGen.RemoveLight(0);
+  map::LightmapGenerator dark(1024, 1024, 16.0f);
+  REQUIRE(dark.Pack(m.SolidEntities()));
+  dark.CalculateLighting({});
+  CHECK(lmGen.GetAtlasData() == dark.GetAtlasData());
+}
+
+TEST_CASE("lightmap occlusion", "[map/lightmap]") {
+  map::QMap m;
+  m.LoadBuffer(mapbuff, [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  m.GenerateGeometry();
+
+  std::vector<map::LightmapGenerator::Light> lights = {{{24, -56, 120}, 300, {1.0f, 1.0f, 1.0f}}};
+
+  map::LightmapGenerator lmGen(1024, 1024, 16.0f);
+  REQUIRE(lmGen.Pack(m.SolidEntities()));
+  lmGen.CalculateLighting(lights);
+  auto unoccluded = lmGen.GetAtlasData();
+
+  map::LightmapGenerator::OcclusionSettings settings;
+  settings.samples = 12;
+  settings.applyToAtlas = false;
+  lmGen.CalculateOcclusion(settings);
+  REQUIRE(lmGen.GetAtlasData() == unoccluded);
+
+  // luxels near the room's corners see walls within the occlusion distance
+  const auto &ao = lmGen.Occlusion();
+  REQUIRE(ao.size() == lmGen.Luxels().Size());
+  bool occluded = false;
+  for (float v : ao) {
+    REQUIRE(v >= 0.0f);
+    REQUIRE(v <= 1.0f);
+    occluded |= v < 1.0f;
+  }
+  CHECK(occluded);
+
+  settings.applyToAtlas = true;
+  lmGen.CalculateOcclusion(settings);
+  const auto &lit = lmGen.GetAtlasData();
+  bool darker = false;
+  for (size_t i = 0; i < lit.size(); i++) {
+    REQUIRE(lit[i] <= unoccluded[i]);
+    darker |= lit[i] < unoccluded[i];
+  }
+  CHECK(darker);
+}
+
+TEST_CASE("lightmap hdr encoding", "[map/lightmap]") {
+  const Vec3 colors[] = {{0.0f, 0.0f, 0.0f}, {0.25f, 0.5f, 1.0f}, {1.0f, 0.8f, 0.6f}, {4.0f, 3.0f, 2.5f}};
+  for (const auto &color : colors) {
+    unsigned char rgbm[4], logluv[4];
+    map::EncodeRGBM(color, map::LIGHTMAP_RGBM_RANGE, rgbm);
+    map::EncodeLogLuv(color, logluv);
+
+    Vec3 a = map::DecodeRGBM(rgbm, map::LIGHTMAP_RGBM_RANGE);
+    Vec3 b = map::DecodeLogLuv(logluv);
+    for (int i = 0; i < 3; i++) {
+      CHECK(std::fabs(a[i] - color[i]) <= 0.02f + color[i] * 0.02f);
+      CHECK(std::fabs(b[i] - color[i]) <= 0.01f + color[i] * 0.05f);
+    }
+  }
+
+  map::QMap m;
+  m.LoadBuffer(mapbuff, [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  m.GenerateGeometry();
+
+  // bright enough to saturate the RGBA8 atlas close to the light
+  std::vector<map::LightmapGenerator::Light> lights = {{{24, -56, 120}, 300, {4.0f, 4.0f, 4.0f}}};
+
+  map::LightmapGenerator lmGen(1024, 1024, 16.0f);
+  REQUIRE(lmGen.Pack(m.SolidEntities()));
+  lmGen.CalculateLighting(lights);
+
+  auto hdr = lmGen.GetHDRAtlasData();
+  REQUIRE(hdr.size() == lmGen.GetAtlasData().size() / 4 * 3);
+  CHECK(*std::max_element(hdr.begin(), hdr.end()) > 1.0f);
+
+  auto rgbm = lmGen.GetEncodedAtlasData(map::LightmapEncoding::RGBM);
+  REQUIRE(rgbm.size() == lmGen.GetAtlasData().size());
+  for (int atlasIndex : lmGen.Luxels().atlasIndex) {
+    if (atlasIndex < 0)
+      continue;
+    Vec3 decoded = map::DecodeRGBM(&rgbm[atlasIndex * 4], map::LIGHTMAP_RGBM_RANGE);
+    float expected = std::min(hdr[atlasIndex * 3], map::LIGHTMAP_RGBM_RANGE);
+    REQUIRE(std::fabs(decoded[0] - expected) <= 0.05f);
+  }
+
+  // pixels outside every face hold the ambient level in all atlases
+  std::vector<bool> covered(hdr.size() / 3, false);
+  for (int atlasIndex : lmGen.Luxels().atlasIndex) {
+    if (atlasIndex >= 0)
+      covered[atlasIndex] = true;
+  }
+  size_t empty = std::find(covered.begin(), covered.end(), false) - covered.begin();
+  REQUIRE(empty < covered.size());
+  lmGen.CalculateLighting(lights, {0.25f, 0.5f, 0.75f});
+  hdr = lmGen.GetHDRAtlasData();
+  rgbm = lmGen.GetEncodedAtlasData(map::LightmapEncoding::RGBM);
+  Vec3 decoded = map::DecodeRGBM(&rgbm[empty * 4], map::LIGHTMAP_RGBM_RANGE);
+  for (int i = 0; i < 3; i++) {
+    CHECK(hdr[empty * 3 + i] == 0.25f * (i + 1));
+    CHECK(std::fabs(decoded[i] - hdr[empty * 3 + i]) <= 0.02f);
+  }
+
+  CHECK(lmGen.GetEncodedAtlasData(map::LightmapEncoding::RGBA8) == lmGen.GetAtlasData());
+}
+
+TEST_CASE("lightmap light grid", "[map/lightmap]") {
+  map::QMap m;
+  m.LoadBuffer(mapbuff, [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  m.GenerateGeometry();
+
+  Vec3 lightPos = {24, -56, 120};
+  std::vector<map::LightmapGenerator::Light> lights = {{lightPos, 300, {1.0f, 1.0f, 1.0f}}};
+
+  map::LightmapGenerator lmGen(1024, 1024, 16.0f);
+  REQUIRE(lmGen.Pack(m.SolidEntities()));
+  lmGen.CalculateLighting(lights);
+
+  map::LightmapGenerator::LightGridSettings settings;
+  settings.samples = 8;
+  auto grid = lmGen.BakeLightGrid(settings);
+  REQUIRE_FALSE(grid.Empty());
+  REQUIRE(grid.Cells().size() == static_cast<size_t>(grid.Size(0)) * grid.Size(1) * grid.Size(2));
+
+  // grid points are exact samples
+  const auto &cell = grid.Cell(1, 1, 1);
+  auto sampled = grid.Sample(grid.CellPosition(1, 1, 1));
+  for (int f = 0; f < 6; f++) {
+    for (int k = 0; k < 3; k++)
+      CHECK(std::fabs(sampled.faces[f][k] - cell.faces[f][k]) < 1e-4f);
+  }
+
+  // an entity below the light receives more light from above than from below
+  for (const auto &ent : m.PointEntities()) {
+    if (ent->ClassName() != "info_player_start")
+      continue;
+    Vec3 up = grid.Evaluate(ent->Origin(), {0, 0, 1});
+    Vec3 down = grid.Evaluate(ent->Origin(), {0, 0, -1});
+    CHECK(up[0] > down[0]);
+  }
+}
+
+// an axial box in the layout of brush 0 of the dummy map, the +y face can take another texture
+static std::string boxBrush(Vec3 mins, Vec3 maxs, const std::string &backTexture = "128_cyan_1") {
+  // 0 and 1 pick the min or max of each axis for the three points of every face
+  const int pts[6][9] = {{0, 1, 1, 0, 0, 1, 0, 1, 0}, {1, 0, 0, 0, 0, 0, 1, 0, 1},
+                         {1, 1, 0, 0, 1, 0, 1, 0, 0}, {1, 0, 1, 0, 0, 1, 1, 1, 1},
+                         {1, 1, 1, 0, 1, 1, 1, 1, 0}, {1, 0, 1, 1, 1, 1, 1, 0, 0}};
+  const char *axes[6] = {"[ 0 1 0 0 ] [ 0 0 -1 0 ]", "[ 1 0 0 0 ] [ 0 0 -1 0 ]",
+                         "[ -1 0 0 0 ] [ 0 -1 0 0 ]", "[ 1 0 0 0 ] [ 0 -1 0 0 ]",
+                         "[ -1 0 0 0 ] [ 0 0 -1 0 ]", "[ 0 1 0 0 ] [ 0 0 -1 0 ]"};
+  std::string out = "{\n";
+  for (int f = 0; f < 6; f++) {
+    for (int p = 0; p < 3; p++) {
+      out += "( ";
+      for (int a = 0; a < 3; a++)
+        out += std::to_string((int)(pts[f][p * 3 + a] ? maxs[a] : mins[a])) + " ";
+      out += ") ";
+    }
+    out += (f == 4 ? backTexture : std::string("128_cyan_1")) + " " + axes[f] + " 0 1 1\n";
+  }
+  return out + "}\n";
+}
+
+// brush 0 of the dummy map as a func_wall, moved along x
+static std::string funcWall(int dx) {
+  return "{\n\"classname\" \"func_wall\"\n" +
+         boxBrush({208.0f + dx, -240, -16}, {224.0f + dx, 144, 240}) + "}\n";
+}
+
+TEST_CASE("brush entity instancing", "[map/instancing]") {
+  // the second wall is a whole texture further, the third shifts the texture by 8 texels
+  std::string buffer = "{\n\"mapversion\" \"220\"\n\"classname\" \"worldspawn\"\n}\n" + funcWall(0) +
+                       funcWall(256) + funcWall(8);
+
+  map::QMapConfig cfg;
+  cfg.instanceBrushEntities = true;
+  map::QMap m(cfg);
+  m.LoadBuffer(buffer.c_str(), [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  m.GenerateGeometry();
+
+  const auto &ents = m.SolidEntities();
+  REQUIRE(ents.size() == 4);
+  CHECK(ents[1]->Prototype() == nullptr);
+  CHECK(ents[2]->Prototype() == ents[1]);
+  CHECK(ents[3]->Prototype() == nullptr);
+
+  CHECK(ents[2]->InstanceOffset()[0] == 256);
+  CHECK(ents[2]->GetMin()[0] == ents[1]->GetMin()[0] + 256);
+  CHECK(ents[2]->GetMax()[2] == ents[1]->GetMax()[2]);
+
+  // the instance is not built, the provider moves the prototype's meshes
+  for (const auto &b : ents[2]->Brushes()) {
+    for (const auto &f : b.Faces())
+      CHECK(f->Vertices().empty());
+  }
+
+  map::QMap plain;
+  plain.LoadBuffer(buffer.c_str(), [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  plain.GenerateGeometry();
+  CHECK(plain.SolidEntities()[2]->Prototype() == nullptr);
+  CHECK(plain.SolidEntities()[2]->GetMin()[0] == ents[2]->GetMin()[0]);
+}
+
+TEST_CASE("provider instances", "[map/instancing]") {
+  auto path = std::filesystem::temp_directory_path() / "quakelib_instances.map";
+  std::ofstream(path) << "{\n\"mapversion\" \"220\"\n\"classname\" \"worldspawn\"\n}\n" + funcWall(0) +
+                             funcWall(256);
+
+  map::QMapConfig cfg;
+  cfg.instanceBrushEntities = true;
+  QMapProvider provider;
+  REQUIRE(provider.Load(path.string(), cfg));
+  provider.SetTextureBoundsProvider([](const std::string &) { return std::make_pair(128, 128); });
+  provider.GenerateGeometry();
+  std::filesystem::remove(path);
+
+  auto instances = provider.GetEntityInstances();
+  REQUIRE(instances.size() == 1);
+  CHECK(instances[0].entity == 2);
+  CHECK(instances[0].prototype == 1);
+  CHECK(instances[0].offset[0] == 256);
+
+  // the prototype is built once and shared, the instance has no copy of it
+  auto ents = provider.GetSolidEntities();
+  auto first = provider.GetEntityMeshes(ents[1]);
+  REQUIRE_FALSE(first.empty());
+  CHECK(provider.GetEntityMeshes(ents[2]).empty());
+
+  auto second = provider.GetEntityMeshes(ents[1]);
+  REQUIRE(second.size() == first.size());
+  for (size_t i = 0; i < first.size(); i++) {
+    CHECK(second[i].indices == first[i].indices);
+    CHECK(second[i].vertices.size() == first[i].vertices.size());
+  }
+}
+
+TEST_CASE("provider merge keeps corners of other textures", "[map/provider]") {
+  // two floor brushes side by side, their back faces use another texture
+  auto path = std::filesystem::temp_directory_path() / "quakelib_merge_groups.map";
+  std::ofstream(path) << "{\n\"mapversion\" \"220\"\n\"classname\" \"worldspawn\"\n" +
+                             boxBrush({0, 0, -16}, {64, 64, 0}, "128_red_1") +
+                             boxBrush({64, 0, -16}, {128, 64, 0}, "128_red_1") + "}\n";
+
+  map::QMapConfig cfg;
+  cfg.mergeCoplanarFaces = true;
+  QMapProvider provider;
+  REQUIRE(provider.Load(path.string(), cfg));
+  provider.SetTextureBoundsProvider([](const std::string &) { return std::make_pair(128, 128); });
+  provider.GenerateGeometry();
+  std::filesystem::remove(path);
+
+  // the floor top merges into one face but keeps the corner the back faces meet at
+  auto meshes = provider.GetEntityMeshes(provider.GetSolidEntities()[0]);
+  REQUIRE(meshes.size() == 2);
+  const auto &floor = meshes[0].textureName == "128_cyan_1" ? meshes[0] : meshes[1];
+  bool keepsCorner = false;
+  for (const auto &v : floor.vertices)
+    keepsCorner |= v.point[0] == 64 && v.point[1] == 64 && v.point[2] == 0;
+  CHECK(keepsCorner);
+}
+
+TEST_CASE("lightmap instance occluders", "[map/instancing]") {
+  // a floor with the wall and an instance of it 256 units further
+  std::string buffer = "{\n\"mapversion\" \"220\"\n\"classname\" \"worldspawn\"\n" +
+                       boxBrush({0, -256, -32}, {768, 256, -16}) + "}\n" + funcWall(0) + funcWall(256);
+
+  map::QMapConfig cfg;
+  cfg.instanceBrushEntities = true;
+  map::QMap m(cfg);
+  m.LoadBuffer(buffer.c_str(), [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  m.GenerateGeometry();
+  REQUIRE(m.SolidEntities()[2]->Prototype() == m.SolidEntities()[1]);
+
+  map::LightmapGenerator lmGen(1024, 1024, 16.0f);
+  REQUIRE(lmGen.Pack(m.SolidEntities()));
+  map::LightmapGenerator::OcclusionSettings settings;
+  settings.samples = 32;
+  lmGen.CalculateOcclusion(settings);
+
+  // floor luxels next to the instance only see the instance within the occlusion distance
+  const auto &luxels = lmGen.Luxels();
+  bool occluded = false;
+  for (size_t i = 0; i < luxels.Size(); i++) {
+    const Vec3 &p = luxels.position[i];
+    if (luxels.normal[i][2] > 0.5f && p[0] > 480 && p[0] < 500 && std::fabs(p[1]) < 128)
+      occluded |= lmGen.Occlusion()[i] < 1.0f;
+  }
+  CHECK(occluded);
+}
+
+TEST_CASE("lightmap failed pack after lighting", "[map/lightmap]") {
+  auto worldspawn = [](Vec3 mins, Vec3 maxs) {
+    return "{\n\"mapversion\" \"220\"\n\"classname\" \"worldspawn\"\n" + boxBrush(mins, maxs) + "}\n";
+  };
+  std::string small = worldspawn({0, 0, 0}, {32, 32, 32});
+  std::string large = worldspawn({0, 0, 0}, {4096, 4096, 32});
+
+  map::QMap smallMap;
+  smallMap.LoadBuffer(small.c_str(), [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  smallMap.GenerateGeometry();
+  map::QMap largeMap;
+  largeMap.LoadBuffer(large.c_str(), [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  largeMap.GenerateGeometry();
+
+  map::LightmapGenerator gen(64, 64, 16.0f);
+  REQUIRE(gen.Pack(smallMap.SolidEntities()));
+  gen.CalculateLighting({{{16, 16, 64}, 128, {1, 1, 1}}});
+  CHECK(gen.Luxels().Size() > 0);
+
+  // the failed pack drops the old entries and luxels instead of keeping stale offsets
+  CHECK_FALSE(gen.Pack(largeMap.SolidEntities()));
+  CHECK(gen.Entries().empty());
+  CHECK(gen.Luxels().Size() == 0);
+  CHECK(gen.Occlusion().empty());
+
+  // nothing is packed, so the new light relights no entry and only the ambient level is left
+  CHECK(gen.AddLight({{16, 16, 64}, 128, {1, 1, 1}}) == 0);
+  CHECK(gen.GetAtlasData().size() == 64 * 64 * 4);
+  CHECK(gen.CalculateBounces({}) == 0);
+}
+
+TEST_CASE("outside fill", "[map/outside]") {
+  // a 256 unit room with 16 unit walls, optionally without its ceiling
+  auto room = [](bool ceiling) {
+    std::string out = "{\n\"mapversion\" \"220\"\n\"classname\" \"worldspawn\"\n";
+    out += boxBrush({-144, -144, -16}, {144, 144, 0});
+    if (ceiling)
+      out += boxBrush({-144, -144, 256}, {144, 144, 272});
+    out += boxBrush({-144, -144, 0}, {-128, 144, 256});
+    out += boxBrush({128, -144, 0}, {144, 144, 256});
+    out += boxBrush({-128, -144, 0}, {128, -128, 256});
+    out += boxBrush({-128, 128, 0}, {128, 144, 256});
+    return out + "}\n{\n\"classname\" \"info_player_start\"\n\"origin\" \"0 0 24\"\n}\n";
+  };
+  auto faceCount = [](const map::QMap &m) {
+    size_t count = 0;
+    for (const auto &b : m.SolidEntities()[0]->Brushes())
+      count += b.Faces().size();
+    return count;
+  };
+
+  map::QMapConfig cfg;
+  cfg.outsideFill = true;
+
+  std::string sealed = room(true);
+  map::QMap m(cfg);
+  m.LoadBuffer(sealed.c_str(), [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  m.GenerateGeometry();
+
+  const auto &fill = m.OutsideFill();
+  CHECK(fill.ran);
+  CHECK_FALSE(fill.leaked);
+  CHECK(fill.removedFaces > 0);
+
+  // only the six quads of the room's interior are left, triangulated by the CSG pass
+  CHECK(faceCount(m) == 6 * 2);
+  for (const auto &b : m.SolidEntities()[0]->Brushes()) {
+    for (const auto &f : b.Faces()) {
+      const auto &verts = f->Vertices();
+      Vec3 centre = (verts[0].point + verts[1].point + verts[2].point) / 3.0f;
+      CHECK(std::fabs(centre[0]) <= 128);
+      CHECK(std::fabs(centre[1]) <= 128);
+      CHECK(centre[2] >= 0);
+      CHECK(centre[2] <= 256);
+    }
+  }
+
+  // without the ceiling the player start leaks, the path ends outside the walls
+  std::string open = room(false);
+  map::QMap leaky(cfg);
+  leaky.LoadBuffer(open.c_str(), [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  leaky.GenerateGeometry();
+
+  const auto &leak = leaky.OutsideFill();
+  CHECK(leak.leaked);
+  CHECK(leak.leakEntity == "info_player_start");
+  CHECK(leak.removedFaces == 0);
+  REQUIRE(leak.leakPath.size() > 1);
+  CHECK(leak.leakPath.back()[2] > 256);
+
+  map::QMap unfilled;
+  unfilled.LoadBuffer(open.c_str(), [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  unfilled.GenerateGeometry();
+  CHECK(faceCount(leaky) == faceCount(unfilled));
+}
+
+TEST_CASE("outside fill keeps large faces bordering the inside", "[map/outside]") {
+  // a long floor slab covered by solid blocks at its centre and both ends, only the stretch between
+  // the centre block and the right end faces the room
+  std::string buffer = "{\n\"mapversion\" \"220\"\n\"classname\" \"worldspawn\"\n";
+  buffer += boxBrush({-512, -128, -16}, {512, 128, 0});
+  buffer += boxBrush({-512, -128, 0}, {96, 128, 272});
+  buffer += boxBrush({384, -128, 0}, {512, 128, 272});
+  buffer += boxBrush({96, -128, 0}, {384, -112, 256});
+  buffer += boxBrush({96, 112, 0}, {384, 128, 256});
+  buffer += boxBrush({96, -112, 256}, {384, 112, 272});
+  buffer += "}\n{\n\"classname\" \"info_player_start\"\n\"origin\" \"240 0 24\"\n}\n";
+
+  // without CSG the slab keeps its whole top face, its centre and corners lie under the blocks
+  map::QMapConfig cfg;
+  cfg.csg = false;
+  cfg.outsideFill = true;
+  map::QMap m(cfg);
+  m.LoadBuffer(buffer.c_str(), [&](const char *textureName) { return map::textureBounds{128, 128}; });
+  m.GenerateGeometry();
+
+  const auto &fill = m.OutsideFill();
+  REQUIRE(fill.ran);
+  CHECK_FALSE(fill.leaked);
+  CHECK(fill.removedFaces > 0);
+
+  bool top = false;
+  for (const auto &f : m.SolidEntities()[0]->Brushes()[0].Faces()) {
+    bool onTop = true;
+    for (const auto &v : f->Vertices())
+      onTop &= v.point[2] == 0;
+    top |= onTop;
+  }
+  CHECK(top);
+}
@@ -1,7 +1,9 @@
 #include "../../src/wrapper.h"
 #include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <quakelib/map/qmap_provider.h>
 #include <snitch/snitch.hpp>
 #include <string>
 
@@ -337,15 +339,96 @@ TEST_CASE("Wrapper API - Load WAD file", "[wrapper][wad]") {
   }
 }
 
+TEST_CASE("Wrapper API - BSP meshlets", "[wrapper][bsp]") {
+  void *bsp = QLibBsp_Load("tests/data/box_split.bsp", 1, 0, 0);
+  REQUIRE(bsp != nullptr);
+
+  QLibBspEntityMesh *mesh = QLibBsp_GetEntityMesh(bsp, 0);
+  QLibMeshletData *meshlets = QLibBsp_GetEntityMeshlets(bsp, 0);
+  REQUIRE(mesh != nullptr);
+  REQUIRE(meshlets != nullptr);
+  REQUIRE(meshlets->meshletCount > 0);
+  CHECK(meshlets->triangleCount * 3 == mesh->totalIndexCount);
+
+  for (uint32_t i = 0; i < meshlets->meshletCount; i++) {
+    const QLibMeshlet &m = meshlets->meshlets[i];
+    CHECK(m.submeshIndex < mesh->submeshCount);
+    CHECK(m.vertexCount <= 64);
+    CHECK(m.triangleCount <= 124);
+    for (uint32_t t = 0; t < m.triangleCount * 3; t++) {
+      uint8_t local = meshlets->triangles[m.triangleOffset * 3 + t];
+      REQUIRE(local < m.vertexCount);
+      CHECK(meshlets->vertices[m.vertexOffset + local] < mesh->totalVertexCount);
+    }
+  }
+
+  CHECK(QLibBsp_GetEntityMeshlets(bsp, 9999) == nullptr);
+
+  QLib_FreeMeshlets(meshlets);
+  QLibBsp_FreeMesh(mesh);
+  QLibBsp_Destroy(bsp);
+}
+
+TEST_CASE("Wrapper API - MAP instances", "[wrapper][map]") {
+  // the same func_wall twice, a whole texture apart so the second one becomes an instance
+  auto wall = [](int x) {
+    // A and B stand for the wall's min and max x
+    const char *faces[6] = {"( A 144 240 ) ( A -240 240 ) ( A 144 -16 ) [ 0 1 0 0 ] [ 0 0 -1 0 ]",
+                            "( B -240 -16 ) ( A -240 -16 ) ( B -240 240 ) [ 1 0 0 0 ] [ 0 0 -1 0 ]",
+                            "( B 144 -16 ) ( A 144 -16 ) ( B -240 -16 ) [ -1 0 0 0 ] [ 0 -1 0 0 ]",
+                            "( B -240 240 ) ( A -240 240 ) ( B 144 240 ) [ 1 0 0 0 ] [ 0 -1 0 0 ]",
+                            "( B 144 240 ) ( A 144 240 ) ( B 144 -16 ) [ -1 0 0 0 ] [ 0 0 -1 0 ]",
+                            "( B -240 240 ) ( B 144 240 ) ( B -240 -16 ) [ 0 1 0 0 ] [ 0 0 -1 0 ]"};
+    std::string out = "{\n\"classname\" \"func_wall\"\n{\n";
+    for (const char *face : faces) {
+      std::string line = face;
+      line.insert(line.find('['), "128_cyan_1 ");
+      for (size_t at; (at = line.find_first_of("AB")) != std::string::npos;)
+        line.replace(at, 1, std::to_string(line[at] == 'A' ? x : x + 16));
+      out += line + " 0 1 1\n";
+    }
+    return out + "}\n}\n";
+  };
+  auto path = std::filesystem::temp_directory_path() / "quakelib_wrapper_instances.map";
+  std::ofstream(path) << "{\n\"mapversion\" \"220\"\n\"classname\" \"worldspawn\"\n}\n" + wall(208) +
+                             wall(464);
+
+  // the wrapper loads without instancing, hand it a provider configured for it
+  quakelib::map::QMapConfig cfg;
+  cfg.instanceBrushEntities = true;
+  quakelib::QMapProvider provider;
+  REQUIRE(provider.Load(path.string(), cfg));
+  std::filesystem::remove(path);
+  provider.SetTextureBoundsProvider([](const std::string &) { return std::make_pair(128, 128); });
+  provider.GenerateGeometry();
+
+  QLibMapData *data = QLibMap_ExportAll(&provider);
+  REQUIRE(data != nullptr);
+  REQUIRE(data->solidEntityCount == 3);
+  CHECK(data->solidEntities[0].prototypeIndex == -1);
+  CHECK(data->solidEntities[1].prototypeIndex == -1);
+  CHECK(data->solidEntities[2].prototypeIndex == 1);
+  CHECK(data->solidEntities[2].instanceOffset.x == 256);
+  QLibMap_FreeData(data);
+
+  QLibMapEntityMesh *mesh = QLibMap_GetEntityMesh(&provider, 2);
+  REQUIRE(mesh != nullptr);
+  CHECK(mesh->prototypeIndex == 1);
+  QLibMap_FreeMesh(mesh);
+}
+
 TEST_CASE("Wrapper API - NULL safety", "[wrapper]") {
   SECTION("NULL pointers are handled") {
     CHECK(QLibMap_ExportAll(nullptr) == nullptr);
     CHECK(QLibMap_GetEntityMesh(nullptr, 0) == nullptr);
+    CHECK(QLibMap_GetEntityMeshlets(nullptr, 0) == nullptr);
+    CHECK(QLibBsp_GetEntityMeshlets(nullptr, 0) == nullptr);
     CHECK(QLibWad_ExportAll(nullptr) == nullptr);
     CHECK(QLibWad_GetTexture(nullptr, "test") == nullptr);
 
     // These should not crash
     QLibMap_FreeMesh(nullptr);
+    QLib_FreeMeshlets(nullptr);
     QLibMap_FreeData(nullptr);
     QLibMap_Destroy(nullptr);
     QLibWad_FreeTexture(nullptr);
@@ -58,7 +58,8 @@ Texture2D MapBuilder::generateLightmapAtlas(quakelib::IMapProviderPtr provider)
     img.width = existingLm->width;
     img.height = existingLm->height;
     img.mipmaps = 1;
-    img.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+    img.format =
+        existingLm->channels == 1 ? PIXELFORMAT_UNCOMPRESSED_GRAYSCALE : PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
 
     Texture2D tex = LoadTextureFromImage(img);
     UnloadImage(img);